@@ -0,0 +1,306 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Allen Institute for Brain Science and Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __ACTIONPOTENTIALTRAIN_H__
+#define __ACTIONPOTENTIALTRAIN_H__
+
+#include "SampleClock.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/* Piece-wise linear action potential: start of each phase from the onset (the spike ends when the
+   hyperpolarization returns to rest), and the refractory period after it ends */
+#define DEPOLARIZATION_START_TIME_IN_MS 0.8f
+#define REPOLARIZATION_START_TIME_IN_MS 1.3f
+#define HYPERPOLARIZATION_START_TIME_IN_MS 1.8f
+#define REFRACTORY_PERIOD_DURATION_IN_MS 5.0f
+
+#define RESTING_MEMBRANE_POTENTIAL_IN_MV 10.0f
+#define THRESHOLD_POTENTIAL_IN_MV -25.0f
+#define PEAK_DEPOLARIZATION_POTENTIAL_IN_MV -100.0f
+
+/* Spike source of an action potential train */
+struct SpikeTrainSettings
+{
+	int trigger;          // ActionPotentialTrain::Trigger
+	float rate;           // Hz, mean rate of the rate process before refractory losses; 0 = silent
+	float channelDelay;   // ms of conduction delay per electrode
+};
+
+/* Default train: one spike per TTL rising edge, 10 us of conduction delay per electrode */
+#define DEFAULT_SPIKE_TRAIN SpikeTrainSettings{ 0, 10.0f, 0.01f }
+
+/**
+
+	Event-driven action potential train.
+
+	Spikes start at exact sample indices: the rising edges of the TTL line, or a Poisson rate
+	process whose intervals are hashed per spike. A spike that would start before the previous
+	one has ended and its refractory period has passed is dropped. Each channel sees a spike
+	after the conduction delay of its electrode.
+
+	The action potential is tabulated once. A packet only writes the samples a spike covers and
+	clears the ones the previous packet's spikes covered, so samples between spikes cost nothing
+	and a render's cost does not depend on the packet length.
+
+*/
+
+class ActionPotentialTrain
+{
+public:
+
+	enum Trigger { TTL_TRIGGER = 0, RATE_TRIGGER };
+
+	ActionPotentialTrain() : sampleRate(30000.0f), numChannels(0), refractorySamples(0), maxDelay(0),
+		seed(0), trigger(TTL_TRIGGER), rate(0.0f), lastOnset(0), ttlHigh(false), nextRateSpike(0),
+		rateSpikes(0), drawnFirst(0), drawnSamples(0), clearAll(true)
+	{
+	}
+
+	/* Restarts the train at sample 0: no spike in flight, TTL low, rate process at its first spike.
+	   channelMap gives the electrode of each channel, or is null when every electrode is generated
+	   in order. The next render clears its whole packet */
+	void prepare(float rate_, int channels, const int* channelMap, uint32_t seed_, const SpikeTrainSettings& settings)
+	{
+		sampleRate = rate_;
+		numChannels = channels;
+		seed = seed_;
+		trigger = settings.trigger == RATE_TRIGGER ? RATE_TRIGGER : TTL_TRIGGER;
+		rate = std::max(0.0f, settings.rate);
+
+		buildWaveform();
+
+		delays.resize((size_t)std::max(0, numChannels));
+		maxDelay = 0;
+
+		for (int j = 0; j < numChannels; j++)
+		{
+			const int electrode = channelMap != nullptr ? channelMap[j] : j;
+			delays[(size_t)j] = (int)std::lround(electrode * settings.channelDelay * sampleRate / 1000.0f);
+			maxDelay = std::max(maxDelay, delays[(size_t)j]);
+		}
+
+		spikes.clear();
+		drawn.clear();
+		lastOnset = INT64_MIN;
+		ttlHigh = false;
+		rateSpikes = 0;
+		nextRateSpike = rate > 0.0f ? drawInterval() : INT64_MAX;
+		clearAll = true;
+	}
+
+	/* Samples of one action potential, and the samples after it in which no spike may start */
+	int getLength() const { return (int)waveform.size(); }
+	int getRefractorySamples() const { return refractorySamples; }
+
+	const float* getWaveform() const { return waveform.data(); }
+
+	/* Conduction delay of a channel, in samples */
+	int getDelay(int channel) const { return delays[(size_t)channel]; }
+
+	/* Starts a spike at onset unless it falls within the previous spike or its refractory period.
+	   Onsets must not decrease; returns true if the spike was scheduled */
+	bool schedule(int64_t onset)
+	{
+		if (lastOnset != INT64_MIN && onset < lastOnset + (int64_t)waveform.size() + refractorySamples)
+			return false;
+
+		spikes.push_back(onset);
+		lastOnset = onset;
+
+		return true;
+	}
+
+	/* In TTL mode, schedules a spike at every rising edge of line 0 in the packet whose codes are given
+	   (filled by clock). Edges inside the packet come from the clock; of the codes only the first and
+	   last are read, for an edge on the first sample (including the line switching on) and the level
+	   at the end */
+	template <typename CodeType>
+	void scheduleRisingEdges(const SampleClock& clock, const CodeType* codes, int64_t first, int count, bool enabled)
+	{
+		if (trigger != TTL_TRIGGER || count <= 0)
+			return;
+
+		if ((codes[0] & 1) != 0 && !ttlHigh)
+			schedule(first);
+
+		if (enabled)
+			clock.forEachRisingEdge(first + 1, count - 1, [this](int64_t n) { schedule(n); });
+
+		ttlHigh = (codes[count - 1] & 1) != 0;
+	}
+
+	/**
+		Writes samples [first, first + numSamples) into dest, interleaved [sample][channel], after
+		scheduling the rate process's spikes up to the end of the packet. dest must still hold what
+		the previous render wrote (the packet buffer of a source): only the samples covered by a
+		spike are written, all others are left at zero.
+	*/
+	void render(float* dest, int numSamples, int64_t first)
+	{
+		const int64_t end = first + numSamples;
+
+		if (clearAll)
+		{
+			std::fill(dest, dest + (size_t)numSamples * numChannels, 0.0f);
+			clearAll = false;
+		}
+		else
+		{
+			const int64_t drawnEnd = drawnFirst + std::min(drawnSamples, numSamples);
+
+			for (int64_t onset : drawn)
+				cover(dest, onset, drawnFirst, drawnEnd, nullptr);
+		}
+
+		if (trigger == RATE_TRIGGER)
+		{
+			while (nextRateSpike < end)
+			{
+				schedule(nextRateSpike);
+				nextRateSpike += drawInterval();
+			}
+		}
+
+		drawn.clear();
+
+		for (int64_t onset : spikes)
+		{
+			if (onset >= end)
+				break;
+
+			cover(dest, onset, first, end, waveform.data());
+			drawn.push_back(onset);
+		}
+
+		drawnFirst = first;
+		drawnSamples = numSamples;
+
+		//Spikes that have passed every channel are done
+		size_t done = 0;
+		while (done < spikes.size() && spikes[done] + maxDelay + (int64_t)waveform.size() <= end)
+			done++;
+
+		spikes.erase(spikes.begin(), spikes.begin() + (std::ptrdiff_t)done);
+	}
+
+private:
+
+	/* Writes values (or zeros, if null) over the samples of [first, end) a spike covers on every channel */
+	void cover(float* dest, int64_t onset, int64_t first, int64_t end, const float* values) const
+	{
+		const int64_t length = (int64_t)waveform.size();
+
+		for (int j = 0; j < numChannels; j++)
+		{
+			const int64_t start = onset + delays[(size_t)j];
+			const int64_t from = std::max(start, first);
+			const int64_t to = std::min(start + length, end);
+
+			for (int64_t n = from; n < to; n++)
+				dest[(size_t)(n - first) * numChannels + j] = values != nullptr ? values[n - start] : 0.0f;
+		}
+	}
+
+	/* Exponential interval to the next spike of the rate process (hashed per spike, so deterministic) */
+	int64_t drawInterval()
+	{
+		uint64_t z = ((uint64_t)seed << 32) + (rateSpikes++ + 1) * 0x9E3779B97F4A7C15ULL;
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		z ^= z >> 31;
+
+		const double u = ((double)(z >> 11) + 0.5) / 9007199254740992.0;
+		return std::max((int64_t)1, (int64_t)(-std::log(u) * sampleRate / rate));
+	}
+
+	/* Rest, ramp to threshold, depolarization to the peak, repolarization back to rest; one entry per sample */
+	void buildWaveform()
+	{
+		const int length = std::max(1, (int)(HYPERPOLARIZATION_START_TIME_IN_MS * sampleRate / 1000.0f));
+		waveform.resize((size_t)length);
+
+		for (int i = 0; i < length; i++)
+		{
+			const float time = 1000.0f * (float)i / sampleRate;
+			float value;
+
+			if (time < DEPOLARIZATION_START_TIME_IN_MS)
+			{
+				value = RESTING_MEMBRANE_POTENTIAL_IN_MV + (THRESHOLD_POTENTIAL_IN_MV - RESTING_MEMBRANE_POTENTIAL_IN_MV)
+					* time / DEPOLARIZATION_START_TIME_IN_MS;
+			}
+			else if (time < REPOLARIZATION_START_TIME_IN_MS)
+			{
+				value = THRESHOLD_POTENTIAL_IN_MV + (PEAK_DEPOLARIZATION_POTENTIAL_IN_MV - THRESHOLD_POTENTIAL_IN_MV)
+					* (time - DEPOLARIZATION_START_TIME_IN_MS) / (REPOLARIZATION_START_TIME_IN_MS - DEPOLARIZATION_START_TIME_IN_MS);
+			}
+			else
+			{
+				value = PEAK_DEPOLARIZATION_POTENTIAL_IN_MV + (RESTING_MEMBRANE_POTENTIAL_IN_MV - PEAK_DEPOLARIZATION_POTENTIAL_IN_MV)
+					* (time - REPOLARIZATION_START_TIME_IN_MS) / (HYPERPOLARIZATION_START_TIME_IN_MS - REPOLARIZATION_START_TIME_IN_MS);
+			}
+
+			waveform[(size_t)i] = value;
+		}
+
+		refractorySamples = (int)(REFRACTORY_PERIOD_DURATION_IN_MS * sampleRate / 1000.0f);
+	}
+
+	float sampleRate;
+	int numChannels;
+
+	std::vector<float> waveform;
+	int refractorySamples;
+
+	/* Conduction delay of every channel, in samples */
+	std::vector<int> delays;
+	int maxDelay;
+
+	uint32_t seed;
+	Trigger trigger;
+	float rate;
+
+	/* Onsets of the spikes still reaching some channel, oldest first, and of the last one scheduled */
+	std::vector<int64_t> spikes;
+	int64_t lastOnset;
+
+	/* TTL level at the end of the last packet */
+	bool ttlHigh;
+
+	int64_t nextRateSpike;
+	uint64_t rateSpikes;
+
+	/* Spikes written into the last packet, and its range: the next render clears exactly their samples */
+	std::vector<int64_t> drawn;
+	int64_t drawnFirst;
+	int drawnSamples;
+	bool clearAll;
+
+};
+
+#endif  // __ACTIONPOTENTIALTRAIN_H__
@@ -0,0 +1,398 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Allen Institute for Brain Science and Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __BACKGROUNDNOISE_H__
+#define __BACKGROUNDNOISE_H__
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+/* Power-law background activity (e.g. LFP) shared by neighbouring sites */
+struct BackgroundSettings
+{
+	float rms;                // uV per channel; 0 disables
+	float exponent;           // power spectral density falls as 1 / f^exponent
+	float correlationLength;  // um, Gaussian spatial correlation between sites; 0 = independent channels
+
+	bool isEnabled() const { return rms > 0.0f; }
+};
+
+/* Default LFP background: 40 uV rms, 1/f^2 power, correlated over ~200 um */
+#define DEFAULT_LFP_BACKGROUND BackgroundSettings{ 40.0f, 2.0f, 200.0f }
+
+/* Channels mixed per rendering step of SpectralBlockSynth */
+#define SPECTRAL_MIX_CHANNELS 32
+
+/* In-place radix-2 complex FFT; tables are built once per size */
+class Fft
+{
+public:
+
+	Fft() : size(0) {}
+
+	void setSize(int n)
+	{
+		size = n;
+		cosTable.resize(n / 2);
+		sinTable.resize(n / 2);
+		reversed.resize(n);
+
+		for (int i = 0; i < n / 2; i++)
+		{
+			cosTable[i] = (float)std::cos(6.283185307179586 * i / n);
+			sinTable[i] = (float)std::sin(6.283185307179586 * i / n);
+		}
+
+		int bits = 0;
+		while ((1 << bits) < n)
+			bits++;
+
+		for (int i = 0; i < n; i++)
+		{
+			int r = 0;
+			for (int b = 0; b < bits; b++)
+				r |= ((i >> b) & 1) << (bits - 1 - b);
+			reversed[i] = r;
+		}
+	}
+
+	int getSize() const { return size; }
+
+	/* Forward (e^-i) or unscaled inverse (e^+i) transform */
+	void transform(float* re, float* im, bool inverse) const
+	{
+		for (int i = 0; i < size; i++)
+		{
+			if (i < reversed[i])
+			{
+				std::swap(re[i], re[reversed[i]]);
+				std::swap(im[i], im[reversed[i]]);
+			}
+		}
+
+		const float sign = inverse ? 1.0f : -1.0f;
+
+		for (int length = 2; length <= size; length *= 2)
+		{
+			const int half = length / 2;
+			const int step = size / length;
+
+			for (int start = 0; start < size; start += length)
+			{
+				for (int k = 0; k < half; k++)
+				{
+					const float wr = cosTable[k * step];
+					const float wi = sign * sinTable[k * step];
+					const int a = start + k;
+					const int b = a + half;
+
+					const float tr = re[b] * wr - im[b] * wi;
+					const float ti = re[b] * wi + im[b] * wr;
+
+					re[b] = re[a] - tr;
+					im[b] = im[a] - ti;
+					re[a] += tr;
+					im[a] += ti;
+				}
+			}
+		}
+	}
+
+private:
+
+	int size;
+	std::vector<float> cosTable;
+	std::vector<float> sinTable;
+	std::vector<int> reversed;
+};
+
+/**
+
+	Synthesises blocks of spatially correlated 1/f^exponent noise for overlap-add.
+
+	Block k covers samples [k * hop, k * hop + length) with hop = length / 2. Each block is
+	white Gaussian noise shaped in the frequency domain (two nodes per complex FFT) at a
+	sparse set of sites about half a correlation length apart, mixed onto every channel
+	with a Gaussian kernel over nearby nodes and multiplied by a sine window;
+	since sin^2 + cos^2 = 1, consecutive half-overlapping blocks add up to stationary noise
+	of the requested rms. A block depends only on its index, the seed and the configuration,
+	so blocks can be rendered ahead of time on any thread, in any order.
+
+	A block can also be rendered a few steps at a time (renderStep): one step shapes a pair of
+	nodes, one mixes a group of channels. The steps of a block must run in order, without steps
+	of another block in between.
+
+*/
+
+class SpectralBlockSynth
+{
+public:
+
+	SpectralBlockSynth() : length(0), numChannels(0), seed(0), rms(0.0f) {}
+
+	/* Channel positions are (x, y) in um per generated channel; electrodes key the random numbers */
+	void configure(const BackgroundSettings& settings, float sampleRate, uint64_t seed_,
+		const std::vector<float>& positions, const std::vector<int>& electrodes)
+	{
+		seed = seed_;
+		rms = settings.rms;
+		numChannels = (int)electrodes.size();
+		channelElectrode = electrodes;
+
+		length = getBlockLength(sampleRate);
+
+		fft.setSize(length);
+
+		//Amplitude gain per bin, flat below the first bin, no DC; normalised to unit output variance
+		gain.assign(length, 0.0f);
+		double power = 0.0;
+
+		for (int i = 1; i < length; i++)
+		{
+			const int bin = std::min(i, length - i);
+			gain[i] = std::pow((float)bin, -0.5f * settings.exponent);
+			power += gain[i] * gain[i];
+		}
+
+		const float norm = power > 0.0 ? (float)std::sqrt(length / power) : 0.0f;
+		for (float& g : gain)
+			g *= norm;
+
+		window.resize(length);
+		for (int i = 0; i < length; i++)
+			window[i] = (float)std::sin(3.141592653589793 * (i + 0.5) / length);
+
+		buildKernel(settings.correlationLength, positions);
+
+		re.resize(length);
+		im.resize(length);
+		shaped.resize((size_t)length * nodes.size());
+		group.resize((size_t)length * SPECTRAL_MIX_CHANNELS);
+	}
+
+	/* About 0.4 s per block: enough spectral resolution for the LFP band, bounded memory at 30 kHz */
+	static int getBlockLength(float sampleRate)
+	{
+		int n = 256;
+		while (n < 2048 && n < 0.4f * sampleRate)
+			n *= 2;
+		return n;
+	}
+
+	int getLength() const { return length; }
+	int getHop() const { return length / 2; }
+	int getNumChannels() const { return numChannels; }
+
+	/* Steps of renderStep per block */
+	int getNumSteps() const { return ((int)nodes.size() + 1) / 2 + (numChannels + SPECTRAL_MIX_CHANNELS - 1) / SPECTRAL_MIX_CHANNELS; }
+
+	/* Writes block k as [sample][channel], windowed and scaled */
+	void render(int64_t block, float* dest)
+	{
+		for (int step = 0; step < getNumSteps(); step++)
+			renderStep(block, step, dest);
+	}
+
+	/* Runs one step of render(block, dest) */
+	void renderStep(int64_t block, int step, float* dest)
+	{
+		const int numNodes = (int)nodes.size();
+		const int shapingSteps = (numNodes + 1) / 2;
+
+		//Shape the white noise of two nodes per transform: gain is real and even, so real and
+		//imaginary parts stay independent filtered real signals
+		if (step < shapingSteps)
+		{
+			const int c = 2 * step;
+			const bool pair = c + 1 < numNodes;
+
+			//Both values of a Box-Muller draw: one node takes the cosine, its pair the sine
+			const int electrode = channelElectrode[nodes[c]];
+
+			for (int i = 0; i < length; i++)
+				gaussianPair(block, i, electrode, re[i], im[i]);
+
+			if (!pair)
+				std::fill(im.begin(), im.end(), 0.0f);
+
+			fft.transform(re.data(), im.data(), false);
+
+			for (int i = 0; i < length; i++)
+			{
+				re[i] *= gain[i];
+				im[i] *= gain[i];
+			}
+
+			fft.transform(re.data(), im.data(), true);
+
+			const float scale = 1.0f / length;
+			float* a = shaped.data() + (size_t)c * length;
+
+			for (int i = 0; i < length; i++)
+				a[i] = re[i] * scale;
+
+			if (pair)
+			{
+				float* b = a + length;
+				for (int i = 0; i < length; i++)
+					b[i] = im[i] * scale;
+			}
+
+			return;
+		}
+
+		//Mix neighbouring channels and window them into a group buffer, then interleave whole
+		//rows of the group: writing dest a column at a time would miss the cache on every sample
+		const int firstChannel = (step - shapingSteps) * SPECTRAL_MIX_CHANNELS;
+		const int groupChannels = std::min(numChannels - firstChannel, SPECTRAL_MIX_CHANNELS);
+
+		for (int g = 0; g < groupChannels; g++)
+		{
+			const int c = firstChannel + g;
+			std::fill(re.begin(), re.end(), 0.0f);
+
+			for (int k = kernelStart[c]; k < kernelStart[c + 1]; k++)
+			{
+				const float* source = shaped.data() + (size_t)kernelNode[k] * length;
+				const float w = kernelWeight[k] * rms;
+
+				for (int i = 0; i < length; i++)
+					re[i] += w * source[i];
+			}
+
+			for (int i = 0; i < length; i++)
+				group[(size_t)i * SPECTRAL_MIX_CHANNELS + g] = window[i] * re[i];
+		}
+
+		for (int i = 0; i < length; i++)
+			std::memcpy(dest + (size_t)i * numChannels + firstChannel, group.data() + (size_t)i * SPECTRAL_MIX_CHANNELS, groupChannels * sizeof(float));
+	}
+
+private:
+
+	/* Picks the nodes (channels at least half a correlation length apart; every channel if the
+	   channels are independent) and the Gaussian weights of the nodes within two correlation
+	   lengths of each channel, normalised to unit variance */
+	void buildKernel(float correlationLength, const std::vector<float>& positions)
+	{
+		const bool correlated = correlationLength > 0.0f && positions.size() >= 2 * (size_t)numChannels;
+		const float spacing = 0.5f * correlationLength;
+
+		nodes.clear();
+
+		for (int c = 0; c < numChannels; c++)
+		{
+			bool covered = false;
+
+			for (size_t n = 0; correlated && n < nodes.size() && !covered; n++)
+			{
+				const float dx = positions[2 * c] - positions[2 * nodes[n]];
+				const float dy = positions[2 * c + 1] - positions[2 * nodes[n] + 1];
+				covered = dx * dx + dy * dy < spacing * spacing;
+			}
+
+			if (!covered)
+				nodes.push_back(c);
+		}
+
+		kernelStart.assign(1, 0);
+		kernelNode.clear();
+		kernelWeight.clear();
+
+		for (int c = 0; c < numChannels; c++)
+		{
+			double sum = 0.0;
+			const size_t first = kernelWeight.size();
+
+			for (int n = 0; n < (int)nodes.size(); n++)
+			{
+				float w = c == nodes[n] ? 1.0f : 0.0f;
+
+				if (correlated)
+				{
+					const float dx = positions[2 * c] - positions[2 * nodes[n]];
+					const float dy = positions[2 * c + 1] - positions[2 * nodes[n] + 1];
+					const float r2 = (dx * dx + dy * dy) / (correlationLength * correlationLength);
+					w = r2 < 4.0f ? std::exp(-0.5f * r2) : 0.0f;
+				}
+
+				if (w > 0.0f)
+				{
+					kernelNode.push_back(n);
+					kernelWeight.push_back(w);
+					sum += (double)w * w;
+				}
+			}
+
+			for (size_t k = first; k < kernelWeight.size(); k++)
+				kernelWeight[k] /= (float)std::sqrt(sum);
+
+			kernelStart.push_back((int)kernelWeight.size());
+		}
+	}
+
+	/* Two independent standard normal values (Box-Muller) for sample i of block on an electrode */
+	void gaussianPair(int64_t block, int i, int electrode, float& a, float& b) const
+	{
+		const uint64_t h = mix(((uint64_t)block << 32) + (uint64_t)i, (uint64_t)electrode);
+		const float u1 = ((float)(h >> 40) + 0.5f) / 16777216.0f;
+		const float u2 = (float)(h & 0xFFFFFF) / 16777216.0f;
+
+		const float r = std::sqrt(-2.0f * std::log(u1));
+		a = r * std::cos(6.2831853f * u2);
+		b = r * std::sin(6.2831853f * u2);
+	}
+
+	uint64_t mix(uint64_t sample, uint64_t electrode) const
+	{
+		uint64_t z = (seed ^ 0xB4C6A0D5ULL) + sample * 0x9E3779B97F4A7C15ULL + electrode * 0xD1B54A32D192ED03ULL;
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		return z ^ (z >> 31);
+	}
+
+	int length;
+	int numChannels;
+	uint64_t seed;
+	float rms;
+
+	Fft fft;
+	std::vector<float> gain;
+	std::vector<float> window;
+
+	std::vector<int> channelElectrode;
+	std::vector<int> nodes;
+	std::vector<int> kernelStart;
+	std::vector<int> kernelNode;
+	std::vector<float> kernelWeight;
+
+	std::vector<float> re;
+	std::vector<float> im;
+	std::vector<float> shaped;
+	std::vector<float> group;
+};
+
+#endif  // __BACKGROUNDNOISE_H__
@@ -0,0 +1,301 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Allen Institute for Brain Science and Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "BinaryStreamWriter.h"
+
+static char* alignPointer(char* p)
+{
+    return p + (STREAM_WRITER_ALIGNMENT - ((pointer_sized_int) p % STREAM_WRITER_ALIGNMENT)) % STREAM_WRITER_ALIGNMENT;
+}
+
+BinaryStreamWriter::BinaryStreamWriter(const File& continuousDirectory_, const File& eventDirectory_,
+    int numChannels_, float bitVolts_, int maxPacketSize, int numBlocks) :
+    Thread("Binary writer"),
+    continuousDirectory(continuousDirectory_),
+    eventDirectory(eventDirectory_),
+    numChannels(numChannels_),
+    bitVolts(bitVolts_),
+    queue(jmax(2, numBlocks) + 1),
+    currentSlot(-1),
+    lastEventCode(0),
+    samplesWritten(0),
+    droppedPackets(0)
+{
+
+    blockSamples = jmax(maxPacketSize, STREAM_WRITER_BLOCK_BYTES / (int)(sizeof(int16) * jmax(1, numChannels)));
+
+    //One slot more than the FIFO can hold, for the block being filled
+    for (int i = 0; i < queue.getTotalSize(); i++)
+    {
+        Block* b = new Block();
+
+        size_t sampleBytes = (size_t) blockSamples * numChannels * sizeof(int16);
+        sampleBytes += (STREAM_WRITER_ALIGNMENT - sampleBytes % STREAM_WRITER_ALIGNMENT) % STREAM_WRITER_ALIGNMENT;
+
+        b->memory.calloc(sampleBytes + (size_t) blockSamples * sizeof(int64) + STREAM_WRITER_ALIGNMENT);
+        char* base = alignPointer(b->memory.getData());
+        b->samples = reinterpret_cast<int16*>(base);
+        b->timestamps = reinterpret_cast<int64*>(base + sampleBytes);
+        b->numSamples = 0;
+
+        blocks.add(b);
+    }
+
+}
+
+BinaryStreamWriter::~BinaryStreamWriter()
+{
+    if (dataStream != nullptr)
+        close();
+}
+
+bool BinaryStreamWriter::open()
+{
+
+    if (continuousDirectory.createDirectory().failed() || eventDirectory.createDirectory().failed())
+        return false;
+
+    File dataFile = continuousDirectory.getChildFile("continuous.dat");
+    File timestampFile = continuousDirectory.getChildFile("timestamps.npy");
+
+    //FileOutputStream appends to existing files
+    dataFile.deleteFile();
+    timestampFile.deleteFile();
+
+    dataStream = new FileOutputStream(dataFile, 1 << 16);
+    timestampStream = new FileOutputStream(timestampFile, 1 << 16);
+
+    if (!dataStream->openedOk() || !timestampStream->openedOk())
+    {
+        dataStream = nullptr;
+        timestampStream = nullptr;
+        return false;
+    }
+
+    //Placeholder; the element count is filled in at close()
+    writeNpyHeader(*timestampStream, "<i8", 0);
+
+    startThread();
+
+    return true;
+
+}
+
+void BinaryStreamWriter::close()
+{
+
+    if (dataStream == nullptr)
+        return;
+
+    if (currentSlot >= 0 && blocks[currentSlot]->numSamples > 0)
+        commitCurrentBlock();
+
+    //The writer drains every committed block before it exits
+    signalThreadShouldExit();
+    dataReady.signal();
+    waitForThreadToExit(-1);
+
+    dataStream->flush();
+    dataStream = nullptr;
+
+    timestampStream->flush();
+    timestampStream->setPosition(0);
+    writeNpyHeader(*timestampStream, "<i8", samplesWritten);
+    timestampStream->flush();
+    timestampStream = nullptr;
+
+    writeEvents();
+
+}
+
+BinaryStreamWriter::Block* BinaryStreamWriter::getCurrentBlock(bool wait)
+{
+
+    while (currentSlot < 0)
+    {
+        int start1, size1, start2, size2;
+        queue.prepareToWrite(1, start1, size1, start2, size2);
+
+        if (size1 > 0)
+            currentSlot = start1;
+        else if (size2 > 0)
+            currentSlot = start2;
+        else if (!wait)
+            return nullptr;
+        else
+            spaceAvailable.wait(10);
+    }
+
+    return blocks[currentSlot];
+
+}
+
+void BinaryStreamWriter::commitCurrentBlock()
+{
+    queue.finishedWrite(1);
+    currentSlot = -1;
+    dataReady.signal();
+}
+
+bool BinaryStreamWriter::writePacket(const float* samples, const int64* timestamps, const uint64* eventCodes, int numSamples, bool block)
+{
+
+    Block* b = getCurrentBlock(block);
+
+    if (b != nullptr && b->numSamples + numSamples > blockSamples)
+    {
+        commitCurrentBlock();
+        b = getCurrentBlock(block);
+    }
+
+    if (b == nullptr)
+    {
+        droppedPackets++;
+        return false;
+    }
+
+    const float scale = 1.0f / bitVolts;
+    const int count = numSamples * numChannels;
+    int16* dest = b->samples + (size_t) b->numSamples * numChannels;
+
+    for (int i = 0; i < count; i++)
+    {
+        float v = samples[i] * scale;
+        v = v < -32768.0f ? -32768.0f : (v > 32767.0f ? 32767.0f : v);
+        dest[i] = (int16)(v < 0 ? v - 0.5f : v + 0.5f);
+    }
+
+    memcpy(b->timestamps + b->numSamples, timestamps, sizeof(int64) * numSamples);
+
+    //One event per TTL line transition, as the GUI's binary format stores them
+    for (int i = 0; i < numSamples; i++)
+    {
+        const uint64 code = eventCodes[i];
+
+        if (code == lastEventCode)
+            continue;
+
+        const uint64 changed = code ^ lastEventCode;
+
+        for (int line = 0; line < 8; line++)
+        {
+            if ((changed >> line) & 1)
+            {
+                eventTimestamps.push_back(timestamps[i]);
+                eventChannels.push_back((int16)(line + 1));
+                eventStates.push_back((int16)(((code >> line) & 1) ? line + 1 : -(line + 1)));
+                eventWords.push_back(code);
+            }
+        }
+
+        lastEventCode = code;
+    }
+
+    b->numSamples += numSamples;
+
+    if (b->numSamples == blockSamples)
+        commitCurrentBlock();
+
+    return true;
+
+}
+
+void BinaryStreamWriter::run()
+{
+
+    while (true)
+    {
+        int start1, size1, start2, size2;
+        queue.prepareToRead(1, start1, size1, start2, size2);
+
+        if (size1 + size2 == 0)
+        {
+            if (threadShouldExit())
+                break;
+
+            dataReady.wait(50);
+            continue;
+        }
+
+        Block* b = blocks[size1 > 0 ? start1 : start2];
+
+        dataStream->write(b->samples, (size_t) b->numSamples * numChannels * sizeof(int16));
+        timestampStream->write(b->timestamps, (size_t) b->numSamples * sizeof(int64));
+
+        samplesWritten += b->numSamples;
+        b->numSamples = 0;
+
+        queue.finishedRead(1);
+        spaceAvailable.signal();
+    }
+
+}
+
+void BinaryStreamWriter::writeNpyHeader(OutputStream& out, const String& descr, int64 numElements)
+{
+
+    String dict = "{'descr': '" + descr + "', 'fortran_order': False, 'shape': (" + String(numElements) + ",), }";
+
+    //Magic string, version 1.0, little-endian header length, then the space-padded dictionary
+    const char magic[8] = { (char) 0x93, 'N', 'U', 'M', 'P', 'Y', 1, 0 };
+    const uint16 headerLength = (uint16)(NPY_HEADER_SIZE - 10);
+
+    out.write(magic, 8);
+    out.write(&headerLength, 2);
+    out.write(dict.toRawUTF8(), dict.length());
+
+    for (int i = 10 + dict.length(); i < NPY_HEADER_SIZE - 1; i++)
+        out.write(" ", 1);
+
+    out.write("\n", 1);
+
+}
+
+void BinaryStreamWriter::writeEvents()
+{
+
+    File ttlDirectory = eventDirectory.getChildFile("TTL_1");
+    ttlDirectory.createDirectory();
+
+    struct NpyArray { const char* name; const char* descr; const void* data; size_t elementSize; };
+
+    const int64 numEvents = (int64) eventTimestamps.size();
+
+    const NpyArray arrays[] = {
+        { "timestamps.npy", "<i8", eventTimestamps.data(), sizeof(int64) },
+        { "channels.npy", "<i2", eventChannels.data(), sizeof(int16) },
+        { "channel_states.npy", "<i2", eventStates.data(), sizeof(int16) },
+        { "full_words.npy", "<u8", eventWords.data(), sizeof(uint64) }
+    };
+
+    for (auto& array : arrays)
+    {
+        File file = ttlDirectory.getChildFile(array.name);
+        file.deleteFile();
+
+        FileOutputStream out(file);
+        writeNpyHeader(out, array.descr, numEvents);
+        out.write(array.data, (size_t) numEvents * array.elementSize);
+    }
+
+}
@@ -0,0 +1,129 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Allen Institute for Brain Science and Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __BINARYSTREAMWRITER_H__
+#define __BINARYSTREAMWRITER_H__
+
+#include <DataThreadHeaders.h>
+
+#include <atomic>
+#include <vector>
+
+/* Size of one asynchronous write; large enough that the disk, not syscalls, limits throughput */
+#define STREAM_WRITER_BLOCK_BYTES (4 * 1024 * 1024)
+#define STREAM_WRITER_ALIGNMENT 4096
+
+/**
+
+	Writes one subprocessor in Open Ephys binary layout:
+
+		<continuousDirectory>/continuous.dat     int16, interleaved [sample][channel]
+		<continuousDirectory>/timestamps.npy     int64 sample number of each sample
+		<eventDirectory>/TTL_1/<array>.npy       one entry per TTL line transition
+
+	Packets are converted to int16 on the calling thread into large aligned blocks;
+	full blocks are handed to a dedicated writer thread through a bounded queue, so the
+	caller only waits when the queue is full (or, in non-blocking mode, drops the packet).
+
+*/
+
+class BinaryStreamWriter : public Thread
+{
+public:
+
+	BinaryStreamWriter(const File& continuousDirectory, const File& eventDirectory,
+		int numChannels, float bitVolts, int maxPacketSize, int numBlocks = 4);
+	~BinaryStreamWriter();
+
+	/** Creates the directories and files and starts the writer thread.*/
+	bool open();
+
+	/** Flushes queued blocks, finalizes the .npy headers and writes the TTL events.*/
+	void close();
+
+	/** Appends one packet. With block == false a packet that finds the queue full is dropped
+	    and counted instead of waiting; returns false in that case.*/
+	bool writePacket(const float* samples, const int64* timestamps, const uint64* eventCodes, int numSamples, bool block);
+
+	int64 getNumSamplesWritten() const { return samplesWritten; }
+	const File& getContinuousDirectory() const { return continuousDirectory; }
+	int64 getNumDroppedPackets() const { return droppedPackets; }
+
+	/** Counts packets the caller dropped before they reached writePacket.*/
+	void addDroppedPackets(int64 count) { droppedPackets += count; }
+
+	/** Writes the header of a one-dimensional .npy array of numElements elements.*/
+	static void writeNpyHeader(OutputStream& out, const String& descr, int64 numElements);
+
+	static const int NPY_HEADER_SIZE = 128;
+
+	void run() override;
+
+private:
+
+	struct Block
+	{
+		HeapBlock<char> memory;
+		int16* samples;
+		int64* timestamps;
+		int numSamples;
+	};
+
+	/* Returns the block being filled, claiming a free one if needed (nullptr if none free) */
+	Block* getCurrentBlock(bool wait);
+	void commitCurrentBlock();
+
+	void writeEvents();
+
+	File continuousDirectory;
+	File eventDirectory;
+
+	int numChannels;
+	float bitVolts;
+	int blockSamples;
+
+	OwnedArray<Block> blocks;
+	AbstractFifo queue;
+	int currentSlot;
+
+	WaitableEvent dataReady;
+	WaitableEvent spaceAvailable;
+
+	ScopedPointer<FileOutputStream> dataStream;
+	ScopedPointer<FileOutputStream> timestampStream;
+
+	/* TTL transitions, written once at close */
+	std::vector<int64> eventTimestamps;
+	std::vector<int16> eventChannels;
+	std::vector<int16> eventStates;
+	std::vector<uint64> eventWords;
+	uint64 lastEventCode;
+
+	std::atomic<int64> samplesWritten;
+	std::atomic<int64> droppedPackets;
+
+	JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(BinaryStreamWriter);
+
+};
+
+#endif  // __BINARYSTREAMWRITER_H__
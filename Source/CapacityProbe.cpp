@@ -0,0 +1,348 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Allen Institute for Brain Science and Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "CapacityProbe.h"
+
+CapacityProbe::Config::Config() :
+    secondsPerStep(CAPACITY_STEP_SECONDS),
+    maxProbes(getDeviceProfile(NPX1_PROBE).maxDevices)
+{
+    channelCounts.add(384);
+    channelCounts.add(768);
+    channelCounts.add(1536);
+
+    rateScales.add(1);
+    rateScales.add(2);
+    rateScales.add(4);
+}
+
+CapacityProbe::CapacityProbe(const Config& config_, const File& reportFile_) :
+    Thread("Capacity probe"),
+    config(config_),
+    reportFile(reportFile_),
+    apCostNs(0),
+    lfpCostNs(0)
+{
+}
+
+CapacityProbe::~CapacityProbe()
+{
+    stopThread(5000);
+}
+
+void CapacityProbe::run()
+{
+    sweep();
+}
+
+bool CapacityProbe::sweep()
+{
+
+    steps.clearQuick();
+    capacities.clearQuick();
+
+    {
+        const ScopedLock lock(summaryLock);
+        progress = "measuring generation cost";
+    }
+
+    measureCosts();
+
+    String text;
+
+    for (int channels : config.channelCounts)
+    {
+        for (int rateScale : config.rateScales)
+        {
+            //Double until a configuration is not sustained, then bisect between the last good and first bad counts
+            int good = 0;
+            int bad = config.maxProbes + 1;
+            int probes = 1;
+
+            while (probes > good && !threadShouldExit())
+            {
+                const Step step = runStep(probes, channels, rateScale);
+                steps.add(step);
+
+                if (step.sustained)
+                    good = probes;
+                else
+                    bad = probes;
+
+                probes = bad > config.maxProbes ? jmin(probes * 2, config.maxProbes) : (good + bad) / 2;
+            }
+
+            if (threadShouldExit())
+                return false;
+
+            capacities.add(Capacity{ channels, rateScale, good, getPredictedProbes(channels, rateScale) });
+
+            text += String(channels) + " channels at " + String(rateScale) + "x rate: " + String(good) + " probes sustained ("
+                + String(getPredictedProbes(channels, rateScale)) + " predicted)\n";
+        }
+    }
+
+    {
+        const ScopedLock lock(summaryLock);
+        summary = text;
+    }
+
+    return writeReport();
+
+}
+
+String CapacityProbe::getSummary() const
+{
+    const ScopedLock lock(summaryLock);
+    return summary;
+}
+
+String CapacityProbe::getProgress() const
+{
+    const ScopedLock lock(summaryLock);
+    return progress;
+}
+
+void CapacityProbe::addProbe(OwnedArray<SourceSim>& sources, int channels, int rateScale)
+{
+
+    SourceSim* ap = new NPX_AP_BAND(channels);
+    SourceSim* lfp = new NPX_LFP_BAND(channels);
+
+    for (SourceSim* source : { ap, lfp })
+    {
+        source->sampleRate *= (float) rateScale;
+        source->seed = (uint32) sources.size();
+        source->updateClkFreq(1, 0);
+        source->prepare(waveformCache);
+        sources.add(source);
+    }
+
+}
+
+void CapacityProbe::measureCosts()
+{
+
+    OwnedArray<SourceSim> sources;
+    addProbe(sources, 384, 1);
+
+    Array<double> costs;
+
+    //Same sequence as a source thread, without pacing or a buffer
+    for (auto source : sources)
+    {
+        source->reset();
+
+        const double start = Time::getMillisecondCounterHiRes();
+        double elapsed = 0;
+
+        while (elapsed < CAPACITY_COST_SECONDS * 1000.0)
+        {
+            source->acquireParameters();
+            source->updateEventCodes();
+            source->renderPacket();
+            source->stampPacket();
+
+            elapsed = Time::getMillisecondCounterHiRes() - start;
+        }
+
+        costs.add(elapsed * 1e6 / ((double) source->numSamples * source->numChannels));
+    }
+
+    apCostNs = costs[0];
+    lfpCostNs = costs[1];
+
+}
+
+int CapacityProbe::getPredictedProbes(int channels, int rateScale) const
+{
+
+    //Cost grows linearly with channels x sample rate (see DeviceProfile)
+    const double coresPerProbe = (double) channels * rateScale * (30000.0 * apCostNs + 2500.0 * lfpCostNs) * 1e-9;
+
+    return coresPerProbe > 0 ? (int)(SystemStats::getNumCpus() / coresPerProbe) : 0;
+
+}
+
+CapacityProbe::Step CapacityProbe::runStep(int probes, int channels, int rateScale)
+{
+
+    OwnedArray<SourceSim> sources;
+    OwnedArray<DataBuffer> buffers;
+
+    for (int i = 0; i < probes; i++)
+        addProbe(sources, channels, rateScale);
+
+    Step step = { probes, channels, rateScale, 0.0, 0.0, 0.0, 0.0, 0, 0, true };
+
+    //One timebase for every stream, as in SourceThread::startAcquisition
+    const high_resolution_clock::time_point startTime = high_resolution_clock::now();
+
+    for (auto source : sources)
+    {
+        buffers.add(new DataBuffer(source->numChannels, 1000));
+        source->buffer = buffers.getLast();
+        source->bufferSize = 1000;
+        source->timeScale = 1.0;
+        source->setStartTime(startTime);
+        source->startThread();
+
+        step.channelSamplesPerSecond += (double) source->numChannels * source->sampleRate;
+    }
+
+    const double end = Time::getMillisecondCounterHiRes() + config.secondsPerStep * 1000.0;
+
+    while (Time::getMillisecondCounterHiRes() < end && !threadShouldExit())
+        Thread::sleep(50);
+
+    //A stream that keeps up is at most one packet short of the expected count
+    for (auto source : sources)
+    {
+        const int64 behind = source->getExpectedSamples() - source->generatedSamples - source->packetSize;
+        const double lagMs = jmax((int64) 0, behind) * 1000.0 / source->sampleRate;
+
+        step.lagMs = jmax(step.lagMs, lagMs);
+        step.sustained &= behind <= CAPACITY_MAX_LAG_PACKETS * source->packetSize;
+    }
+
+    for (auto source : sources)
+        source->signalThreadShouldExit();
+
+    for (auto source : sources)
+        source->stopThread(2000);
+
+    //Latency histograms, now that the threads are stopped
+    for (auto source : sources)
+    {
+        const double packetUs = 1e6 * source->packetSize / source->sampleRate;
+        const int overrunBin = jmin(LATENCY_BINS - 1, (int)(packetUs / LATENCY_BIN_US));
+        const int64 rank = source->latencyCount - source->latencyCount / 100;
+
+        int64 overruns = 0;
+        int64 seen = 0;
+        int p99Bin = -1;
+
+        for (int bin = 0; bin < LATENCY_BINS; bin++)
+        {
+            seen += source->latencyBins[bin];
+
+            if (p99Bin < 0 && seen >= rank)
+                p99Bin = bin;
+            if (bin >= overrunBin)
+                overruns += source->latencyBins[bin];
+        }
+
+        step.packets += source->latencyCount;
+        step.overruns += overruns;
+        step.latencyP99Us = jmax(step.latencyP99Us, (p99Bin + 1) * LATENCY_BIN_US);
+        step.latencyMaxUs = jmax(step.latencyMaxUs, source->latencyPeakUs);
+        step.sustained &= source->latencyCount > 0 && overruns <= (int64)(CAPACITY_MAX_OVERRUN_FRACTION * source->latencyCount);
+    }
+
+    {
+        const ScopedLock lock(summaryLock);
+        progress = String(probes) + " x " + String(channels) + " channels at " + String(rateScale) + "x rate "
+            + (step.sustained ? "sustained" : "not sustained") + " (p99 latency " + String(step.latencyP99Us, 0) + " us)";
+    }
+
+    return step;
+
+}
+
+bool CapacityProbe::writeReport()
+{
+
+    DynamicObject* machine = new DynamicObject();
+    machine->setProperty("cpus", SystemStats::getNumCpus());
+    machine->setProperty("physical_cpus", SystemStats::getNumPhysicalCpus());
+    machine->setProperty("cpu_model", SystemStats::getCpuModel());
+    machine->setProperty("os", SystemStats::getOperatingSystemName());
+
+    DynamicObject* costModel = new DynamicObject();
+    costModel->setProperty("ap_ns_per_channel_sample", apCostNs);
+    costModel->setProperty("lfp_ns_per_channel_sample", lfpCostNs);
+    costModel->setProperty("ap_channel_samples_per_core", apCostNs > 0 ? 1e9 / apCostNs : 0.0);
+    costModel->setProperty("lfp_channel_samples_per_core", lfpCostNs > 0 ? 1e9 / lfpCostNs : 0.0);
+
+    Array<var> stepList;
+
+    for (const Step& step : steps)
+    {
+        DynamicObject* entry = new DynamicObject();
+        entry->setProperty("probes", step.probes);
+        entry->setProperty("channels", step.channels);
+        entry->setProperty("rate_scale", step.rateScale);
+        entry->setProperty("channel_samples_per_second", step.channelSamplesPerSecond);
+        entry->setProperty("lag_ms", step.lagMs);
+        entry->setProperty("latency_p99_us", step.latencyP99Us);
+        entry->setProperty("latency_max_us", step.latencyMaxUs);
+        entry->setProperty("packets", step.packets);
+        entry->setProperty("overruns", step.overruns);
+        entry->setProperty("sustained", step.sustained);
+        stepList.add(var(entry));
+    }
+
+    //The largest sustained configuration is the one generating the most channel-samples
+    Array<var> capacityList;
+    var maximum;
+    double maximumRate = 0;
+
+    for (const Capacity& capacity : capacities)
+    {
+        const double rate = (double) capacity.probes * capacity.channels * capacity.rateScale * (30000.0 + 2500.0);
+
+        DynamicObject* entry = new DynamicObject();
+        entry->setProperty("channels", capacity.channels);
+        entry->setProperty("rate_scale", capacity.rateScale);
+        entry->setProperty("ap_sample_rate", 30000 * capacity.rateScale);
+        entry->setProperty("lfp_sample_rate", 2500 * capacity.rateScale);
+        entry->setProperty("max_probes", capacity.probes);
+        entry->setProperty("predicted_probes", capacity.predictedProbes);
+        entry->setProperty("channel_samples_per_second", rate);
+        capacityList.add(var(entry));
+
+        if (rate > maximumRate)
+        {
+            maximumRate = rate;
+            maximum = capacityList.getLast();
+        }
+    }
+
+    DynamicObject* report = new DynamicObject();
+    report->setProperty("machine", var(machine));
+    report->setProperty("seconds_per_step", config.secondsPerStep);
+    report->setProperty("cost_model", var(costModel));
+    report->setProperty("steps", stepList);
+    report->setProperty("capacity", capacityList);
+    report->setProperty("maximum", maximum);
+
+    if (reportFile.getParentDirectory().createDirectory().failed()
+        || !reportFile.replaceWithText(JSON::toString(var(report))))
+    {
+        std::cout << "Capacity probe: could not write " << reportFile.getFullPathName() << std::endl;
+        return false;
+    }
+
+    return true;
+
+}
@@ -0,0 +1,152 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Allen Institute for Brain Science and Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __CAPACITYPROBE_H__
+#define __CAPACITYPROBE_H__
+
+#include "SourceSim.h"
+
+/* Real-time run of every configuration tried */
+#define CAPACITY_STEP_SECONDS 3.0
+
+/* A configuration is sustained if no stream ends more than this many packets behind... */
+#define CAPACITY_MAX_LAG_PACKETS 2
+
+/* ...and at most this fraction of its packets is overrun: delivered a packet period (or the whole
+   latency histogram, if shorter) or more after falling due */
+#define CAPACITY_MAX_OVERRUN_FRACTION 0.001
+
+/* Single-thread generation time per source type for the cost model */
+#define CAPACITY_COST_SECONDS 0.5
+
+/**
+
+	Finds the largest simulated rig this machine generates in real time.
+
+	For every channel count and sample-rate multiple, the probe count is doubled until a
+	configuration is no longer sustained and then bisected. Each step runs NP1.0 probes (AP and
+	LFP streams on their own threads, as during acquisition) in real time and measures how far
+	each stream falls behind, its packet latency and its overruns. The sweep also times each
+	stream type on one thread, giving a per-core cost model (ns per channel-sample) that
+	predicts how many probes fit on the available cores.
+
+	The report is written as JSON; sweep() blocks, start the thread to sweep in the background.
+
+*/
+
+class CapacityProbe : public Thread
+{
+public:
+
+	struct Config
+	{
+		Config();
+
+		double secondsPerStep;
+		int maxProbes;
+
+		/* Channels per stream, and multiples of the NP1.0 sample rates (30 kHz AP, 2.5 kHz LFP) */
+		Array<int> channelCounts;
+		Array<int> rateScales;
+	};
+
+	/* Outcome of one configuration */
+	struct Step
+	{
+		int probes;
+		int channels;
+		int rateScale;
+
+		double channelSamplesPerSecond;
+
+		/* Worst stream: samples behind real time at the end (ms), packet latency p99 and max (us) */
+		double lagMs;
+		double latencyP99Us;
+		double latencyMaxUs;
+
+		int64 packets;
+		int64 overruns;
+
+		bool sustained;
+	};
+
+	CapacityProbe(const Config& config, const File& reportFile);
+	~CapacityProbe();
+
+	void run() override;
+
+	/** Runs the whole sweep and writes the report. Returns false if interrupted or on I/O errors.*/
+	bool sweep();
+
+	/** One line per channel count and rate: the largest sustained probe count, measured and predicted.*/
+	String getSummary() const;
+
+	/** The last step measured while sweeping.*/
+	String getProgress() const;
+
+	File getReportFile() const { return reportFile; }
+
+private:
+
+	/* Single-thread ns per channel-sample of each stream type */
+	void measureCosts();
+
+	Step runStep(int probes, int channels, int rateScale);
+
+	/* Largest sustained probe count of a channel count and rate */
+	struct Capacity
+	{
+		int channels;
+		int rateScale;
+		int probes;
+		int predictedProbes;
+	};
+
+	/* AP and LFP streams of one NP1.0 probe, at rateScale times the usual rates */
+	void addProbe(OwnedArray<SourceSim>& sources, int channels, int rateScale);
+
+	/* Probes the cost model fits on the available cores */
+	int getPredictedProbes(int channels, int rateScale) const;
+
+	bool writeReport();
+
+	Config config;
+	File reportFile;
+
+	WaveformCache waveformCache;
+
+	double apCostNs;
+	double lfpCostNs;
+
+	Array<Step> steps;
+	Array<Capacity> capacities;
+
+	CriticalSection summaryLock;
+	String summary;
+	String progress;
+
+	JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(CapacityProbe);
+
+};
+
+#endif  // __CAPACITYPROBE_H__
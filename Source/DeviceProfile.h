@@ -0,0 +1,92 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Allen Institute for Brain Science and Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __DEVICEPROFILE_H__
+#define __DEVICEPROFILE_H__
+
+/**
+
+	Runtime description of a simulated device type: the streams one device adds to the
+	signal chain and the limits the editor validates against.
+
+	Every stream is generated by one thread, so maxChannels is bounded by what one core
+	sustains at the stream's sample rate. Measured on one core (x86-64, -O3, 500-sample
+	packets, timed as in Tests/Benchmark.cpp), in M channel-samples/s at 384 channels:
+
+		                 default   front end (noise, artifacts, ADC step) enabled
+		AP band           850        87
+		LFP band           43        32
+		Wideband           31        27
+
+	The LFP and wideband figures include synthesising their background continuously.
+	One NP1.0 probe (AP + LFP, 384 channels) needs 12.5 M channel-samples/s on two threads.
+	Wider streams get slower per channel (the background synthesis and spatial sources outgrow
+	the cache): a 30 kHz wideband stream of 1536 channels needs 46 M/s but only reaches
+	about 13 M/s, and 768 channels (23 M/s needed) reach about 19 M/s. 512 channels
+	(15.4 M/s needed, about 24 M/s reached, 20 M/s with the front end) keep some headroom.
+
+*/
+
+enum DeviceProfileId
+{
+	NPX1_PROBE = 0,
+	NPX2_4SHANK_PROBE,
+	NIDAQ_DEVICE,
+	AP_TRAIN_DEVICE,
+	NUM_DEVICE_PROFILES
+};
+
+struct DeviceProfile
+{
+	const char* name;
+
+	int numShanks;
+	int sitesPerShank;
+
+	/* Channels per stream */
+	int defaultChannels;
+	int maxChannels;
+
+	/* Devices of this type in one rig */
+	int defaultDevices;
+	int maxDevices;
+
+	/* Separate AP (30 kHz) and LFP (2.5 kHz) streams, or one 30 kHz wideband stream */
+	bool splitBands;
+};
+
+inline const DeviceProfile& getDeviceProfile(int id)
+{
+	//NP2.0 hardware records 384 of its 5120 sites; up to 512 channels model denser readouts, as many as one thread sustains.
+	//Action potential trains only write their spikes, so any count of channels is cheap; the default rig has none
+	static const DeviceProfile profiles[NUM_DEVICE_PROFILES] = {
+		{ "NPX1 Probe",   1, 960,  384, 384,  6, 64, true  },
+		{ "NPX2 4-shank", 4, 1280, 384, 512,  6, 64, false },
+		{ "NIDAQ-Sim",    0, 0,    8,   64,   1, 8,  false },
+		{ "APTrain-Sim",  0, 0,    16,  384,  0, 8,  false }
+	};
+
+	return profiles[id >= 0 && id < NUM_DEVICE_PROFILES ? id : 0];
+}
+
+#endif  // __DEVICEPROFILE_H__
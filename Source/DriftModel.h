@@ -0,0 +1,145 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Allen Institute for Brain Science and Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __DRIFTMODEL_H__
+#define __DRIFTMODEL_H__
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+/* Walk steps reserved up front (one hour at the default step), so the trajectory rarely grows while generating */
+#define DRIFT_RESERVED_STEPS 36000
+
+/* Motion of the tissue relative to the probe along its depth axis */
+struct DriftSettings
+{
+	float amplitude;    // um, peak of the periodic component
+	float frequency;    // Hz of the periodic component
+	float randomWalk;   // um per sqrt(s), standard deviation of the random walk
+	float nonRigid;     // 0 = rigid; otherwise the tip moves (1 - nonRigid) and the top (1 + nonRigid) times as far
+	float stepSeconds;  // trajectory resolution; positions (and cached weights) change once per step
+	uint32_t seed;
+
+	bool isEnabled() const { return amplitude != 0.0f || randomWalk != 0.0f; }
+};
+
+/**
+
+	Deterministic drift trajectory: a sinusoid plus a Gaussian random walk, sampled once per
+	step. Displacement depends only on the step index (time), never on how generation is
+	split, so streams of different sample rates on one probe see the same motion and the
+	trace can be regenerated exactly for scoring.
+
+*/
+
+class DriftModel
+{
+public:
+
+	DriftModel() : probeLength(1.0f)
+	{
+		settings = DriftSettings{ 0.0f, 0.0f, 0.0f, 0.0f, 0.1f, 0 };
+	}
+
+	void configure(const DriftSettings& s, float lengthUm)
+	{
+		settings = s;
+		settings.stepSeconds = s.stepSeconds > 0.0f ? s.stepSeconds : 0.1f;
+		probeLength = lengthUm > 0.0f ? lengthUm : 1.0f;
+
+		walk.clear();
+		walk.reserve(DRIFT_RESERVED_STEPS);
+		walk.push_back(0.0f);
+	}
+
+	bool isEnabled() const { return settings.isEnabled(); }
+
+	const DriftSettings& getSettings() const { return settings; }
+
+	/* Drift step containing a sample */
+	int64_t getStep(int64_t sample, float sampleRate) const
+	{
+		return (int64_t)std::floor((double)sample / ((double)settings.stepSeconds * sampleRate));
+	}
+
+	/* First sample of a drift step */
+	int64_t getStepStart(int64_t step, float sampleRate) const
+	{
+		return (int64_t)std::ceil((double)step * settings.stepSeconds * sampleRate);
+	}
+
+	/* Displacement (um, towards the top of the probe) at a depth during a step */
+	float getDisplacement(int64_t step, float depth)
+	{
+		if (step < 0)
+			step = 0;
+
+		const double t = (double)step * settings.stepSeconds;
+		float rigid = settings.amplitude * (float)std::sin(6.283185307179586 * settings.frequency * t);
+
+		if (settings.randomWalk != 0.0f)
+			rigid += getWalk(step);
+
+		const float scale = 1.0f + settings.nonRigid * (2.0f * depth / probeLength - 1.0f);
+		return rigid * scale;
+	}
+
+private:
+
+	float getWalk(int64_t step)
+	{
+		const float sigma = settings.randomWalk * std::sqrt(settings.stepSeconds);
+
+		while ((int64_t)walk.size() <= step)
+		{
+			const uint64_t k = (uint64_t)walk.size();
+			walk.push_back(walk.back() + sigma * gaussian(k));
+		}
+
+		return walk[(size_t)step];
+	}
+
+	/* Standard normal value for step k (Box-Muller on two hashed uniforms) */
+	float gaussian(uint64_t k) const
+	{
+		const double u1 = ((double)(mix(k * 2 + 1) >> 11) + 0.5) / 9007199254740992.0;
+		const double u2 = (double)(mix(k * 2 + 2) >> 11) / 9007199254740992.0;
+		return (float)(std::sqrt(-2.0 * std::log(u1)) * std::cos(6.283185307179586 * u2));
+	}
+
+	uint64_t mix(uint64_t k) const
+	{
+		uint64_t z = ((uint64_t)settings.seed << 32) + k * 0x9E3779B97F4A7C15ULL;
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		return z ^ (z >> 31);
+	}
+
+	DriftSettings settings;
+	float probeLength;
+	std::vector<float> walk;
+
+};
+
+#endif  // __DRIFTMODEL_H__
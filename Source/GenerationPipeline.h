@@ -0,0 +1,224 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Allen Institute for Brain Science and Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __GENERATIONPIPELINE_H__
+#define __GENERATIONPIPELINE_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <tuple>
+#include <utility>
+#include <algorithm>
+
+/* Working set of one tile; sized to stay resident in L1 while every stage runs over it */
+#define PIPELINE_TILE_BYTES (32 * 1024)
+#define PIPELINE_TILE_CHANNELS 64
+
+/**
+
+	Compile-time composed generation pipeline.
+
+	A packet is an interleaved [sample][channel] float array. Instead of every stage
+	sweeping the whole packet, the pipeline cuts it into channel x sample tiles and
+	runs all stages back to back on one tile before moving to the next, so each extra
+	stage adds arithmetic on cache-resident data rather than another pass over memory.
+
+	Stages derive from GenerationStage<Stage> (CRTP) and provide:
+		void prepare(const StageContext&)   - called whenever the source is reconfigured
+		void process(const Tile&)           - first stage writes the tile, later stages modify it
+		bool isEnabled() const              - optional, skipped per tile when false
+		void beginPacket(int64_t, int)      - optional, sample range of the packet about to be tiled
+
+	Stages that need every channel of a sample at once (e.g. a common reference) set
+	spansAllChannels; while such a stage is enabled the pipeline uses full-width tiles.
+
+*/
+
+struct DriftSettings;
+struct BackgroundSettings;
+struct OscillationSettings;
+struct FrontEndSettings;
+
+namespace SourceSimPipeline
+{
+
+/* Static description of the source a pipeline generates for */
+struct StageContext
+{
+	int numChannels;
+	float sampleRate;
+	uint32_t seed;
+
+	/* Site position (x, y in um) of every electrode of the device, or null if it has no sites */
+	const float* sitePositions;
+	int numElectrodes;
+
+	/* Probe motion applied to spatial sources, or null for a static probe */
+	const DriftSettings* drift;
+
+	/* Correlated power-law background, or null for none */
+	const BackgroundSettings* background;
+
+	/* Probe-wide rhythms and ripple events, or null for none */
+	const OscillationSettings* oscillations;
+
+	/* Amplifier noise, artifacts and ADC step of the probe, or null for an ideal front end */
+	const FrontEndSettings* frontEnd;
+
+	/* Electrode generated on each channel, or null when every electrode is generated in order */
+	const int* channelMap;
+
+	/* Electrode of a generated channel; per-electrode content must be keyed on this */
+	int getElectrode(int channel) const { return channelMap != nullptr ? channelMap[channel] : channel; }
+
+	/* One period of the cached source waveform, interleaved [sample][channel] (may be null) */
+	const float* waveform;
+	int waveformLength;
+
+	/* Spike templates for units, [template][electrode][sample] so each electrode's waveform is
+	   contiguous, or null to use the built-in template */
+	const float* templates;
+	int numTemplates;
+	int templateElectrodes;
+	int templateLength;
+};
+
+/* A rectangular region of the packet being generated */
+struct Tile
+{
+	float* data;            // first sample of the first channel in the tile
+	int stride;             // floats between consecutive samples (total channels in the packet)
+	int firstChannel;
+	int numChannels;
+	int64_t firstSample;    // absolute index of the first sample since acquisition started
+	int numSamples;
+
+	float* row(int sample) const { return data + (size_t)sample * stride; }
+};
+
+template <typename Derived>
+class GenerationStage
+{
+public:
+
+	static const bool spansAllChannels = false;
+
+	bool isEnabled() const { return true; }
+
+	void prepare(const StageContext&) {}
+
+	void beginPacket(int64_t, int) {}
+
+	void run(const Tile& tile)
+	{
+		Derived& stage = static_cast<Derived&>(*this);
+
+		if (stage.isEnabled())
+			stage.process(tile);
+	}
+};
+
+template <typename... Stages>
+class GenerationPipeline
+{
+public:
+
+	std::tuple<Stages...> stages;
+
+	template <size_t Index>
+	typename std::tuple_element<Index, std::tuple<Stages...>>::type& stage() { return std::get<Index>(stages); }
+
+	void prepare(const StageContext& context)
+	{
+		prepareStages(context, std::index_sequence_for<Stages...>());
+	}
+
+	/* Generates numSamples x numChannels interleaved samples starting at absolute sample firstSample */
+	void process(float* dest, int numChannels, int numSamples, int64_t firstSample)
+	{
+		const int tileChannels = anySpansAllChannels(std::index_sequence_for<Stages...>()) ? numChannels : std::min(numChannels, PIPELINE_TILE_CHANNELS);
+
+		if (tileChannels <= 0)
+			return;
+
+		beginStages(firstSample, numSamples, std::index_sequence_for<Stages...>());
+
+		const int tileSamples = std::max(1, PIPELINE_TILE_BYTES / (int)(tileChannels * sizeof(float)));
+
+		for (int channel = 0; channel < numChannels; channel += tileChannels)
+		{
+			for (int sample = 0; sample < numSamples; sample += tileSamples)
+			{
+				Tile tile;
+				tile.data = dest + (size_t)sample * numChannels + channel;
+				tile.stride = numChannels;
+				tile.firstChannel = channel;
+				tile.numChannels = std::min(tileChannels, numChannels - channel);
+				tile.firstSample = firstSample + sample;
+				tile.numSamples = std::min(tileSamples, numSamples - sample);
+
+				runStages(tile, std::index_sequence_for<Stages...>());
+			}
+		}
+	}
+
+private:
+
+	/* Only enabled stages force full-width tiles */
+	template <size_t... Index>
+	bool anySpansAllChannels(std::index_sequence<Index...>) const
+	{
+		const bool spans[] = { false, (Stages::spansAllChannels && std::get<Index>(stages).isEnabled())... };
+
+		for (bool s : spans)
+			if (s)
+				return true;
+
+		return false;
+	}
+
+	template <size_t... Index>
+	void prepareStages(const StageContext& context, std::index_sequence<Index...>)
+	{
+		int expand[] = { 0, (std::get<Index>(stages).prepare(context), 0)... };
+		(void)expand;
+	}
+
+	template <size_t... Index>
+	void beginStages(int64_t firstSample, int numSamples, std::index_sequence<Index...>)
+	{
+		int expand[] = { 0, (std::get<Index>(stages).beginPacket(firstSample, numSamples), 0)... };
+		(void)expand;
+	}
+
+	template <size_t... Index>
+	void runStages(const Tile& tile, std::index_sequence<Index...>)
+	{
+		int expand[] = { 0, (std::get<Index>(stages).run(tile), 0)... };
+		(void)expand;
+	}
+};
+
+}
+
+#endif  // __GENERATIONPIPELINE_H__
@@ -0,0 +1,1571 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Allen Institute for Brain Science and Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __GENERATIONSTAGES_H__
+#define __GENERATIONSTAGES_H__
+
+#include "GenerationPipeline.h"
+#include "DriftModel.h"
+#include "BackgroundNoise.h"
+#include "OscillationModel.h"
+
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+/* Amplifier noise, periodic stimulation artifacts and ADC resolution of the probe streams
+   (NoiseStage, ArtifactStage and QuantizeStage); a zero turns each off */
+struct FrontEndSettings
+{
+	float noiseRms;           // uV of white noise per channel
+	float artifactInterval;   // s between artifact onsets
+	float artifactAmplitude;  // uV at onset
+	float artifactDecay;      // s, time constant of the exponential decay
+	float adcStep;            // uV per ADC code; codes are clipped to 16 bits
+
+	bool isEnabled() const { return noiseRms > 0.0f || (artifactInterval > 0.0f && artifactDecay > 0.0f) || adcStep > 0.0f; }
+};
+
+namespace SourceSimPipeline
+{
+
+/* Counter-based hash (splitmix64 finaliser): random values depend only on seed and position,
+   so output is identical whatever the tile or packet boundaries are */
+inline uint64_t hashSample(uint64_t seed, uint64_t sample, uint64_t channel)
+{
+	uint64_t z = seed + sample * 0x9E3779B97F4A7C15ULL + channel * 0xD1B54A32D192ED03ULL;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+/* Onsets of hashed events of a fixed length that overlap the current packet. Consecutive
+   packets only hash their new samples, so the cost per packet does not grow with the event
+   length however small the packets are; any other packet is scanned from scratch. */
+class OnsetTrack
+{
+public:
+
+	OnsetTrack() : scannedFrom(0), scannedEnd(0) {}
+
+	std::vector<int64_t> onsets;
+
+	void reset()
+	{
+		onsets.clear();
+		scannedFrom = 0;
+		scannedEnd = 0;
+	}
+
+	/* Moves to the packet [firstSample, end); isOnset(n) decides whether an event starts at sample n */
+	template <typename IsOnset>
+	void advance(int64_t firstSample, int64_t end, int length, IsOnset isOnset)
+	{
+		const int64_t from = std::max<int64_t>(0, firstSample - length + 1);
+
+		if (firstSample != scannedEnd || from < scannedFrom)
+		{
+			onsets.clear();
+			scannedEnd = from;
+		}
+
+		onsets.erase(onsets.begin(), std::lower_bound(onsets.begin(), onsets.end(), from));
+
+		for (int64_t n = std::max(from, scannedEnd); n < end; n++)
+		{
+			if (isOnset(n))
+				onsets.push_back(n);
+		}
+
+		scannedFrom = from;
+		scannedEnd = std::max(scannedEnd, end);
+	}
+
+	/* True if every onset in [from, end) is in onsets */
+	bool covers(int64_t from, int64_t end) const { return from >= scannedFrom && end <= scannedEnd; }
+
+private:
+
+	int64_t scannedFrom;
+	int64_t scannedEnd;
+};
+
+/* Zero-fills the tile; first stage of sources without a periodic waveform */
+class ClearStage : public GenerationStage<ClearStage>
+{
+public:
+
+	void process(const Tile& tile)
+	{
+		for (int s = 0; s < tile.numSamples; s++)
+			memset(tile.row(s), 0, sizeof(float) * tile.numChannels);
+	}
+};
+
+/* Copies the cached periodic source waveform (see WaveformCache) into the tile */
+class OscillatorStage : public GenerationStage<OscillatorStage>
+{
+public:
+
+	OscillatorStage() : waveform(nullptr), length(0), numChannels(0) {}
+
+	void prepare(const StageContext& context)
+	{
+		waveform = context.waveform;
+		length = context.waveformLength;
+		numChannels = context.numChannels;
+	}
+
+	void process(const Tile& tile)
+	{
+		if (waveform == nullptr || length <= 0)
+		{
+			for (int s = 0; s < tile.numSamples; s++)
+				memset(tile.row(s), 0, sizeof(float) * tile.numChannels);
+			return;
+		}
+
+		int position = (int)(tile.firstSample % length);
+
+		for (int s = 0; s < tile.numSamples; s++)
+		{
+			memcpy(tile.row(s), waveform + (size_t)position * numChannels + tile.firstChannel, sizeof(float) * tile.numChannels);
+
+			if (++position == length)
+				position = 0;
+		}
+	}
+
+private:
+
+	const float* waveform;
+	int length;
+	int numChannels;
+};
+
+/* Adds zero-mean, approximately Gaussian white noise (Irwin-Hall sum of four uniforms) */
+class NoiseStage : public GenerationStage<NoiseStage>
+{
+public:
+
+	NoiseStage() : amplitude(0.0f), seed(0), channelMap(nullptr) {}
+
+	bool isEnabled() const { return amplitude > 0.0f; }
+
+	void prepare(const StageContext& context)
+	{
+		amplitude = context.frontEnd != nullptr ? context.frontEnd->noiseRms : 0.0f;
+		seed = context.seed;
+		channelMap = context.channelMap;
+	}
+
+	void process(const Tile& tile)
+	{
+		//Sum of four 16-bit uniforms has mean 2 * 65535 and variance 4 * 65536^2 / 12
+		const float scale = amplitude * 1.7320508f / 65536.0f;
+		const float offset = 2.0f * 65535.0f;
+
+		for (int s = 0; s < tile.numSamples; s++)
+		{
+			float* row = tile.row(s);
+			const uint64_t sample = (uint64_t)(tile.firstSample + s);
+
+			for (int c = 0; c < tile.numChannels; c++)
+			{
+				//Keyed on the electrode, so a channel's noise is the same whichever electrodes are enabled
+				const int channel = tile.firstChannel + c;
+				const uint64_t h = hashSample(seed, sample, (uint64_t)(channelMap != nullptr ? channelMap[channel] : channel));
+				const float sum = (float)(h & 0xFFFF) + (float)((h >> 16) & 0xFFFF)
+					+ (float)((h >> 32) & 0xFFFF) + (float)(h >> 48);
+				row[c] += (sum - offset) * scale;
+			}
+		}
+	}
+
+private:
+
+	float amplitude;
+	uint64_t seed;
+	const int* channelMap;
+};
+
+/* Adds a periodic stimulation-like artifact: a step that decays exponentially, from a lookup table */
+class ArtifactStage : public GenerationStage<ArtifactStage>
+{
+public:
+
+	ArtifactStage() : period(0) {}
+
+	void prepare(const StageContext& context)
+	{
+		period = 0;
+		shape.clear();
+
+		if (context.frontEnd == nullptr)
+			return;
+
+		//Onsets on whole samples; the decay is kept in samples as well
+		period = (int)std::lround(context.frontEnd->artifactInterval * context.sampleRate);
+		const float amplitude = context.frontEnd->artifactAmplitude;
+		const float decaySamples = context.frontEnd->artifactDecay * context.sampleRate;
+
+		if (period <= 0 || decaySamples <= 0.0f)
+			return;
+
+		//Truncate once the artifact has decayed below 0.1% of its peak
+		int length = std::min(period, (int)std::ceil(decaySamples * 6.9f));
+		shape.resize(length);
+
+		for (int i = 0; i < length; i++)
+			shape[i] = amplitude * std::exp(-(float)i / decaySamples);
+	}
+
+	bool isEnabled() const { return period > 0 && !shape.empty(); }
+
+	void process(const Tile& tile)
+	{
+		const int length = (int)shape.size();
+		int offset = (int)(tile.firstSample % period);
+
+		for (int s = 0; s < tile.numSamples; s++)
+		{
+			if (offset < length)
+			{
+				float* row = tile.row(s);
+				const float value = shape[offset];
+
+				for (int c = 0; c < tile.numChannels; c++)
+					row[c] += value;
+			}
+			else
+			{
+				//Skip straight to the next artifact onset
+				int skip = std::min(period - offset, tile.numSamples - s) - 1;
+				s += skip;
+				offset += skip;
+			}
+
+			if (++offset == period)
+				offset = 0;
+		}
+	}
+
+private:
+
+	int period;
+	std::vector<float> shape;
+};
+
+/**
+	Spatial signal model: point sources near the probe project onto its sites through a
+	precomputed sparse weight matrix.
+
+	Three kinds of sources are placed deterministically (from the seed) along the probe:
+	units firing a biphasic spike template, LFP dipoles oscillating at 4-12 Hz and
+	point-like artifact generators. Each source keeps only the weights above
+	SPATIAL_WEIGHT_THRESHOLD of its peak, sorted by channel (CSR), so a tile costs one
+	temporal evaluation per source plus one multiply-add per non-zero weight and sample.
+
+	With drift enabled, sources move along the probe with the DriftModel trajectory. The
+	weights are rebuilt once per drift step and the two most recent steps are kept, so
+	tiles (which revisit a packet once per channel block) almost never rebuild them.
+
+	When the context provides recorded templates, each unit instead plays one template
+	centred on its nearest site: the weight set then points every channel at that
+	electrode's contiguous template waveform, and a tile adds it at each spike onset.
+*/
+
+/* Weights below this fraction of a source's peak weight are dropped */
+#define SPATIAL_WEIGHT_THRESHOLD 0.05f
+
+class SpatialStage : public GenerationStage<SpatialStage>
+{
+public:
+
+	enum Kind { UNIT = 0, DIPOLE, ARTIFACT };
+
+	SpatialStage() : unitDensity(0.0f), dipoleDensity(0.0f), numArtifacts(0),
+		unitRate(5.0f), unitAmplitude(150.0f), dipoleAmplitude(300.0f), artifactAmplitude(500.0f),
+		sampleRate(30000.0f), seed(0), templates(nullptr), numTemplates(0), templateElectrodes(0), templateLength(0),
+		lastUsed(0), rebuilds(0) {}
+
+	/* Units and dipoles per 100 electrodes, plus a fixed number of artifact generators (all 0 disables
+	   the stage); takes effect at the next prepare */
+	void setSourceDensity(float unitsPer100Electrodes, float dipolesPer100Electrodes, int artifacts)
+	{
+		unitDensity = unitsPer100Electrodes;
+		dipoleDensity = dipolesPer100Electrodes;
+		numArtifacts = artifacts;
+	}
+
+	/* Mean firing rate (Hz) and peak amplitudes at distance 0 */
+	void setAmplitudes(float rate, float unit, float dipole, float artifact)
+	{
+		unitRate = rate;
+		unitAmplitude = unit;
+		dipoleAmplitude = dipole;
+		artifactAmplitude = artifact;
+	}
+
+	bool isEnabled() const { return !sources.empty(); }
+
+	size_t getNumWeights() const { return weightSets[lastUsed].channel.size(); }
+
+	/* Number of times the weights were rebuilt for a new drift step */
+	int64_t getNumRebuilds() const { return rebuilds; }
+
+	void prepare(const StageContext& context)
+	{
+		sources.clear();
+		channelX.clear();
+		channelY.clear();
+		channelElectrode.clear();
+		templatePeakElectrode.clear();
+		templateElectrodePeak.clear();
+
+		sampleRate = context.sampleRate;
+		seed = context.seed;
+
+		templates = context.templates;
+		numTemplates = context.templates != nullptr ? context.numTemplates : 0;
+		templateElectrodes = context.templateElectrodes;
+		templateLength = context.templateLength;
+
+		for (int w = 0; w < 2; w++)
+			weightSets[w].step = INVALID_STEP;
+
+		if (context.sitePositions == nullptr || context.numElectrodes <= 0 || context.numChannels <= 0)
+			return;
+
+		float length = 0.0f;
+
+		for (int e = 0; e < context.numElectrodes; e++)
+			length = std::max(length, context.sitePositions[2 * e + 1]);
+
+		for (int c = 0; c < context.numChannels; c++)
+		{
+			const int e = context.getElectrode(c);
+			channelX.push_back(context.sitePositions[2 * e]);
+			channelY.push_back(context.sitePositions[2 * e + 1]);
+			channelElectrode.push_back(e);
+		}
+
+		sites.assign(context.sitePositions, context.sitePositions + 2 * context.numElectrodes);
+		prepareTemplates();
+
+		drift.configure(context.drift != nullptr ? *context.drift : DriftSettings{ 0.0f, 0.0f, 0.0f, 0.0f, 0.1f, 0 }, length);
+
+		buildTemplate();
+
+		const int numUnits = (int)std::round(unitDensity * context.numElectrodes / 100.0f);
+		const int numDipoles = (int)std::round(dipoleDensity * context.numElectrodes / 100.0f);
+		int index = 0;
+
+		for (int k = 0; k < numUnits; k++)
+			addSource(context, UNIT, index++);
+		for (int k = 0; k < numDipoles; k++)
+			addSource(context, DIPOLE, index++);
+		for (int k = 0; k < numArtifacts; k++)
+			addSource(context, ARTIFACT, index++);
+
+		//Largest tile has PIPELINE_TILE_BYTES / sizeof(float) samples (one channel wide)
+		signal.resize(PIPELINE_TILE_BYTES / sizeof(float));
+		spikes.reserve(64);
+		onsets.assign(sources.size(), OnsetTrack());
+
+		if (!sources.empty())
+			getWeights(drift.isEnabled() ? 0 : STATIC_STEP);
+	}
+
+	/* Finds the spikes of every unit overlapping the packet once; tiles then only look them up */
+	void beginPacket(int64_t firstSample, int numSamples)
+	{
+		const uint64_t threshold = getSpikeThreshold();
+
+		for (const Source& source : sources)
+		{
+			if (source.kind != UNIT)
+				continue;
+
+			onsets[source.index].advance(firstSample, firstSample + numSamples, getSpikeLength(source),
+				[&](int64_t n) { return isSpike(source, n, threshold); });
+		}
+	}
+
+	void process(const Tile& tile)
+	{
+		if (!drift.isEnabled())
+		{
+			processRange(tile, getWeights(STATIC_STEP), 0, tile.numSamples);
+			return;
+		}
+
+		//Split the tile where the drift step changes
+		int s = 0;
+
+		while (s < tile.numSamples)
+		{
+			const int64_t step = drift.getStep(tile.firstSample + s, sampleRate);
+			const int64_t next = drift.getStepStart(step + 1, sampleRate);
+			const int end = (int)std::min<int64_t>(tile.numSamples, next - tile.firstSample);
+
+			processRange(tile, getWeights(step), s, std::max(end, s + 1));
+			s = std::max(end, s + 1);
+		}
+	}
+
+private:
+
+	static const int64_t INVALID_STEP = -2;
+	static const int64_t STATIC_STEP = -1;
+
+	struct Source
+	{
+		Kind kind;
+		int index;
+		float frequency; //dipoles: Hz; artifacts: period in samples
+		float phase;
+		float x, y, z; //um
+		float falloff; //um
+		float amplitude;
+		int templateIndex; //recorded template of a unit, or -1
+	};
+
+	/* CSR weights of all sources for one drift step: source k covers [start[k], start[k + 1]), sorted by channel.
+	   Template units also point each channel at the template waveform of the electrode it sees. */
+	struct WeightSet
+	{
+		int64_t step;
+		std::vector<int> start;
+		std::vector<int> channel;
+		std::vector<float> value;
+		std::vector<const float*> waveform;
+	};
+
+	void processRange(const Tile& tile, const WeightSet& weights, int firstRow, int endRow)
+	{
+		const int lastChannel = tile.firstChannel + tile.numChannels;
+		const int numRows = endRow - firstRow;
+
+		for (size_t k = 0; k < sources.size(); k++)
+		{
+			const int* channelsBegin = weights.channel.data() + weights.start[k];
+			const int* channelsEnd = weights.channel.data() + weights.start[k + 1];
+
+			const int* first = std::lower_bound(channelsBegin, channelsEnd, tile.firstChannel);
+			const int* last = std::lower_bound(first, channelsEnd, lastChannel);
+
+			if (first == last)
+				continue;
+
+			const float* value = weights.value.data() + (first - weights.channel.data());
+
+			if (sources[k].templateIndex >= 0)
+			{
+				if (findSpikes(sources[k], tile.firstSample + firstRow, numRows))
+					addTemplates(tile, first, last, value, weights.waveform.data() + (first - weights.channel.data()),
+						tile.firstSample + firstRow, firstRow, numRows);
+				continue;
+			}
+
+			if (!evaluate(sources[k], tile.firstSample + firstRow, numRows))
+				continue;
+
+			for (const int* c = first; c < last; c++, value++)
+			{
+				const int column = *c - tile.firstChannel;
+				const float w = *value;
+
+				for (int s = 0; s < numRows; s++)
+					tile.row(firstRow + s)[column] += w * signal[s];
+			}
+		}
+	}
+
+	/* Weights for a drift step, rebuilt into the least recently used slot on a miss */
+	const WeightSet& getWeights(int64_t step)
+	{
+		if (weightSets[lastUsed].step == step)
+			return weightSets[lastUsed];
+
+		lastUsed ^= 1;
+
+		if (weightSets[lastUsed].step != step)
+			buildWeights(step, weightSets[lastUsed]);
+
+		return weightSets[lastUsed];
+	}
+
+	void buildWeights(int64_t step, WeightSet& weights)
+	{
+		weights.step = step;
+		weights.start.assign(1, 0);
+		weights.channel.clear();
+		weights.value.clear();
+		weights.waveform.clear();
+		rebuilds++;
+
+		std::vector<float>& w = scratchWeights;
+		w.resize(channelX.size());
+
+		for (const Source& source : sources)
+		{
+			//Tissue (and every source in it) moves along the probe axis
+			const float y = step == STATIC_STEP ? source.y : source.y + drift.getDisplacement(step, source.y);
+
+			if (source.templateIndex >= 0)
+			{
+				addTemplateWeights(source, y, weights);
+				weights.start.push_back((int)weights.channel.size());
+				continue;
+			}
+
+			float peak = 0.0f;
+
+			for (size_t c = 0; c < channelX.size(); c++)
+			{
+				const float dx = channelX[c] - source.x;
+				const float dy = channelY[c] - y;
+				const float r2 = (dx * dx + dy * dy + source.z * source.z) / (source.falloff * source.falloff);
+
+				if (source.kind == DIPOLE)
+					w[c] = source.amplitude * (dy / source.falloff) / std::pow(1.0f + r2, 1.5f) * 2.6f; //2.6 normalises the peak to ~amplitude
+				else
+					w[c] = source.amplitude / (1.0f + r2);
+
+				peak = std::max(peak, std::fabs(w[c]));
+			}
+
+			for (size_t c = 0; c < channelX.size(); c++)
+			{
+				if (peak > 0.0f && std::fabs(w[c]) >= SPATIAL_WEIGHT_THRESHOLD * peak)
+				{
+					weights.channel.push_back((int)c);
+					weights.value.push_back(w[c]);
+					weights.waveform.push_back(nullptr);
+				}
+			}
+
+			weights.start.push_back((int)weights.channel.size());
+		}
+	}
+
+	/* Channels of a template unit at depth y: the template is centred on the site nearest the unit,
+	   so electrode e sees template electrode e - nearest + peak, scaled to the unit amplitude */
+	void addTemplateWeights(const Source& source, float y, WeightSet& weights)
+	{
+		const int t = source.templateIndex;
+		const int numSites = (int)sites.size() / 2;
+		int nearest = 0;
+		float best = 0.0f;
+
+		for (int e = 0; e < numSites; e++)
+		{
+			const float dx = sites[2 * e] - source.x;
+			const float dy = sites[2 * e + 1] - y;
+
+			if (e == 0 || dx * dx + dy * dy < best)
+			{
+				best = dx * dx + dy * dy;
+				nearest = e;
+			}
+		}
+
+		const float* electrodePeak = templateElectrodePeak.data() + (size_t)t * templateElectrodes;
+		const float peak = electrodePeak[templatePeakElectrode[t]];
+
+		if (peak <= 0.0f)
+			return;
+
+		for (size_t c = 0; c < channelElectrode.size(); c++)
+		{
+			const int e = channelElectrode[c] - nearest + templatePeakElectrode[t];
+
+			if (e < 0 || e >= templateElectrodes || electrodePeak[e] < SPATIAL_WEIGHT_THRESHOLD * peak)
+				continue;
+
+			weights.channel.push_back((int)c);
+			weights.value.push_back(source.amplitude / peak);
+			weights.waveform.push_back(templates + ((size_t)t * templateElectrodes + e) * templateLength);
+		}
+	}
+
+	/* Peak electrode and per-electrode peak magnitude of every template */
+	void prepareTemplates()
+	{
+		if (numTemplates <= 0 || templateElectrodes <= 0 || templateLength <= 0)
+		{
+			numTemplates = 0;
+			return;
+		}
+
+		templatePeakElectrode.assign(numTemplates, 0);
+		templateElectrodePeak.assign((size_t)numTemplates * templateElectrodes, 0.0f);
+
+		for (int t = 0; t < numTemplates; t++)
+		{
+			float* electrodePeak = templateElectrodePeak.data() + (size_t)t * templateElectrodes;
+
+			for (int e = 0; e < templateElectrodes; e++)
+			{
+				const float* waveform = templates + ((size_t)t * templateElectrodes + e) * templateLength;
+
+				for (int i = 0; i < templateLength; i++)
+					electrodePeak[e] = std::max(electrodePeak[e], std::fabs(waveform[i]));
+
+				if (electrodePeak[e] > electrodePeak[templatePeakElectrode[t]])
+					templatePeakElectrode[t] = e;
+			}
+		}
+	}
+
+	/* Adds the template waveform of every channel in [first, last) at each onset in spikes */
+	void addTemplates(const Tile& tile, const int* first, const int* last, const float* value, const float* const* waveform,
+		int64_t firstSample, int firstRow, int numRows)
+	{
+		for (const int* c = first; c < last; c++, value++, waveform++)
+		{
+			const int column = *c - tile.firstChannel;
+			const float w = *value;
+
+			for (int64_t n : spikes)
+			{
+				const int begin = (int)std::max<int64_t>(0, n - firstSample);
+				const int end = (int)std::min<int64_t>(numRows, n - firstSample + templateLength);
+				const float* samples = *waveform + (firstSample - n);
+
+				for (int s = begin; s < end; s++)
+					tile.row(firstRow + s)[column] += w * samples[s];
+			}
+		}
+	}
+
+	/* Uniform [0, 1) draw number field for source index */
+	float draw(int index, int field) const { return (float)(hashSample(seed, 0x5A70 + field, (uint64_t)index) >> 40) / 16777216.0f; }
+
+	/* Spike template: 1.6 ms trough followed by a slower positive rebound, peak -1 */
+	void buildTemplate()
+	{
+		const int length = std::max(1, (int)(0.0016f * sampleRate));
+		spikeTemplate.resize(length);
+
+		for (int i = 0; i < length; i++)
+		{
+			const float t = (float)i / (float)length;
+			spikeTemplate[i] = -std::exp(-std::pow((t - 0.25f) / 0.08f, 2.0f)) + 0.35f * std::exp(-std::pow((t - 0.55f) / 0.15f, 2.0f));
+		}
+	}
+
+	void addSource(const StageContext& context, Kind kind, int index)
+	{
+		//Place the source next to a random site, slightly off the probe plane
+		const int electrode = std::min(context.numElectrodes - 1, (int)(draw(index, 0) * (float)context.numElectrodes));
+
+		Source source;
+		source.kind = kind;
+		source.index = index;
+		source.frequency = kind == DIPOLE ? 4.0f + 8.0f * draw(index, 4) : std::max(1.0f, std::round(sampleRate * (0.5f + draw(index, 4))));
+		source.phase = 6.2831853f * draw(index, 5);
+		source.x = context.sitePositions[2 * electrode] + 30.0f * (draw(index, 1) - 0.5f);
+		source.y = context.sitePositions[2 * electrode + 1] + 30.0f * (draw(index, 2) - 0.5f);
+		source.z = 10.0f + 30.0f * draw(index, 3);
+
+		//Units fall off within ~100 um, artifacts barely attenuate; dipoles flip sign across their depth
+		source.falloff = kind == UNIT ? 25.0f : (kind == DIPOLE ? 300.0f : 2000.0f);
+		source.amplitude = kind == UNIT ? unitAmplitude : (kind == DIPOLE ? dipoleAmplitude : artifactAmplitude);
+		source.templateIndex = kind == UNIT && numTemplates > 0 ? index % numTemplates : -1;
+
+		sources.push_back(source);
+	}
+
+	/* Writes the source's signal for the tile into signal; returns false if it is zero throughout */
+	bool evaluate(const Source& source, int64_t firstSample, int numSamples)
+	{
+		if (source.kind == DIPOLE)
+		{
+			const double step = 6.283185307179586 * source.frequency / sampleRate;
+
+			for (int s = 0; s < numSamples; s++)
+				signal[s] = (float)std::sin(step * (double)(firstSample + s) + source.phase);
+
+			return true;
+		}
+
+		if (source.kind == ARTIFACT)
+		{
+			const int64_t period = (int64_t)source.frequency;
+			const int64_t offset = (int64_t)(source.phase * period / 6.2831853f);
+			const float decay = 0.002f * sampleRate;
+			bool any = false;
+
+			for (int s = 0; s < numSamples; s++)
+			{
+				const int64_t t = (firstSample + s + offset) % period;
+				signal[s] = t < (int64_t)(decay * 7.0f) ? std::exp(-(float)t / decay) : 0.0f;
+				any = any || signal[s] != 0.0f;
+			}
+
+			return any;
+		}
+
+		const int length = (int)spikeTemplate.size();
+
+		if (!findSpikes(source, firstSample, numSamples))
+			return false;
+
+		std::fill(signal.begin(), signal.begin() + numSamples, 0.0f);
+
+		for (int64_t n : spikes)
+		{
+			const int begin = (int)std::max<int64_t>(0, n - firstSample);
+			const int end = (int)std::min<int64_t>(numSamples, n - firstSample + length);
+
+			for (int s = begin; s < end; s++)
+				signal[s] += spikeTemplate[firstSample + s - n];
+		}
+
+		return true;
+	}
+
+	/* A spike starts at sample n with probability rate / sampleRate, decided per sample by hash */
+	uint64_t getSpikeThreshold() const { return (uint64_t)((double)unitRate / sampleRate * 18446744073709551615.0); }
+
+	bool isSpike(const Source& source, int64_t n, uint64_t threshold) const
+	{
+		return hashSample(seed ^ 0x5917E5ULL, (uint64_t)n, (uint64_t)source.index) < threshold;
+	}
+
+	int getSpikeLength(const Source& source) const { return source.templateIndex >= 0 ? templateLength : (int)spikeTemplate.size(); }
+
+	/* Onsets of a unit's spikes overlapping the range into spikes, from the packet's onsets when
+	   beginPacket found them. Returns false if there are none. */
+	bool findSpikes(const Source& source, int64_t firstSample, int numSamples)
+	{
+		const int64_t from = std::max<int64_t>(0, firstSample - getSpikeLength(source) + 1);
+		const int64_t end = firstSample + numSamples;
+		const OnsetTrack& track = onsets[source.index];
+		spikes.clear();
+
+		if (track.covers(from, end))
+		{
+			for (auto n = std::lower_bound(track.onsets.begin(), track.onsets.end(), from); n != track.onsets.end() && *n < end; ++n)
+				spikes.push_back(*n);
+
+			return !spikes.empty();
+		}
+
+		const uint64_t threshold = getSpikeThreshold();
+
+		for (int64_t n = from; n < end; n++)
+		{
+			if (isSpike(source, n, threshold))
+				spikes.push_back(n);
+		}
+
+		return !spikes.empty();
+	}
+
+	float unitDensity;
+	float dipoleDensity;
+	int numArtifacts;
+
+	float unitRate;
+	float unitAmplitude;
+	float dipoleAmplitude;
+	float artifactAmplitude;
+
+	float sampleRate;
+	uint64_t seed;
+
+	std::vector<Source> sources;
+	std::vector<float> spikeTemplate;
+	std::vector<int64_t> spikes;
+
+	/* Spike onsets of the current packet, per source (units only) */
+	std::vector<OnsetTrack> onsets;
+
+	/* Recorded templates, [template][electrode][sample] */
+	const float* templates;
+	int numTemplates;
+	int templateElectrodes;
+	int templateLength;
+	std::vector<int> templatePeakElectrode;
+	std::vector<float> templateElectrodePeak;
+
+	/* Positions and electrodes of the generated channels, and positions of all sites */
+	std::vector<float> channelX;
+	std::vector<float> channelY;
+	std::vector<int> channelElectrode;
+	std::vector<float> sites;
+
+	DriftModel drift;
+	WeightSet weightSets[2];
+	int lastUsed;
+	int64_t rebuilds;
+
+	std::vector<float> scratchWeights;
+	std::vector<float> signal;
+};
+
+/**
+	Correlated power-law background (see SpectralBlockSynth), synthesised continuously and
+	overlap-added.
+
+	Every block of the acquisition is synthesised anew, so the background never repeats. The
+	work is spread over the packets: beginPacket completes the blocks the packet reads, then
+	renders as many steps of the next block as the packet's progress through the current hop
+	calls for, so the next block is complete just when it is needed and a packet pays for a
+	whole block only after a jump (the first packet, or one longer than a hop). A block depends
+	only on the seed and its index, so output does not depend on packet or tile boundaries.
+*/
+class BackgroundStage : public GenerationStage<BackgroundStage>
+{
+public:
+
+	BackgroundStage() : enabled(false), numChannels(0), hop(1), blockSize(0), pendingBlock(NO_BLOCK), pendingStep(0) {}
+
+	bool isEnabled() const { return enabled; }
+
+	void prepare(const StageContext& context)
+	{
+		enabled = context.background != nullptr && context.background->isEnabled() && context.numChannels > 0;
+
+		if (!enabled)
+		{
+			std::vector<float>().swap(blocks);
+			slotBlock.clear();
+			return;
+		}
+
+		std::vector<float> positions;
+		std::vector<int> electrodes;
+
+		for (int c = 0; c < context.numChannels; c++)
+		{
+			const int e = context.getElectrode(c);
+			electrodes.push_back(e);
+
+			if (context.sitePositions != nullptr)
+			{
+				positions.push_back(context.sitePositions[2 * e]);
+				positions.push_back(context.sitePositions[2 * e + 1]);
+			}
+		}
+
+		synth.configure(*context.background, context.sampleRate, context.seed, positions, electrodes);
+
+		numChannels = context.numChannels;
+		hop = synth.getHop();
+		blockSize = (size_t)synth.getLength() * numChannels;
+
+		//Blocks m - 1 and m of a packet within one hop, and the next one
+		setSlots(3);
+
+		//The first packet starts in block 0, which overlaps block -1
+		completeBlock(-1);
+		completeBlock(0);
+	}
+
+	void beginPacket(int64_t firstSample, int numSamples)
+	{
+		if (!enabled || numSamples <= 0)
+			return;
+
+		const int64_t first = getBlockIndex(firstSample) - 1;
+		const int64_t last = getBlockIndex(firstSample + numSamples - 1);
+
+		//A slot for every block the packet reads and one for the block rendered ahead
+		if (last - first + 2 > (int64_t)slotBlock.size())
+			setSlots((int)(last - first + 2));
+
+		for (int64_t m = first; m <= last; m++)
+			completeBlock(m);
+
+		const int64_t progress = firstSample + numSamples - last * hop;
+		advance(last + 1, (int)(synth.getNumSteps() * progress / hop));
+	}
+
+	void process(const Tile& tile)
+	{
+		int s = 0;
+
+		//Every sample is the sum of the current block and the second half of the previous one
+		while (s < tile.numSamples)
+		{
+			const int64_t m = getBlockIndex(tile.firstSample + s);
+			const int64_t offset = tile.firstSample + s - m * hop;
+			const int end = (int)std::min<int64_t>(tile.numSamples, (m + 1) * hop - tile.firstSample);
+
+			const float* current = getBlock(m) + (size_t)offset * numChannels + tile.firstChannel;
+			const float* previous = getBlock(m - 1) + (size_t)(offset + hop) * numChannels + tile.firstChannel;
+
+			for (int i = 0; i < end - s; i++)
+			{
+				float* row = tile.row(s + i);
+				const float* a = current + (size_t)i * numChannels;
+				const float* b = previous + (size_t)i * numChannels;
+
+				for (int c = 0; c < tile.numChannels; c++)
+					row[c] += a[c] + b[c];
+			}
+
+			s = end;
+		}
+	}
+
+private:
+
+	static const int64_t NO_BLOCK = INT64_MIN;
+
+	int64_t getBlockIndex(int64_t sample) const { return sample >= 0 ? sample / hop : -((-sample + hop - 1) / hop); }
+
+	int getSlot(int64_t block) const
+	{
+		const int64_t n = (int64_t)slotBlock.size();
+		return (int)(((block % n) + n) % n);
+	}
+
+	const float* getBlock(int64_t block) const { return blocks.data() + (size_t)getSlot(block) * blockSize; }
+
+	/* Consecutive blocks, up to n, get distinct slots; rendered blocks are dropped */
+	void setSlots(int n)
+	{
+		blocks.assign((size_t)n * blockSize, 0.0f);
+		slotBlock.assign((size_t)n, (int64_t)NO_BLOCK);
+		pendingBlock = NO_BLOCK;
+	}
+
+	/* Renders block up to step target (of synth.getNumSteps()); another block in progress restarts */
+	void advance(int64_t block, int target)
+	{
+		const int slot = getSlot(block);
+
+		if (slotBlock[slot] == block)
+			return;
+
+		if (pendingBlock != block)
+		{
+			pendingBlock = block;
+			pendingStep = 0;
+			slotBlock[slot] = NO_BLOCK;
+		}
+
+		float* dest = blocks.data() + (size_t)slot * blockSize;
+
+		while (pendingStep < target)
+			synth.renderStep(block, pendingStep++, dest);
+
+		if (pendingStep == synth.getNumSteps())
+		{
+			slotBlock[slot] = block;
+			pendingBlock = NO_BLOCK;
+		}
+	}
+
+	void completeBlock(int64_t block) { advance(block, synth.getNumSteps()); }
+
+	bool enabled;
+	int numChannels;
+	int hop;
+	size_t blockSize;
+
+	SpectralBlockSynth synth;
+
+	/* Rendered blocks, [slot][sample][channel], and the block each slot holds */
+	std::vector<float> blocks;
+	std::vector<int64_t> slotBlock;
+
+	/* Block partly rendered into its slot, and its next step */
+	int64_t pendingBlock;
+	int pendingStep;
+};
+
+/**
+	Probe-wide rhythms (see OscillationSettings) and ripple events.
+
+	The temporal part of every band is rendered once per packet by a ModulatedOscillator
+	(beginPacket); tiles then only combine it with per-channel vectors. A band travelling at
+	speed v reaches depth y with a phase lag of 2 pi f y / v, so channel c gets
+	sin(theta + phi_c) = sin(theta) cos(phi_c) + cos(theta) sin(phi_c): two multiply-adds
+	per band, channel and sample.
+
+	Ripples start at sample n with probability rate / sampleRate (decided by hash, like unit
+	spikes) at a random depth; each plays a precomputed Gaussian-windowed burst scaled by a
+	Gaussian spatial profile around its depth.
+*/
+
+/* Ripples overlapping one packet; further events are dropped */
+#define MAX_ACTIVE_RIPPLES 8
+
+class OscillationStage : public GenerationStage<OscillationStage>
+{
+public:
+
+	OscillationStage() : enabled(false), numBands(0), packetStart(0), packetLength(0), numRipples(0), rippleThreshold(0), seed(0) {}
+
+	bool isEnabled() const { return enabled; }
+
+	void prepare(const StageContext& context)
+	{
+		enabled = context.oscillations != nullptr && context.oscillations->isEnabled() && context.numChannels > 0;
+		numBands = 0;
+		numRipples = 0;
+		packetLength = 0;
+		seed = context.seed;
+
+		if (!enabled)
+			return;
+
+		const OscillationSettings& settings = *context.oscillations;
+		const int numChannels = context.numChannels;
+
+		channelY.resize(numChannels);
+		for (int c = 0; c < numChannels; c++)
+			channelY[c] = context.sitePositions != nullptr ? context.sitePositions[2 * context.getElectrode(c) + 1] : 0.0f;
+
+		probeLength = 0.0f;
+		for (int c = 0; c < numChannels; c++)
+			probeLength = std::max(probeLength, channelY[c]);
+
+		numBands = std::min(settings.numBands, MAX_OSCILLATION_BANDS);
+		phaseCos.resize((size_t)numBands * numChannels);
+		phaseSin.resize((size_t)numBands * numChannels);
+
+		for (int b = 0; b < numBands; b++)
+		{
+			const OscillationBand& band = settings.bands[b];
+			const double initialPhase = 6.283185307179586 * (double)(hashSample(seed, 0x05C1 + b, 0) >> 11) / 9007199254740992.0;
+
+			oscillators[b].configure(band, context.sampleRate, initialPhase);
+
+			for (int c = 0; c < numChannels; c++)
+			{
+				const double lag = band.waveSpeed != 0.0f ? -6.283185307179586 * band.frequency * channelY[c] / band.waveSpeed : 0.0;
+				phaseCos[(size_t)b * numChannels + c] = (float)std::cos(lag);
+				phaseSin[(size_t)b * numChannels + c] = (float)std::sin(lag);
+			}
+		}
+
+		//One ripple burst: carrier under a Gaussian window spanning +-3 sd over the duration
+		ripple.clear();
+		rippleThreshold = 0;
+
+		if (settings.rippleRate > 0.0f && settings.rippleAmplitude != 0.0f && settings.rippleDuration > 0.0f)
+		{
+			const int length = std::max(1, (int)(settings.rippleDuration * context.sampleRate));
+
+			for (int i = 0; i < length; i++)
+			{
+				const float x = 6.0f * ((float)i / length - 0.5f);
+				ripple.push_back(settings.rippleAmplitude * std::exp(-0.5f * x * x)
+					* (float)std::sin(6.283185307179586 * settings.rippleFrequency * i / context.sampleRate));
+			}
+
+			rippleThreshold = (uint64_t)((double)settings.rippleRate / context.sampleRate * 18446744073709551615.0);
+			rippleExtent = std::max(1.0f, settings.rippleExtent);
+		}
+
+		rippleOnsets.reset();
+
+		for (int r = 0; r < MAX_ACTIVE_RIPPLES; r++)
+		{
+			ripples[r].onset = -1;
+			ripples[r].gain.assign(numChannels, 0.0f);
+		}
+
+		temporal.reserve((size_t)2 * numBands * 512);
+	}
+
+	void beginPacket(int64_t firstSample, int numSamples)
+	{
+		if (!enabled)
+			return;
+
+		packetStart = firstSample;
+		packetLength = numSamples;
+
+		//Temporal part of every band: [band][sine, cosine][sample]
+		temporal.resize((size_t)2 * numBands * numSamples);
+
+		for (int b = 0; b < numBands; b++)
+		{
+			float* sine = temporal.data() + (size_t)2 * b * numSamples;
+			oscillators[b].render(firstSample, numSamples, sine, sine + numSamples);
+		}
+
+		findRipples(firstSample, numSamples);
+	}
+
+	void process(const Tile& tile)
+	{
+		const int numChannels = (int)channelY.size();
+		const int offset = (int)(tile.firstSample - packetStart);
+
+		for (int b = 0; b < numBands; b++)
+		{
+			const float* sine = temporal.data() + (size_t)2 * b * packetLength + offset;
+			const float* cosine = sine + packetLength;
+			const float* p = phaseCos.data() + (size_t)b * numChannels + tile.firstChannel;
+			const float* q = phaseSin.data() + (size_t)b * numChannels + tile.firstChannel;
+
+			for (int s = 0; s < tile.numSamples; s++)
+			{
+				float* row = tile.row(s);
+				const float a = sine[s];
+				const float d = cosine[s];
+
+				for (int c = 0; c < tile.numChannels; c++)
+					row[c] += a * p[c] + d * q[c];
+			}
+		}
+
+		const int length = (int)ripple.size();
+
+		for (int r = 0; r < numRipples; r++)
+		{
+			const Ripple& event = ripples[r];
+			const int first = std::max(event.firstChannel, tile.firstChannel);
+			const int last = std::min(event.endChannel, tile.firstChannel + tile.numChannels);
+
+			if (first >= last)
+				continue;
+
+			const int begin = (int)std::max<int64_t>(0, event.onset - tile.firstSample);
+			const int end = (int)std::min<int64_t>(tile.numSamples, event.onset + length - tile.firstSample);
+
+			for (int s = begin; s < end; s++)
+			{
+				float* row = tile.row(s);
+				const float value = ripple[(size_t)(tile.firstSample + s - event.onset)];
+
+				for (int c = first; c < last; c++)
+					row[c - tile.firstChannel] += value * event.gain[c];
+			}
+		}
+	}
+
+private:
+
+	struct Ripple
+	{
+		int64_t onset;
+		int firstChannel; // channels with a non-negligible gain
+		int endChannel;
+		std::vector<float> gain;
+	};
+
+	/* Collects the ripples overlapping the packet, reusing the gains of those already active */
+	void findRipples(int64_t firstSample, int numSamples)
+	{
+		numRipples = 0;
+
+		if (ripple.empty())
+			return;
+
+		rippleOnsets.advance(firstSample, firstSample + numSamples, (int)ripple.size(),
+			[this](int64_t n) { return hashSample(seed ^ 0x819913ULL, (uint64_t)n, 0) < rippleThreshold; });
+
+		for (size_t i = 0; i < rippleOnsets.onsets.size() && numRipples < MAX_ACTIVE_RIPPLES; i++)
+		{
+			const int64_t n = rippleOnsets.onsets[i];
+
+			//Active ripples keep their slot (and gains) from packet to packet
+			int slot = numRipples;
+
+			for (int r = numRipples; r < MAX_ACTIVE_RIPPLES; r++)
+			{
+				if (ripples[r].onset == n)
+				{
+					slot = r;
+					break;
+				}
+			}
+
+			std::swap(ripples[numRipples], ripples[slot]);
+			Ripple& event = ripples[numRipples++];
+
+			if (event.onset != n)
+			{
+				event.onset = n;
+				setGains(event, probeLength * (float)(hashSample(seed ^ 0x819913ULL, (uint64_t)n, 1) >> 40) / 16777216.0f);
+			}
+		}
+	}
+
+	void setGains(Ripple& event, float depth)
+	{
+		const int numChannels = (int)channelY.size();
+		event.firstChannel = numChannels;
+		event.endChannel = 0;
+
+		for (int c = 0; c < numChannels; c++)
+		{
+			const float x = (channelY[c] - depth) / rippleExtent;
+			event.gain[c] = x * x < 9.0f ? std::exp(-0.5f * x * x) : 0.0f;
+
+			if (event.gain[c] != 0.0f)
+			{
+				event.firstChannel = std::min(event.firstChannel, c);
+				event.endChannel = c + 1;
+			}
+		}
+	}
+
+	bool enabled;
+	int numBands;
+
+	ModulatedOscillator oscillators[MAX_OSCILLATION_BANDS];
+
+	/* Per band and channel: cos and sin of the travelling-wave phase lag */
+	std::vector<float> phaseCos;
+	std::vector<float> phaseSin;
+
+	std::vector<float> channelY;
+	float probeLength;
+
+	/* Band signals of the current packet */
+	std::vector<float> temporal;
+	int64_t packetStart;
+	int packetLength;
+
+	std::vector<float> ripple;
+	OnsetTrack rippleOnsets;
+	Ripple ripples[MAX_ACTIVE_RIPPLES];
+	int numRipples;
+	uint64_t rippleThreshold;
+	float rippleExtent;
+
+	uint64_t seed;
+};
+
+/* Partial sums of the common average; a power of two, enough to cover two AVX registers */
+#define REFERENCE_ACCUMULATORS 16
+
+/* Emulates the probe reference: none, one reference electrode, or the common average of all channels */
+class ReferenceStage : public GenerationStage<ReferenceStage>
+{
+public:
+
+	enum Mode { NONE = 0, ELECTRODE, AVERAGE };
+
+	/* Averaging needs every channel of a sample in the same tile */
+	static const bool spansAllChannels = true;
+
+	ReferenceStage() : mode(NONE), referenceElectrode(0), referenceChannel(-1) {}
+
+	/* electrode is used in ELECTRODE mode; if it is not generated the stage does nothing */
+	void setReference(Mode m, int electrode)
+	{
+		mode = m;
+		referenceElectrode = electrode;
+		findReferenceChannel();
+	}
+
+	bool isEnabled() const { return mode == AVERAGE || (mode == ELECTRODE && referenceChannel >= 0); }
+
+	void prepare(const StageContext& context)
+	{
+		electrodes.resize(context.numChannels);
+
+		for (int c = 0; c < context.numChannels; c++)
+			electrodes[c] = context.getElectrode(c);
+
+		findReferenceChannel();
+	}
+
+	void process(const Tile& tile)
+	{
+		if (mode == AVERAGE && tile.numChannels > 0)
+		{
+			const float scale = 1.0f / (float)tile.numChannels;
+
+			for (int s = 0; s < tile.numSamples; s++)
+			{
+				float* row = tile.row(s);
+				const float mean = sumChannels(row, tile.numChannels) * scale;
+
+				for (int c = 0; c < tile.numChannels; c++)
+					row[c] -= mean;
+			}
+		}
+		else if (mode == ELECTRODE)
+		{
+			for (int s = 0; s < tile.numSamples; s++)
+			{
+				float* row = tile.row(s);
+				const float reference = row[referenceChannel];
+
+				for (int c = 0; c < tile.numChannels; c++)
+					row[c] -= reference;
+			}
+		}
+	}
+
+	/* Sum of count floats. Independent partial sums break the dependency chain of a single
+	   accumulator, so the adds pipeline and vectorise without -ffast-math */
+	static float sumChannels(const float* row, int count)
+	{
+		float partial[REFERENCE_ACCUMULATORS] = {};
+		int c = 0;
+
+		for (; c + REFERENCE_ACCUMULATORS <= count; c += REFERENCE_ACCUMULATORS)
+			for (int k = 0; k < REFERENCE_ACCUMULATORS; k++)
+				partial[k] += row[c + k];
+
+		for (; c < count; c++)
+			partial[0] += row[c];
+
+		for (int width = REFERENCE_ACCUMULATORS / 2; width > 0; width /= 2)
+			for (int k = 0; k < width; k++)
+				partial[k] += partial[k + width];
+
+		return partial[0];
+	}
+
+private:
+
+	void findReferenceChannel()
+	{
+		referenceChannel = -1;
+
+		for (size_t c = 0; c < electrodes.size(); c++)
+			if (electrodes[c] == referenceElectrode)
+				referenceChannel = (int)c;
+	}
+
+	Mode mode;
+	int referenceElectrode;
+	int referenceChannel;
+	std::vector<int> electrodes;
+};
+
+/* Applies the amplifier gain with a fixed per-electrode calibration spread (table built in prepare) */
+class GainStage : public GenerationStage<GainStage>
+{
+public:
+
+	GainStage() : gain(1.0f), spread(0.0f), seed(0) {}
+
+	/* Overall gain (1 disables the stage unless a spread is set) and relative per-electrode spread */
+	void setGain(float g, float relativeSpread = 0.0f)
+	{
+		gain = g;
+		spread = relativeSpread;
+		rebuild();
+	}
+
+	bool isEnabled() const { return gain != 1.0f || spread != 0.0f; }
+
+	void prepare(const StageContext& context)
+	{
+		seed = context.seed;
+		electrodes.resize(context.numChannels);
+
+		for (int c = 0; c < context.numChannels; c++)
+			electrodes[c] = context.getElectrode(c);
+
+		rebuild();
+	}
+
+	void process(const Tile& tile)
+	{
+		const float* channelGains = gains.data() + tile.firstChannel;
+
+		for (int s = 0; s < tile.numSamples; s++)
+		{
+			float* row = tile.row(s);
+
+			for (int c = 0; c < tile.numChannels; c++)
+				row[c] *= channelGains[c];
+		}
+	}
+
+private:
+
+	void rebuild()
+	{
+		gains.resize(electrodes.size());
+
+		for (size_t c = 0; c < electrodes.size(); c++)
+		{
+			const float u = (float)(hashSample(seed, 0xCA11B, (uint64_t)electrodes[c]) >> 40) / 16777216.0f;
+			gains[c] = gain * (1.0f + spread * (2.0f * u - 1.0f));
+		}
+	}
+
+	float gain;
+	float spread;
+	uint64_t seed;
+	std::vector<int> electrodes;
+	std::vector<float> gains;
+};
+
+/**
+	First-order high-pass (y[n] = a * (y[n-1] + x[n] - x[n-1])), emulating the Neuropixels AP
+	band filter. Filter state is kept per channel in separate arrays so the inner loop runs
+	over independent channels and vectorizes; tiles of a channel arrive in sample order, so
+	the result does not depend on the tiling.
+*/
+class HighPassStage : public GenerationStage<HighPassStage>
+{
+public:
+
+	HighPassStage() : enabled(false), cutoff(300.0f), sampleRate(30000.0f), coefficient(1.0f) {}
+
+	/* Enabling starts from a cleared state */
+	void setEnabled(bool shouldBeEnabled, float cutoffHz = 300.0f)
+	{
+		if (shouldBeEnabled && !enabled)
+			clearState();
+
+		enabled = shouldBeEnabled;
+		cutoff = cutoffHz;
+		updateCoefficient();
+	}
+
+	bool isEnabled() const { return enabled; }
+
+	void prepare(const StageContext& context)
+	{
+		sampleRate = context.sampleRate;
+		previousInput.assign(context.numChannels, 0.0f);
+		previousOutput.assign(context.numChannels, 0.0f);
+		updateCoefficient();
+	}
+
+	void process(const Tile& tile)
+	{
+		float* xPrev = previousInput.data() + tile.firstChannel;
+		float* yPrev = previousOutput.data() + tile.firstChannel;
+		const float a = coefficient;
+
+		for (int s = 0; s < tile.numSamples; s++)
+		{
+			float* row = tile.row(s);
+
+			for (int c = 0; c < tile.numChannels; c++)
+			{
+				const float x = row[c];
+				const float y = a * (yPrev[c] + x - xPrev[c]);
+				xPrev[c] = x;
+				yPrev[c] = y;
+				row[c] = y;
+			}
+		}
+	}
+
+private:
+
+	void clearState()
+	{
+		std::fill(previousInput.begin(), previousInput.end(), 0.0f);
+		std::fill(previousOutput.begin(), previousOutput.end(), 0.0f);
+	}
+
+	void updateCoefficient()
+	{
+		const float rc = 1.0f / (2.0f * 3.14159265f * cutoff);
+		const float dt = 1.0f / sampleRate;
+		coefficient = rc / (rc + dt);
+	}
+
+	bool enabled;
+	float cutoff;
+	float sampleRate;
+	float coefficient;
+	std::vector<float> previousInput;
+	std::vector<float> previousOutput;
+};
+
+/* Emulates the ADC: rounds to multiples of the bit-volt step and clips to the 16-bit range */
+class QuantizeStage : public GenerationStage<QuantizeStage>
+{
+public:
+
+	QuantizeStage() : step(0.0f) {}
+
+	bool isEnabled() const { return step > 0.0f; }
+
+	void prepare(const StageContext& context)
+	{
+		step = context.frontEnd != nullptr ? context.frontEnd->adcStep : 0.0f;
+	}
+
+	void process(const Tile& tile)
+	{
+		const float inverse = 1.0f / step;
+		const float lo = -32768.0f;
+		const float hi = 32767.0f;
+
+		for (int s = 0; s < tile.numSamples; s++)
+		{
+			float* row = tile.row(s);
+
+			for (int c = 0; c < tile.numChannels; c++)
+			{
+				float code = std::floor(row[c] * inverse + 0.5f);
+				code = code < lo ? lo : (code > hi ? hi : code);
+				row[c] = code * step;
+			}
+		}
+	}
+
+private:
+
+	float step;
+};
+
+}
+
+/* Standard stage composition of continuous sources: cached waveform, noise, artifacts, spatial
+   sources, background activity and rhythms, then the probe's reference, amplifier gain and AP filter, and finally the ADC */
+typedef SourceSimPipeline::GenerationPipeline<
+	SourceSimPipeline::OscillatorStage,
+	SourceSimPipeline::NoiseStage,
+	SourceSimPipeline::ArtifactStage,
+	SourceSimPipeline::SpatialStage,
+	SourceSimPipeline::BackgroundStage,
+	SourceSimPipeline::OscillationStage,
+	SourceSimPipeline::ReferenceStage,
+	SourceSimPipeline::GainStage,
+	SourceSimPipeline::HighPassStage,
+	SourceSimPipeline::QuantizeStage> ContinuousPipeline;
+
+/* Stage indices of ContinuousPipeline, for pipeline.stage<>() */
+enum ContinuousStage
+{
+	OSCILLATOR_STAGE = 0,
+	NOISE_STAGE,
+	ARTIFACT_STAGE,
+	SPATIAL_STAGE,
+	BACKGROUND_STAGE,
+	OSCILLATION_STAGE,
+	REFERENCE_STAGE,
+	GAIN_STAGE,
+	HIGHPASS_STAGE,
+	QUANTIZE_STAGE
+};
+
+#endif  // __GENERATIONSTAGES_H__
@@ -0,0 +1,269 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Allen Institute for Brain Science and Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "LocalTrigger.h"
+
+#ifdef WIN32
+#include <Windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+/* Shared by every process opening the same trigger; zero-filled when first created */
+struct TriggerState
+{
+    std::atomic<uint32> generation;
+    std::atomic<int32> waiters;
+};
+
+static_assert(ATOMIC_INT_LOCK_FREE == 2, "The shared trigger state needs lock-free atomics");
+
+#ifdef WIN32
+
+struct LocalTrigger::Handle
+{
+    HANDLE semaphore;
+    HANDLE mapping;
+    TriggerState* state;
+};
+
+static LocalTrigger::Handle* openTrigger(const String& name)
+{
+    //The Local namespace is private to the login session
+    const String base = "Local\\" + name;
+
+    HANDLE semaphore = CreateSemaphoreA(NULL, 0, LONG_MAX, base.toRawUTF8());
+
+    if (semaphore == NULL)
+        return nullptr;
+
+    HANDLE mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(TriggerState), (base + "_state").toRawUTF8());
+    void* memory = mapping != NULL ? MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(TriggerState)) : NULL;
+
+    if (memory == NULL)
+    {
+        if (mapping != NULL)
+            CloseHandle(mapping);
+        CloseHandle(semaphore);
+        return nullptr;
+    }
+
+    return new LocalTrigger::Handle{ semaphore, mapping, static_cast<TriggerState*>(memory) };
+}
+
+static void closeTrigger(LocalTrigger::Handle* handle)
+{
+    UnmapViewOfFile(handle->state);
+    CloseHandle(handle->mapping);
+    CloseHandle(handle->semaphore);
+    delete handle;
+}
+
+static bool postTrigger(LocalTrigger::Handle* handle)
+{
+    return ReleaseSemaphore(handle->semaphore, 1, NULL) != 0;
+}
+
+/* Takes one wake-up, waiting up to timeoutMs (0 returns at once) */
+static bool takeTrigger(LocalTrigger::Handle* handle, int timeoutMs)
+{
+    return WaitForSingleObject(handle->semaphore, (DWORD) timeoutMs) == WAIT_OBJECT_0;
+}
+
+#else
+
+struct LocalTrigger::Handle
+{
+    sem_t* semaphore;
+    TriggerState* state;
+};
+
+static LocalTrigger::Handle* openTrigger(const String& name)
+{
+    //Per user and owner-only, so other users can neither fire nor cancel it
+    const String base = "/" + name + "." + String((int) getuid());
+
+    sem_t* semaphore = sem_open(base.toRawUTF8(), O_CREAT, 0600, 0);
+
+    if (semaphore == SEM_FAILED)
+        return nullptr;
+
+    const int fd = shm_open((base + "-state").toRawUTF8(), O_CREAT | O_RDWR, 0600);
+    void* memory = MAP_FAILED;
+
+    if (fd >= 0)
+    {
+        //Sizing an existing segment to its own size leaves the counters alone
+        if (ftruncate(fd, sizeof(TriggerState)) == 0)
+            memory = mmap(nullptr, sizeof(TriggerState), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+        close(fd);
+    }
+
+    if (memory == MAP_FAILED)
+    {
+        sem_close(semaphore);
+        return nullptr;
+    }
+
+    return new LocalTrigger::Handle{ semaphore, static_cast<TriggerState*>(memory) };
+}
+
+static void closeTrigger(LocalTrigger::Handle* handle)
+{
+    munmap(handle->state, sizeof(TriggerState));
+    sem_close(handle->semaphore);
+    delete handle;
+}
+
+static bool postTrigger(LocalTrigger::Handle* handle)
+{
+    return sem_post(handle->semaphore) == 0;
+}
+
+/* Takes one wake-up, waiting up to timeoutMs (0 returns at once) */
+static bool takeTrigger(LocalTrigger::Handle* handle, int timeoutMs)
+{
+    if (timeoutMs <= 0)
+        return sem_trywait(handle->semaphore) == 0;
+
+#ifdef __APPLE__
+    for (int ms = 0; ms < timeoutMs; ms++)
+    {
+        if (sem_trywait(handle->semaphore) == 0)
+            return true;
+
+        usleep(1000);
+    }
+
+    return false;
+#else
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += (long) timeoutMs * 1000000L;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+    deadline.tv_nsec %= 1000000000L;
+
+    //Retry when interrupted by a signal
+    while (sem_timedwait(handle->semaphore, &deadline) != 0)
+    {
+        if (errno != EINTR)
+            return false;
+    }
+
+    return true;
+#endif
+}
+
+#endif
+
+LocalTrigger::LocalTrigger(const String& name_) :
+    name(name_),
+    cancelled(false),
+    armedGeneration(0)
+{
+    handle = openTrigger(name);
+}
+
+LocalTrigger::~LocalTrigger()
+{
+    if (handle != nullptr)
+        closeTrigger(handle);
+}
+
+bool LocalTrigger::isValid() const
+{
+    return handle != nullptr;
+}
+
+void LocalTrigger::arm()
+{
+    cancelled = false;
+
+    if (handle == nullptr)
+        return;
+
+    armedGeneration = handle->state->generation.load();
+
+    //Wake-ups left over from earlier triggers would only cost a spurious check
+    while (takeTrigger(handle, 0))
+        ;
+}
+
+bool LocalTrigger::wait()
+{
+    if (handle == nullptr)
+        return false;
+
+    handle->state->waiters++;
+
+    bool fired = false;
+
+    while (!cancelled)
+    {
+        //Registered before this check, so a trigger fired after it also posts a wake-up for us
+        if (handle->state->generation.load() != armedGeneration)
+        {
+            fired = true;
+            break;
+        }
+
+        takeTrigger(handle, TRIGGER_CANCEL_POLL_MS);
+    }
+
+    handle->state->waiters--;
+
+    return fired;
+}
+
+void LocalTrigger::cancel()
+{
+    //Only this instance's flag: waking the shared semaphore could start another simulator
+    cancelled = true;
+}
+
+bool LocalTrigger::fire(const String& name)
+{
+    Handle* handle = openTrigger(name);
+
+    if (handle == nullptr)
+        return false;
+
+    //The generation moves first, so every waiter woken below sees the trigger
+    handle->state->generation++;
+
+    const int32 waiters = handle->state->waiters.load();
+    bool ok = true;
+
+    for (int32 i = 0; i < waiters; i++)
+        ok &= postTrigger(handle);
+
+    closeTrigger(handle);
+
+    return ok;
+}
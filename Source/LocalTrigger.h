@@ -0,0 +1,89 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Allen Institute for Brain Science and Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __LOCALTRIGGER_H__
+#define __LOCALTRIGGER_H__
+
+#include <DataThreadHeaders.h>
+
+#include <atomic>
+
+#define DEFAULT_TRIGGER_NAME "sourcesim_trigger"
+
+/**
+
+	Start trigger shared with other processes of the same user on the same machine.
+
+	Backed by a POSIX named semaphore and a shared-memory generation counter
+	(/sourcesim_trigger.<uid>, both created 0600) or, on Windows, a named semaphore and
+	file mapping (Local\sourcesim_trigger). Any local process fires it with
+	LocalTrigger::fire() or the plugin's fireSourceSimTrigger() export: the generation
+	is bumped and every registered waiter is woken, so all armed simulators start from
+	the same trigger. A waiter only starts once the generation has moved since it was
+	armed, so surplus wake-ups never count as triggers. Waiters are woken by the kernel
+	(futex/event latency; on macOS, which has no timed semaphore wait, they poll every
+	millisecond) and check for cancel() every TRIGGER_CANCEL_POLL_MS.
+
+*/
+
+/* Longest a waiter blocks before checking whether it was cancelled */
+#define TRIGGER_CANCEL_POLL_MS 20
+
+class LocalTrigger
+{
+public:
+
+	LocalTrigger(const String& name = DEFAULT_TRIGGER_NAME);
+	~LocalTrigger();
+
+	bool isValid() const;
+
+	/** Discards any trigger fired before the simulator was armed.*/
+	void arm();
+
+	/** Blocks until the trigger fires (true) or cancel() is called (false).*/
+	bool wait();
+
+	/** Releases the thread of this instance blocked in wait(); other waiters are not affected.*/
+	void cancel();
+
+	/** Fires the named trigger, starting every armed waiter; this is what the controlling process calls.*/
+	static bool fire(const String& name = DEFAULT_TRIGGER_NAME);
+
+	struct Handle;
+
+private:
+
+	String name;
+	std::atomic<bool> cancelled;
+
+	/* Shared generation when arm() was called */
+	uint32 armedGeneration;
+
+	Handle* handle;
+
+	JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(LocalTrigger);
+
+};
+
+#endif  // __LOCALTRIGGER_H__
@@ -22,6 +22,10 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <PluginInfo.h>
 #include "SourceThread.h"
+#include "SessionRenderer.h"
+#include "SessionStepper.h"
+#include "CapacityProbe.h"
+#include "LocalTrigger.h"
 #include <string>
 
 #ifdef WIN32
@@ -68,6 +72,87 @@ extern "C" EXPORT int getPluginInfo(int index, Plugin::PluginInfo* info)
 	return 0;
 }
 
+/* Headless batch mode: renders a simulated session in Open Ephys binary format into directory.
+   Returns 0 on success. Can be called by loading the plugin library directly, without the GUI. */
+extern "C" EXPORT int renderSourceSimSession(const char* directory, int numProbes, int channelsPerProbe,
+	int numNIDevices, int channelsPerNIDAQDevice, double durationSeconds, unsigned int seed)
+{
+	SessionRenderer::Config config;
+	config.numProbes = numProbes;
+	config.channelsPerProbe = channelsPerProbe;
+	config.numNIDevices = numNIDevices;
+	config.channelsPerNIDAQDevice = channelsPerNIDAQDevice;
+	config.durationSeconds = durationSeconds;
+	config.seed = seed;
+
+	SessionRenderer renderer(config, File(String(directory)));
+
+	return renderer.render() ? 0 : -1;
+}
+
+/* As renderSourceSimSession, with probe motion (see DriftSettings); every probe stream also gets
+   continuous/<stream>/drift_trace.csv with the true displacement for scoring motion correction. */
+extern "C" EXPORT int renderSourceSimDriftSession(const char* directory, int numProbes, int channelsPerProbe,
+	double durationSeconds, unsigned int seed, float driftAmplitude, float driftFrequency, float driftRandomWalk, float driftNonRigid)
+{
+	SessionRenderer::Config config;
+	config.numProbes = numProbes;
+	config.channelsPerProbe = channelsPerProbe;
+	config.numNIDevices = 0;
+	config.durationSeconds = durationSeconds;
+	config.seed = seed;
+	config.drift = DriftSettings{ driftAmplitude, driftFrequency, driftRandomWalk, driftNonRigid, 0.1f, seed };
+
+	SessionRenderer renderer(config, File(String(directory)));
+
+	return renderer.render() ? 0 : -1;
+}
+
+/* Deterministic step mode: generates durationSeconds of the session from the calling thread, packet
+   by packet, and writes the session hash (see SessionStepper) to hash. The same arguments always
+   give the same hash. Returns 0 on success. */
+extern "C" EXPORT int hashSourceSimSession(int numProbes, int channelsPerProbe, int numNIDevices,
+	int channelsPerNIDAQDevice, double durationSeconds, unsigned int seed, unsigned long long* hash)
+{
+	if (hash == nullptr)
+		return -1;
+
+	SessionRenderer::Config config;
+	config.numProbes = numProbes;
+	config.channelsPerProbe = channelsPerProbe;
+	config.numNIDevices = numNIDevices;
+	config.channelsPerNIDAQDevice = channelsPerNIDAQDevice;
+	config.seed = seed;
+
+	SessionStepper stepper(config);
+	stepper.run(durationSeconds);
+
+	*hash = (unsigned long long) stepper.getHash();
+
+	return 0;
+}
+
+/* Capacity sweep (see CapacityProbe): finds the largest rig this machine generates in real time and
+   writes the JSON report to reportFile. Blocks for several minutes. Returns 0 on success. */
+extern "C" EXPORT int probeSourceSimCapacity(const char* reportFile, double secondsPerStep)
+{
+	CapacityProbe::Config config;
+
+	if (secondsPerStep > 0)
+		config.secondsPerStep = secondsPerStep;
+
+	CapacityProbe probe(config, File(String(reportFile)));
+
+	return probe.sweep() ? 0 : -1;
+}
+
+/* Fires the local start trigger of an armed simulator (external trigger mode).
+   Returns 0 on success. */
+extern "C" EXPORT int fireSourceSimTrigger()
+{
+	return LocalTrigger::fire() ? 0 : -1;
+}
+
 #ifdef WIN32
 BOOL WINAPI DllMain(IN HINSTANCE hDllHandle,
 	IN DWORD     nReason,
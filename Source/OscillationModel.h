@@ -0,0 +1,213 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Allen Institute for Brain Science and Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __OSCILLATIONMODEL_H__
+#define __OSCILLATIONMODEL_H__
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#define MAX_OSCILLATION_BANDS 4
+
+/* Samples between exact phase and envelope anchors of a ModulatedOscillator */
+#define OSCILLATOR_CONTROL_INTERVAL 32
+
+/* One rhythm, e.g. theta or gamma */
+struct OscillationBand
+{
+	float frequency;    // Hz, carrier
+	float amplitude;    // uV
+	float amDepth;      // 0 = constant amplitude, 1 = fully modulated
+	float amFrequency;  // Hz
+	float fmDeviation;  // Hz, peak frequency deviation
+	float fmFrequency;  // Hz
+	float waveSpeed;    // um/s, travelling upwards along the probe (negative: downwards); 0 = in phase everywhere
+};
+
+/* Rhythms shared by the whole probe plus transient ripple events */
+struct OscillationSettings
+{
+	int numBands;
+	OscillationBand bands[MAX_OSCILLATION_BANDS];
+
+	float rippleRate;       // events per s
+	float rippleFrequency;  // Hz
+	float rippleDuration;   // s
+	float rippleAmplitude;  // uV at the centre of the event
+	float rippleExtent;     // um, spatial standard deviation around the centre
+
+	bool isEnabled() const { return numBands > 0 || (rippleRate > 0.0f && rippleAmplitude != 0.0f); }
+};
+
+/* Travelling theta with slow AM/FM, nested gamma and sharp-wave ripples */
+inline OscillationSettings getDefaultOscillations()
+{
+	OscillationSettings s;
+	s.numBands = 2;
+	s.bands[0] = OscillationBand{ 7.0f, 80.0f, 0.3f, 0.3f, 1.0f, 0.1f, 200000.0f };
+	s.bands[1] = OscillationBand{ 40.0f, 15.0f, 0.8f, 7.0f, 5.0f, 0.5f, 0.0f };
+	s.rippleRate = 0.2f;
+	s.rippleFrequency = 180.0f;
+	s.rippleDuration = 0.06f;
+	s.rippleAmplitude = 60.0f;
+	s.rippleExtent = 150.0f;
+	return s;
+}
+
+/**
+
+	Amplitude- and frequency-modulated sinusoid produced by a recursive (rotating phasor)
+	oscillator.
+
+	Phase and envelope have closed forms, evaluated exactly once every
+	OSCILLATOR_CONTROL_INTERVAL samples at absolute sample positions. In between, the phasor
+	is rotated by a constant complex factor and the envelope interpolated linearly, so a
+	sample costs a handful of multiplies and no transcendental calls. Any sample range
+	starts from its segment's anchor, so the output does not depend on how generation is
+	split into packets. The current segment and the phasor where the last range ended are
+	kept, so consecutive packets shorter than a segment resume instead of re-anchoring.
+
+*/
+
+class ModulatedOscillator
+{
+public:
+
+	ModulatedOscillator() : omega(0), fmIndex(0), fmOmega(0), amOmega(0), amplitude(0), amDepth(0), phase(0),
+		segmentAnchor(NO_SEGMENT), anchorRe(1), anchorIm(0), rotationRe(1), rotationIm(0), envelope0(0), slope(0),
+		resumeSample(NO_SEGMENT), resumeRe(1), resumeIm(0) {}
+
+	void configure(const OscillationBand& band, float sampleRate, double initialPhase)
+	{
+		const double toRadians = 6.283185307179586 / sampleRate;
+
+		omega = band.frequency * toRadians;
+		fmOmega = band.fmFrequency * toRadians;
+		fmIndex = fmOmega > 0.0 ? band.fmDeviation * toRadians / fmOmega : 0.0;
+		amOmega = band.amFrequency * toRadians;
+		amplitude = band.amplitude;
+		amDepth = band.amDepth;
+		phase = initialPhase;
+		segmentAnchor = NO_SEGMENT;
+		resumeSample = NO_SEGMENT;
+	}
+
+	/* Writes envelope * sin(phase) and envelope * cos(phase) for samples [firstSample, firstSample + numSamples) */
+	void render(int64_t firstSample, int numSamples, float* sine, float* cosine)
+	{
+		const int K = OSCILLATOR_CONTROL_INTERVAL;
+		int s = 0;
+
+		while (s < numSamples)
+		{
+			const int64_t n = firstSample + s;
+			const int64_t anchor = n >= 0 ? n - n % K : n - ((n % K) + K) % K;
+			const int end = (int)std::min<int64_t>(numSamples, anchor + K - firstSample);
+
+			if (anchor != segmentAnchor)
+			{
+				const double theta0 = getPhase(anchor);
+				const double step = (getPhase(anchor + K) - theta0) / K;
+
+				segmentAnchor = anchor;
+				envelope0 = getEnvelope(anchor);
+				slope = (getEnvelope(anchor + K) - envelope0) / K;
+				rotationRe = (float)std::cos(step);
+				rotationIm = (float)std::sin(step);
+				anchorRe = (float)std::cos(theta0);
+				anchorIm = (float)std::sin(theta0);
+			}
+
+			//Phasor where the previous range stopped, or at the anchor advanced to the first sample of the range
+			float re = anchorRe;
+			float im = anchorIm;
+			int offset = 0;
+
+			if (n == resumeSample)
+			{
+				re = resumeRe;
+				im = resumeIm;
+				offset = (int)(n - anchor);
+			}
+
+			for (; offset < (int)(n - anchor); offset++)
+				rotate(re, im, rotationRe, rotationIm);
+
+			for (; s < end; s++, offset++)
+			{
+				const float envelope = envelope0 + slope * offset;
+				sine[s] = envelope * im;
+				cosine[s] = envelope * re;
+				rotate(re, im, rotationRe, rotationIm);
+			}
+
+			//Only valid within this segment; a range ending on the next anchor starts that segment afresh
+			resumeSample = offset < K ? firstSample + s : NO_SEGMENT;
+			resumeRe = re;
+			resumeIm = im;
+		}
+	}
+
+private:
+
+	static const int64_t NO_SEGMENT = INT64_MIN;
+
+	static void rotate(float& re, float& im, float rotationRe, float rotationIm)
+	{
+		const float r = re * rotationRe - im * rotationIm;
+		im = re * rotationIm + im * rotationRe;
+		re = r;
+	}
+
+	/* Integral of the instantaneous frequency omega + deviation * sin(fmOmega * n) */
+	double getPhase(int64_t n) const
+	{
+		return phase + omega * (double)n + fmIndex * (1.0 - std::cos(fmOmega * (double)n));
+	}
+
+	float getEnvelope(int64_t n) const
+	{
+		return (float)(amplitude * (1.0 + amDepth * std::sin(amOmega * (double)n)));
+	}
+
+	double omega;
+	double fmIndex;
+	double fmOmega;
+	double amOmega;
+	double amplitude;
+	double amDepth;
+	double phase;
+
+	/* Segment starting at segmentAnchor: phasor at the anchor, its rotation per sample and the envelope line */
+	int64_t segmentAnchor;
+	float anchorRe, anchorIm;
+	float rotationRe, rotationIm;
+	float envelope0, slope;
+
+	/* Phasor at resumeSample, the sample after the last one rendered */
+	int64_t resumeSample;
+	float resumeRe, resumeIm;
+};
+
+#endif  // __OSCILLATIONMODEL_H__
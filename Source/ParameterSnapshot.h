@@ -0,0 +1,148 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Allen Institute for Brain Science and Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __PARAMETERSNAPSHOT_H__
+#define __PARAMETERSNAPSHOT_H__
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+/**
+
+	Publishes immutable, versioned copies of a parameter struct from any number of
+	writer threads to a single reader thread (read-copy-update).
+
+	Writers copy the current value, modify the copy and swap it in with one atomic
+	pointer store; the reader picks up whole snapshots with acquire(), so it never
+	sees a half-written set of parameters and never waits for a writer. Replaced
+	snapshots are retired and deleted by reclaim() - called by writers, never by the
+	reader - once the reader has moved past them.
+
+*/
+
+template <typename T>
+class ParameterSnapshot
+{
+public:
+
+	struct Snapshot
+	{
+		T value;
+		uint64_t version;
+	};
+
+	explicit ParameterSnapshot(const T& initial) : current(new Snapshot{ initial, 1 }), inUse(nullptr) {}
+
+	~ParameterSnapshot()
+	{
+		delete current.load();
+
+		for (Snapshot* s : retired)
+			delete s;
+	}
+
+	/* Reader thread only: returns the latest snapshot, valid until the next call to acquire() */
+	const Snapshot* acquire()
+	{
+		Snapshot* s = current.load(std::memory_order_acquire);
+
+		//Announce the snapshot before using it; retry if a writer replaced it in between
+		while (true)
+		{
+			inUse.store(s, std::memory_order_seq_cst);
+			Snapshot* latest = current.load(std::memory_order_seq_cst);
+
+			if (latest == s)
+				return s;
+
+			s = latest;
+		}
+	}
+
+	/* Copy of the latest value, for writers */
+	T get() const
+	{
+		std::lock_guard<std::mutex> lock(writeLock);
+		return current.load()->value;
+	}
+
+	/* Applies modify(T&) to a copy of the latest value and publishes the result */
+	template <typename Modifier>
+	void update(Modifier modify)
+	{
+		std::lock_guard<std::mutex> lock(writeLock);
+
+		Snapshot* previous = current.load();
+		Snapshot* next = new Snapshot{ previous->value, previous->version + 1 };
+		modify(next->value);
+
+		current.store(next, std::memory_order_seq_cst);
+		retired.push_back(previous);
+
+		reclaimLocked();
+	}
+
+	/* Deletes retired snapshots the reader can no longer be using */
+	void reclaim()
+	{
+		std::lock_guard<std::mutex> lock(writeLock);
+		reclaimLocked();
+	}
+
+	uint64_t getVersion() const { return current.load()->version; }
+
+private:
+
+	void reclaimLocked()
+	{
+		const Snapshot* reading = inUse.load(std::memory_order_seq_cst);
+
+		for (size_t i = 0; i < retired.size();)
+		{
+			if (retired[i] != reading)
+			{
+				delete retired[i];
+				retired[i] = retired.back();
+				retired.pop_back();
+			}
+			else
+			{
+				i++;
+			}
+		}
+	}
+
+	std::atomic<Snapshot*> current;
+	std::atomic<const Snapshot*> inUse;
+
+	mutable std::mutex writeLock;
+	std::vector<Snapshot*> retired;
+
+	ParameterSnapshot(const ParameterSnapshot&) = delete;
+	ParameterSnapshot& operator=(const ParameterSnapshot&) = delete;
+
+};
+
+#endif  // __PARAMETERSNAPSHOT_H__
@@ -0,0 +1,83 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Allen Institute for Brain Science and Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __PROBEGEOMETRY_H__
+#define __PROBEGEOMETRY_H__
+
+#include "DeviceProfile.h"
+
+#include <vector>
+
+/* Vertical site pitch and shank spacing of the simulated probes, in um */
+#define NPX1_ROW_PITCH 20.0f
+#define NPX2_ROW_PITCH 15.0f
+#define NPX2_COLUMN_PITCH 32.0f
+#define NPX2_SHANK_PITCH 250.0f
+
+/**
+	Fills positions with the (x, y) site position in um of electrodes 0..numElectrodes-1,
+	interleaved [electrode][x, y], tip at y = 0. Returns false (and leaves positions empty)
+	for devices without sites.
+
+	NP1.0: four staggered columns (x = 43/11 on even rows, 59/27 on odd rows), 20 um rows.
+	NP2.0 4-shank: two columns 32 um apart, 15 um rows, shanks 250 um apart; the
+	electrodes are divided evenly among the shanks, starting at each tip.
+*/
+inline bool getSitePositions(int profileId, int numElectrodes, std::vector<float>& positions)
+{
+	positions.clear();
+
+	if (profileId == NPX1_PROBE)
+	{
+		static const float columns[2][2] = { { 43.0f, 11.0f }, { 59.0f, 27.0f } };
+
+		for (int e = 0; e < numElectrodes; e++)
+		{
+			const int row = e / 2;
+			positions.push_back(columns[row % 2][e % 2]);
+			positions.push_back(row * NPX1_ROW_PITCH);
+		}
+
+		return true;
+	}
+
+	if (profileId == NPX2_4SHANK_PROBE)
+	{
+		const int shanks = getDeviceProfile(profileId).numShanks;
+		const int perShank = (numElectrodes + shanks - 1) / shanks;
+
+		for (int e = 0; e < numElectrodes; e++)
+		{
+			const int shank = e / perShank;
+			const int local = e % perShank;
+			positions.push_back(shank * NPX2_SHANK_PITCH + (local % 2) * NPX2_COLUMN_PITCH);
+			positions.push_back((local / 2) * NPX2_ROW_PITCH);
+		}
+
+		return true;
+	}
+
+	return false;
+}
+
+#endif  // __PROBEGEOMETRY_H__
@@ -0,0 +1,119 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Allen Institute for Brain Science and Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __SAMPLECLOCK_H__
+#define __SAMPLECLOCK_H__
+
+#include "TtlClock.h"
+
+/**
+
+	Timestamps and TTL line of one source's packets (see SourceSim).
+
+	Packets follow each other from sample 0 without gaps. Sample n is stamped n + 1 (the
+	number of samples acquired once it is in) and carries the TTL level of sample n, so
+	timestamps and edges land on the same samples whatever the packet sizes are. The
+	caller owns the sample counter and passes the first sample of every packet.
+
+*/
+
+class SampleClock
+{
+public:
+
+	SampleClock() : period(0.0f), tolerance(0.0f), level(0), configured(false) {}
+
+	/* Starts over with the TTL line low; the next setTtl configures the clock whatever its settings */
+	void reset()
+	{
+		level = 0;
+		configured = false;
+	}
+
+	/* TTL period (s, 0 holds the level) and frequency tolerance (Hz) from sample on. Only a new
+	   period or tolerance restarts the clock, at its current level; re-applying keeps the phase */
+	void setTtl(double sampleRate, float periodSeconds, float toleranceHz, int64_t sample)
+	{
+		if (configured && periodSeconds == period && toleranceHz == tolerance)
+			return;
+
+		ttl.configure(sampleRate, periodSeconds > 0 ? 1.0 / periodSeconds : 0.0, toleranceHz, sample, level);
+		period = periodSeconds;
+		tolerance = toleranceHz;
+		configured = true;
+	}
+
+	/* TTL codes of samples [first, first + count), all low while disabled. Returns the last rising
+	   edge in the range (or -1) and stores the last falling edge, if any, in fallingEdge */
+	template <typename CodeType>
+	int64_t fillEventCodes(CodeType* codes, int64_t first, int count, bool enabled, int64_t* fallingEdge = nullptr)
+	{
+		if (!enabled)
+		{
+			for (int i = 0; i < count; i++)
+				codes[i] = 0;
+
+			level = 0;
+			return -1;
+		}
+
+		const int64_t risingEdge = ttl.fill(codes, first, count, fallingEdge);
+
+		if (count > 0)
+			level = (int)(codes[count - 1] & 1);
+
+		return risingEdge;
+	}
+
+	/* Calls visit(sample) for every rising edge of the running clock in [first, first + count) without
+	   evaluating the samples in between. The line switching on (see fillEventCodes) is not an edge
+	   of the clock and is not visited */
+	template <typename Visitor>
+	void forEachRisingEdge(int64_t first, int count, Visitor visit) const
+	{
+		ttl.forEachRisingEdge(first, count, visit);
+	}
+
+	/* Timestamps of samples [first, first + count) */
+	template <typename StampType>
+	static void stamp(StampType* timestamps, int64_t first, int count)
+	{
+		for (int i = 0; i < count; i++)
+			timestamps[i] = (StampType)(first + i + 1);
+	}
+
+	/* TTL level of the last sample filled */
+	int getLevel() const { return level; }
+
+private:
+
+	TtlClock ttl;
+
+	float period;
+	float tolerance;
+	int level;
+	bool configured;
+
+};
+
+#endif  // __SAMPLECLOCK_H__
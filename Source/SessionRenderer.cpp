@@ -0,0 +1,301 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Allen Institute for Brain Science and Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "SessionRenderer.h"
+
+#define RENDER_PROCESSOR_NAME "Source Sim"
+#define RENDER_PROCESSOR_ID 100
+
+class SessionRenderer::SourceJob : public ThreadPoolJob
+{
+public:
+
+    SourceJob(SourceSim* source_, const File& recordingDirectory, int subProcessorIdx, int64 totalSamples_) :
+        ThreadPoolJob(source_->name),
+        source(source_),
+        totalSamples(totalSamples_),
+        ok(false)
+    {
+        String folder = getStreamFolderName(subProcessorIdx);
+
+        writer = new BinaryStreamWriter(recordingDirectory.getChildFile("continuous").getChildFile(folder),
+            recordingDirectory.getChildFile("events").getChildFile(folder),
+            source->numChannels, 1.0f, source->packetSize);
+    }
+
+    JobStatus runJob() override
+    {
+        if (!writer->open())
+            return jobHasFinished;
+
+        source->reset();
+
+        while (source->numSamples < totalSamples && !shouldExit())
+        {
+            int count = (int) jmin((int64) source->packetSize, totalSamples - source->numSamples);
+
+            source->acquireParameters();
+            source->updateEventCodes();
+            source->renderPacket();
+            source->stampPacket();
+
+            writer->writePacket(source->packet, source->timestamps, source->eventCodes, count, true);
+        }
+
+        writer->close();
+
+        if (source->drift.isEnabled())
+            source->writeDriftTrace(writer->getContinuousDirectory().getChildFile("drift_trace.csv"), writer->getNumSamplesWritten());
+
+        ok = writer->getNumSamplesWritten() == totalSamples;
+
+        return jobHasFinished;
+    }
+
+    SourceSim* source;
+    ScopedPointer<BinaryStreamWriter> writer;
+    int64 totalSamples;
+    bool ok;
+};
+
+SessionRenderer::Config::Config() :
+    probeType(NPX1_PROBE),
+    numProbes(1),
+    channelsPerProbe(384),
+    numNIDevices(1),
+    channelsPerNIDAQDevice(8),
+    numAPTrains(0),
+    channelsPerAPTrain(16),
+    clkFreq(1),
+    seed(0),
+    durationSeconds(10.0),
+    drift{ 0.0f, 0.0f, 0.0f, 0.0f, 0.1f, 0 },
+    background(DEFAULT_LFP_BACKGROUND),
+    oscillations(getDefaultOscillations()),
+    frontEnd{ 0.0f, 0.0f, 0.0f, 0.0f, 0.0f },
+    spikeTrain(DEFAULT_SPIKE_TRAIN),
+    templatesPerProbe(0)
+{
+}
+
+SessionRenderer::SessionRenderer(const Config& config_, const File& directory_) :
+    config(config_),
+    directory(directory_)
+{
+
+    createSources(config, waveformCache, sources);
+
+}
+
+SessionRenderer::~SessionRenderer()
+{
+}
+
+void SessionRenderer::createSources(const Config& config, WaveformCache& waveformCache, OwnedArray<SourceSim>& sources)
+{
+
+    //Same source layout as SourceThread::generateBuffers
+    Array<int> probes;
+
+    for (int i = 0; i < config.numProbes; i++)
+    {
+        if (getDeviceProfile(config.probeType).splitBands)
+        {
+            sources.add(new NPX_AP_BAND(config.channelsPerProbe));
+            sources.add(new NPX_LFP_BAND(config.channelsPerProbe));
+            probes.add(i);
+            probes.add(i);
+        }
+        else
+        {
+            sources.add(new NPX2_WIDEBAND(config.channelsPerProbe));
+            probes.add(i);
+        }
+    }
+
+    ScopedPointer<TemplateLibrary> templates;
+
+    if (config.templateLibrary != File())
+    {
+        templates = new TemplateLibrary(config.templateLibrary);
+
+        if (!templates->isValid())
+        {
+            std::cout << "Session renderer: ignoring template library: " << templates->getError() << std::endl;
+            templates = nullptr;
+        }
+    }
+
+    for (int i = 0; i < config.numNIDevices; i++)
+        sources.add(new NIDAQ(config.channelsPerNIDAQDevice));
+
+    for (int i = 0; i < config.numAPTrains; i++)
+        sources.add(new APTrain(config.channelsPerAPTrain));
+
+    for (int i = 0; i < sources.size(); i++)
+    {
+        sources[i]->seed = config.seed + (uint32) i;
+        sources[i]->updateClkFreq(config.clkFreq, 0);
+
+        if (sources[i]->getProbeType() >= 0)
+        {
+            sources[i]->drift = config.drift;
+            sources[i]->frontEnd = config.frontEnd;
+        }
+        if (sources[i]->carriesLfp())
+        {
+            sources[i]->background = config.background;
+            sources[i]->oscillations = config.oscillations;
+        }
+        if (sources[i]->isSpikeTrain())
+            sources[i]->spikeTrain = config.spikeTrain;
+
+        //As SourceThread::assignTemplates: one subset per probe, for its 30 kHz stream
+        if (templates != nullptr && i < probes.size() && sources[i]->sampleRate == TEMPLATE_SAMPLE_RATE)
+        {
+            sources[i]->templates = templates->getSubset(waveformCache, config.templatesPerProbe, (uint32) probes[i]);
+            sources[i]->templateElectrodes = templates->getNumElectrodes();
+        }
+
+        sources[i]->prepare(waveformCache);
+    }
+
+}
+
+String SessionRenderer::getStreamFolderName(int subProcessorIdx)
+{
+    return String(RENDER_PROCESSOR_NAME).replace(" ", "_") + "-" + String(RENDER_PROCESSOR_ID) + "." + String(subProcessorIdx);
+}
+
+bool SessionRenderer::render()
+{
+
+    File recordingDirectory = directory.getChildFile("experiment1").getChildFile("recording1");
+
+    if (recordingDirectory.createDirectory().failed())
+        return false;
+
+    const double start = Time::getMillisecondCounterHiRes();
+
+    ThreadPool pool(jmin(SystemStats::getNumCpus(), jmax(1, sources.size())));
+    OwnedArray<SourceJob> jobs;
+
+    for (int i = 0; i < sources.size(); i++)
+    {
+        int64 totalSamples = (int64)(config.durationSeconds * sources[i]->sampleRate);
+        jobs.add(new SourceJob(sources[i], recordingDirectory, i, totalSamples));
+        pool.addJob(jobs.getLast(), false);
+    }
+
+    for (auto job : jobs)
+        pool.waitForJobToFinish(job, -1);
+
+    const double seconds = (Time::getMillisecondCounterHiRes() - start) / 1000.0;
+
+    Array<SourceSim*> rendered;
+    Array<int> indices;
+
+    for (int i = 0; i < sources.size(); i++)
+    {
+        rendered.add(sources[i]);
+        indices.add(i);
+    }
+
+    bool ok = writeStructureFile(recordingDirectory, rendered, indices);
+    int64 bytes = 0;
+
+    for (auto job : jobs)
+    {
+        ok &= job->ok;
+        bytes += job->writer->getNumSamplesWritten() * job->source->numChannels * sizeof(int16);
+    }
+
+    summary = "Rendered " + String(config.durationSeconds) + " s of " + String(sources.size()) + " streams ("
+        + String(bytes / (1024.0 * 1024.0), 1) + " MB) in " + String(seconds, 2) + " s: "
+        + String(config.durationSeconds / jmax(seconds, 1e-6), 1) + "x real time, "
+        + String(bytes / (1024.0 * 1024.0) / jmax(seconds, 1e-6), 1) + " MB/s";
+
+    return ok;
+
+}
+
+bool SessionRenderer::writeStructureFile(const File& recordingDirectory, const Array<SourceSim*>& sources, const Array<int>& subProcessorIndices)
+{
+
+    Array<var> continuous;
+    Array<var> events;
+
+    for (int i = 0; i < sources.size(); i++)
+    {
+        SourceSim* source = sources[i];
+        String folder = getStreamFolderName(subProcessorIndices[i]);
+
+        Array<var> channels;
+
+        for (int j = 0; j < source->numChannels; j++)
+        {
+            DynamicObject* channel = new DynamicObject();
+            channel->setProperty("channel_name", source->name + String(source->getElectrode(j) + 1));
+            channel->setProperty("description", "Simulated " + source->name + " channel");
+            channel->setProperty("identifier", "genericdata.continuous");
+            channel->setProperty("history", RENDER_PROCESSOR_NAME);
+            channel->setProperty("bit_volts", 1.0);
+            channel->setProperty("units", "uV");
+            channel->setProperty("source_processor_index", j);
+            channel->setProperty("recorded_processor_index", j);
+            channels.add(var(channel));
+        }
+
+        DynamicObject* stream = new DynamicObject();
+        stream->setProperty("folder_name", folder + "/");
+        stream->setProperty("sample_rate", source->sampleRate);
+        stream->setProperty("source_processor_name", RENDER_PROCESSOR_NAME);
+        stream->setProperty("source_processor_id", RENDER_PROCESSOR_ID);
+        stream->setProperty("source_processor_sub_idx", subProcessorIndices[i]);
+        stream->setProperty("recorded_processor", RENDER_PROCESSOR_NAME);
+        stream->setProperty("recorded_processor_id", RENDER_PROCESSOR_ID);
+        stream->setProperty("num_channels", source->numChannels);
+        stream->setProperty("channels", channels);
+        continuous.add(var(stream));
+
+        DynamicObject* ttl = new DynamicObject();
+        ttl->setProperty("folder_name", folder + "/TTL_1/");
+        ttl->setProperty("channel_name", source->name + " TTL");
+        ttl->setProperty("description", "Simulated TTL clock");
+        ttl->setProperty("identifier", "sourcesim.ttl");
+        ttl->setProperty("sample_rate", source->sampleRate);
+        ttl->setProperty("type", "int16");
+        ttl->setProperty("num_channels", 8);
+        ttl->setProperty("source_processor", RENDER_PROCESSOR_NAME);
+        events.add(var(ttl));
+    }
+
+    DynamicObject* structure = new DynamicObject();
+    structure->setProperty("GUI version", "0.5.0");
+    structure->setProperty("continuous", continuous);
+    structure->setProperty("events", events);
+    structure->setProperty("spikes", Array<var>());
+
+    return recordingDirectory.getChildFile("structure.oebin").replaceWithText(JSON::toString(var(structure)));
+
+}
@@ -0,0 +1,108 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Allen Institute for Brain Science and Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __SESSIONRENDERER_H__
+#define __SESSIONRENDERER_H__
+
+#include "SourceSim.h"
+#include "BinaryStreamWriter.h"
+#include "DeviceProfile.h"
+#include "TemplateLibrary.h"
+
+/**
+
+	Renders a simulated session straight to disk in Open Ephys binary format, without
+	the GUI or real-time pacing.
+
+	Uses the same SourceSim generators as live acquisition; each source is rendered by
+	its own pool job and streamed through a BinaryStreamWriter, so generation runs in
+	parallel across sources and disk writes overlap with generation.
+
+*/
+
+class SessionRenderer
+{
+public:
+
+	struct Config
+	{
+		Config();
+
+		int probeType;
+		int numProbes;
+		int channelsPerProbe;
+		int numNIDevices;
+		int channelsPerNIDAQDevice;
+		int numAPTrains;
+		int channelsPerAPTrain;
+		int clkFreq;
+		uint32 seed;
+		double durationSeconds;
+		DriftSettings drift;
+		BackgroundSettings background;
+		OscillationSettings oscillations;
+		FrontEndSettings frontEnd;
+		SpikeTrainSettings spikeTrain;
+
+		/* Recorded unit templates (see TemplateLibrary), or File() for the built-in template */
+		File templateLibrary;
+		int templatesPerProbe;
+	};
+
+	SessionRenderer(const Config& config, const File& directory);
+	~SessionRenderer();
+
+	/** Renders the full session; blocks until every stream is on disk. Returns false on I/O errors.*/
+	bool render();
+
+	/** Sample rate, size and throughput summary of the last render.*/
+	String getSummary() const { return summary; }
+
+	/** Folder name of a subprocessor's streams, as written by the GUI's binary format.*/
+	static String getStreamFolderName(int subProcessorIdx);
+
+	/** Writes structure.oebin describing the given sources and their subprocessor indices.*/
+	static bool writeStructureFile(const File& recordingDirectory, const Array<SourceSim*>& sources, const Array<int>& subProcessorIndices);
+
+	/** Adds the sources of a session to sources, in subprocessor order: probe streams, then NI-DAQ devices,
+	    then action potential trains.
+	    Source i is seeded with config.seed + i and prepared from cache.*/
+	static void createSources(const Config& config, WaveformCache& cache, OwnedArray<SourceSim>& sources);
+
+private:
+
+	class SourceJob;
+
+	Config config;
+	File directory;
+
+	WaveformCache waveformCache;
+	OwnedArray<SourceSim> sources;
+
+	String summary;
+
+	JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SessionRenderer);
+
+};
+
+#endif  // __SESSIONRENDERER_H__
@@ -0,0 +1,148 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Allen Institute for Brain Science and Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "SessionStepper.h"
+
+#define STEP_HASH_BASIS 0xCBF29CE484222325ULL
+#define STEP_HASH_PRIME 0x100000001B3ULL
+
+SessionStepper::SessionStepper(const SessionRenderer::Config& config)
+{
+
+    SessionRenderer::createSources(config, waveformCache, sources);
+
+    reset();
+
+}
+
+SessionStepper::~SessionStepper()
+{
+}
+
+void SessionStepper::reset()
+{
+
+    hashes.clearQuick();
+    numPackets.clearQuick();
+
+    for (auto source : sources)
+    {
+        source->reset();
+        hashes.add(STEP_HASH_BASIS);
+        numPackets.add(0);
+    }
+
+}
+
+void SessionStepper::stepSource(int index)
+{
+
+    SourceSim* source = sources[index];
+
+    //Same sequence as a source thread, without the wait and the push
+    source->acquireParameters();
+    source->updateEventCodes();
+    source->renderPacket();
+    source->stampPacket();
+
+    const int count = source->packetSize;
+
+    static_assert(sizeof(float) == sizeof(uint32), "samples are hashed as 32-bit words");
+
+    uint64 hash = hashes[index];
+    hash = hashWords(hash, reinterpret_cast<const uint32*>(source->packet.getData()), (size_t) count * source->numChannels);
+    hash = hashWords(hash, reinterpret_cast<const uint32*>(source->timestamps.getData()), (size_t) count * 2);
+    hash = hashWords(hash, reinterpret_cast<const uint32*>(source->eventCodes.getData()), (size_t) count * 2);
+
+    hashes.set(index, hash);
+    numPackets.set(index, numPackets[index] + 1);
+
+}
+
+int SessionStepper::step()
+{
+
+    //Compares numSamples / sampleRate cross-multiplied, so level streams of different rates tie exactly
+    int next = 0;
+
+    for (int i = 1; i < sources.size(); i++)
+    {
+        if ((double) sources[i]->numSamples * sources[next]->sampleRate < (double) sources[next]->numSamples * sources[i]->sampleRate)
+            next = i;
+    }
+
+    stepSource(next);
+
+    return next;
+
+}
+
+int64 SessionStepper::run(double seconds)
+{
+
+    int64 packets = 0;
+
+    if (sources.size() == 0)
+        return packets;
+
+    for (;;)
+    {
+        bool done = true;
+
+        for (auto source : sources)
+            done &= source->numSamples >= (int64)(seconds * source->sampleRate);
+
+        if (done)
+            return packets;
+
+        step();
+        packets++;
+    }
+
+}
+
+uint64 SessionStepper::getHash() const
+{
+
+    uint64 hash = STEP_HASH_BASIS;
+
+    for (int i = 0; i < hashes.size(); i++)
+    {
+        const uint64 h = hashes[i];
+        const uint32 words[2] = { (uint32) h, (uint32)(h >> 32) };
+        hash = hashWords(hash, words, 2);
+    }
+
+    return hash;
+
+}
+
+uint64 SessionStepper::hashWords(uint64 hash, const uint32* words, size_t count)
+{
+
+    for (size_t i = 0; i < count; i++)
+        hash = (hash ^ words[i]) * STEP_HASH_PRIME;
+
+    return hash;
+
+}
@@ -0,0 +1,91 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Allen Institute for Brain Science and Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __SESSIONSTEPPER_H__
+#define __SESSIONSTEPPER_H__
+
+#include "SessionRenderer.h"
+
+/**
+
+	Advances a simulated session packet by packet from the calling thread, for reproducible tests.
+
+	The sources are built exactly as by SessionRenderer, each seeded from the configuration seed
+	and its index. There are no source threads, no pacing and no background worker: every packet
+	is generated on demand, in an order that depends only on the sources' progress. The same
+	configuration therefore always produces bit-identical samples, timestamps and TTL codes, which
+	are folded into a running hash per source.
+
+	Settings changed on a source between steps (clock, gain, reference...) take effect at its next
+	packet, as they would in a live acquisition.
+
+*/
+
+class SessionStepper
+{
+public:
+
+	SessionStepper(const SessionRenderer::Config& config);
+	~SessionStepper();
+
+	/** Restarts every source at sample 0 and clears the hashes.*/
+	void reset();
+
+	/** Generates the next packet of one source. Its samples, timestamps and TTL codes stay in the
+	    source's packet buffers until its next step.*/
+	void stepSource(int index);
+
+	/** Steps the source furthest behind in virtual time (the lowest index on ties); returns its index.*/
+	int step();
+
+	/** Steps until every source has generated at least seconds of data; returns the number of packets.*/
+	int64 run(double seconds);
+
+	int getNumSources() const { return sources.size(); }
+	SourceSim* getSource(int index) const { return sources[index]; }
+
+	/** Packets generated by a source since the last reset.*/
+	int64 getNumPackets(int index) const { return numPackets[index]; }
+
+	/** Hash of everything a source has generated since the last reset.*/
+	uint64 getHash(int index) const { return hashes[index]; }
+
+	/** Hash of the whole session: the per-source hashes combined in subprocessor order.*/
+	uint64 getHash() const;
+
+private:
+
+	/* FNV-1a over 32-bit words */
+	static uint64 hashWords(uint64 hash, const uint32* words, size_t count);
+
+	WaveformCache waveformCache;
+	OwnedArray<SourceSim> sources;
+
+	Array<uint64> hashes;
+	Array<int64> numPackets;
+
+	JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SessionStepper);
+
+};
+
+#endif  // __SESSIONSTEPPER_H__
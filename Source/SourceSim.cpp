@@ -1,101 +1,598 @@
 #include "SourceSim.h"
 
-SourceSim::SourceSim(String name, int channels, float sampleRate) : Thread(name)
+SourceSim::SourceSim(String name, int channels, float sampleRate) : Thread(name),
+	parameters(SourceParameters{ true, 1.0f, 0.0f, 1.0f, 0.0f, false, 0, 0 }) //1 s clock, default gain without spread, no filter or reference
 {
 	risingEdgeProcessed = false;
 	fallingEdgeProcessed = false;
 
 	this->name = name;
+	traceName = name;
 	numChannels = channels;
-	packetSize = 500;
+	numElectrodes = channels;
+	packetSize = DEFAULT_PACKET_SIZE;
+
+	drift = DriftSettings{ 0.0f, 0.0f, 0.0f, 0.0f, 0.1f, 0 };
+	background = BackgroundSettings{ 0.0f, 2.0f, 0.0f };
+	oscillations = OscillationSettings(); //no bands, no ripples
+	frontEnd = FrontEndSettings{ 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+	spikeTrain = DEFAULT_SPIKE_TRAIN;
+	templateElectrodes = 0;
 	this->sampleRate = sampleRate;
 
-	clkEnabled = true;
-	clk_period = 1; //s
-	clk_tol = 0.001; //sc
+	params = nullptr;
+	appliedParameterVersion = 0;
+
+	seed = 0;
+	recorder = nullptr;
+	missedRecorderPackets = 0;
+
+	lastRisingEdgeSampleNum = 0;
+	lastFallingEdgeSampleNum = 0;
+
+	timeScale = 1.0;
+	setStartTime(high_resolution_clock::now());
+	bufferSize = 1000;
+
+	startGate = nullptr;
+	triggerLatencyUs = -1.0;
+
+	packetDue = getStartTime();
+	sleepOvershoot = 50e-6;
+	latencyBins.calloc(LATENCY_BINS);
+	latencyCount = 0;
+	latencySumUs = 0;
+	latencyPeakUs = 0;
+	latencyMeanUs = -1.0;
+	latencyP99Us = -1.0;
+	latencyMaxUs = -1.0;
+
+	heartbeatMs = 0;
+	generatedSamples = 0;
+	resumeAfterRestart = false;
+
+	activity = STREAM_ACTIVE;
+
+	placementCpu = -1;
+	realtimePriority = false;
+	nodeLocalBuffers = false;
 	
 }
 
-SourceSim::~SourceSim()
+void SourceSim::prepare(WaveformCache& cache)
 {
-}
 
-void SourceSim::timerCallback()
-{
+	allocatePacketBuffers();
 
-	if (clkEnabled)
+	getSitePositions(getProbeType(), numElectrodes, sitePositions);
+
+	int length = getWaveformLength();
+
+	if (length > 0 && numChannels > 0)
 	{
-		eventCode = (!(bool)eventCode);
-		if (eventCode)
+		String description = name + "|" + String(numChannels) + "ch|" + String(sampleRate) + "Hz|"
+			+ String(length) + "|" + describeWaveform() + "|seed" + String((int64)seed);
+
+		if (channelMap.size() > 0)
 		{
-			risingEdgeReceived = true;
-			risingEdgeProcessed = false;
+			String map;
+			for (int electrode : channelMap)
+				map << electrode << ",";
+			description += "|map" + String::toHexString(map.hashCode64());
 		}
-		else
+
+		waveform = cache.getBlock(description, length, numChannels,
+			[this](float* dest, int numSamples, int numChannels) { renderWaveform(dest, numSamples, numChannels); });
+	}
+	else
+	{
+		waveform = nullptr;
+	}
+
+	preparePipeline();
+
+}
+
+void SourceSim::allocatePacketBuffers()
+{
+
+	packet.free();
+	timestamps.free();
+	eventCodes.free();
+
+	packet.calloc((size_t)packetSize * numChannels);
+	timestamps.calloc(packetSize);
+	eventCodes.calloc(packetSize);
+
+}
+
+void SourceSim::applyPlacement()
+{
+
+	ThreadPlacement placed = ThreadPlacement::applyToCurrentThread(placementCpu, realtimePriority);
+
+	if (nodeLocalBuffers && placed.cpu >= 0)
+	{
+		allocatePacketBuffers();
+		placed.nodeLocal = true;
+	}
+
+	const SpinLock::ScopedLockType sl(placementLock);
+	placement = placed;
+
+}
+
+ThreadPlacement SourceSim::getPlacement() const
+{
+	const SpinLock::ScopedLockType sl(placementLock);
+	return placement;
+}
+
+void SourceSim::setNumElectrodes(int electrodes)
+{
+	numElectrodes = electrodes;
+	numChannels = electrodes;
+	channelMap.clear();
+}
+
+bool SourceSim::setChannelMask(const Array<int>& channelStatus)
+{
+
+	Array<int> map;
+
+	for (int electrode = 0; electrode < numElectrodes; electrode++)
+	{
+		if (electrode >= channelStatus.size() || channelStatus[electrode] != 0)
+			map.add(electrode);
+	}
+
+	//A stream keeps at least one channel
+	if (map.size() == 0)
+		return false;
+
+	//All enabled: keep the identity layout (and its plain cache key)
+	if (map.size() == numElectrodes)
+		map.clear();
+
+	if (map == channelMap)
+		return false;
+
+	channelMap.swapWith(map);
+	numChannels = channelMap.size() > 0 ? channelMap.size() : numElectrodes;
+
+	return true;
+
+}
+
+SourceSimPipeline::StageContext SourceSim::getStageContext() const
+{
+	SourceSimPipeline::StageContext context;
+	context.numChannels = numChannels;
+	context.sampleRate = sampleRate;
+	context.seed = seed;
+	context.channelMap = channelMap.size() > 0 ? channelMap.begin() : nullptr;
+	context.sitePositions = sitePositions.empty() ? nullptr : sitePositions.data();
+	context.numElectrodes = numElectrodes;
+	context.drift = drift.isEnabled() ? &drift : nullptr;
+	context.background = background.isEnabled() ? &background : nullptr;
+	context.oscillations = oscillations.isEnabled() ? &oscillations : nullptr;
+	context.frontEnd = frontEnd.isEnabled() ? &frontEnd : nullptr;
+	context.waveform = waveform != nullptr ? waveform->getSamples() : nullptr;
+	context.waveformLength = waveform != nullptr ? waveform->numSamples : 0;
+	context.templates = templates != nullptr && templateElectrodes > 0 ? templates->getSamples() : nullptr;
+	context.numTemplates = context.templates != nullptr ? templates->numSamples / templateElectrodes : 0;
+	context.templateElectrodes = templateElectrodes;
+	context.templateLength = templates != nullptr ? templates->numChannels : 0;
+	return context;
+}
+
+bool SourceSim::writeDriftTrace(const File& file, int64 numSamples) const
+{
+
+	if (!drift.isEnabled() || sitePositions.empty())
+		return false;
+
+	float length = 0.0f;
+	for (size_t e = 1; e < sitePositions.size(); e += 2)
+		length = jmax(length, sitePositions[e]);
+
+	DriftModel model;
+	model.configure(drift, length);
+
+	FileOutputStream out(file);
+
+	if (out.failedToOpen())
+		return false;
+
+	out.setPosition(0);
+	out.truncate();
+
+	//Header: time, then one column per 100 um of depth from the tip
+	out << "time_s";
+	for (float depth = 0.0f; depth <= length; depth += 100.0f)
+		out << ",depth_" << (int)depth << "um";
+	out << "\n";
+
+	const int64_t lastStep = model.getStep(jmax((int64)0, numSamples - 1), sampleRate);
+
+	for (int64_t step = 0; step <= lastStep; step++)
+	{
+		out << String((double)model.getStepStart(step, sampleRate) / sampleRate, 4);
+
+		for (float depth = 0.0f; depth <= length; depth += 100.0f)
+			out << "," << String(model.getDisplacement(step, depth), 3);
+
+		out << "\n";
+	}
+
+	return true;
+
+}
+
+int SourceSim::getLowLatencyPacketSize(float sampleRate)
+{
+	return jmax(MIN_PACKET_SIZE, roundToInt(sampleRate * LOW_LATENCY_PACKET_SECONDS));
+}
+
+void SourceSim::stampPacket()
+{
+
+	SampleClock::stamp(timestamps.getData(), numSamples, packetSize);
+	numSamples += packetSize;
+
+}
+
+void SourceSim::generateDataPacket()
+{
+
+	//TTL-only streams push timestamps and event codes into a buffer without data channels
+	if (activity != STREAM_TTL_ONLY)
+	{
+		TRACE_SCOPE_SAMPLE("render", numSamples);
+		renderPacket();
+	}
+
+	pushPacket();
+
+}
+
+void SourceSim::pushPacket()
+{
+
+	stampPacket();
+
+	{
+		TRACE_SCOPE_SAMPLE("buffer write", timestamps[0]);
+		buffer->addToBuffer(packet, timestamps, eventCodes, packetSize, 1);
+	}
+
+	if (recorder.load() == nullptr)
+		return;
+
+	//The lock is only taken while the recorder is swapped; a packet arriving then is dropped
+	//and counted by the next writer this thread reaches (or by the one being detached)
+	if (!recorderLock.tryEnter())
+	{
+		missedRecorderPackets++;
+		return;
+	}
+
+	{
+		TRACE_SCOPE_SAMPLE("recorder write", timestamps[0]);
+
+		if (BinaryStreamWriter* writer = recorder.load())
 		{
-			fallingEdgeReceived = true;
-			fallingEdgeProcessed = false;
+			if (missedRecorderPackets.load() > 0)
+				writer->addDroppedPackets(missedRecorderPackets.exchange(0));
+
+			writer->writePacket(packet, timestamps, eventCodes, packetSize, false);
 		}
 	}
 
+	recorderLock.exit();
+
 }
 
-void SourceSim::updateClk(bool enable)
+void SourceSim::recordLatency()
 {
-	clkEnabled = enable;
+
+	const double us = duration_cast<duration<double, std::micro>>(high_resolution_clock::now() - packetDue).count();
+
+	latencyBins[jlimit(0, LATENCY_BINS - 1, (int)(us / LATENCY_BIN_US))]++;
+	latencyCount++;
+	latencySumUs += us;
+	latencyPeakUs = jmax(latencyPeakUs, us);
+
+	//Publish about once a second of packets (the percentile costs one pass over the bins)
+	const int64 packetsPerSecond = jmax((int64)1, (int64)(sampleRate / packetSize));
+
+	if (latencyCount % packetsPerSecond != 0)
+		return;
+
+	const int64 rank = latencyCount - latencyCount / 100;
+	int64 seen = 0;
+	int bin = 0;
+
+	while (bin < LATENCY_BINS - 1 && (seen += latencyBins[bin]) < rank)
+		bin++;
+
+	latencyMeanUs = latencySumUs / (double)latencyCount;
+	latencyP99Us = (bin + 1) * LATENCY_BIN_US;
+	latencyMaxUs = latencyPeakUs;
+
 }
 
-void SourceSim::updateClkFreq(int freq, float tol)
+void SourceSim::setRecorder(BinaryStreamWriter* writer)
 {
-	stopTimer();
+	const SpinLock::ScopedLockType sl(recorderLock);
+
+	if (BinaryStreamWriter* previous = recorder.load())
+		previous->addDroppedPackets(missedRecorderPackets.exchange(0));
 
-	clk_period = 1 / (float)freq;
+	recorder = writer;
+}
 
-	startTimer(1000 * clk_period / 2);
+int64 SourceSim::getExpectedSamples() const
+{
+	//Only published values: the watchdog calls this while the source thread runs
+	if (timeScale <= 0)
+		return generatedSamples;
 
+	const double elapsed = duration_cast<duration<double>>(high_resolution_clock::now() - getStartTime()).count();
+	return (int64)(elapsed * timeScale * sampleRate);
 }
 
-void SourceSim::run()
+int64 SourceSim::fillGap(int64 untilSample)
+{
+
+	TRACE_SCOPE_SAMPLE("fill gap", numSamples);
+
+	const int64 gapStart = numSamples;
+
+	while (numSamples + packetSize <= untilSample && !threadShouldExit())
+	{
+		//The gap is pushed as fast as the consumer accepts it
+		while (!threadShouldExit() && buffer->getNumSamples() + packetSize > bufferSize)
+			wait(1);
+
+		acquireParameters();
+		updateEventCodes();
+		FloatVectorOperations::clear(packet, packetSize * numChannels);
+		pushPacket();
+
+		heartbeatMs = Time::getMillisecondCounterHiRes();
+	}
+
+	return numSamples - gapStart;
+
+}
+
+void SourceSim::reset()
 {
 
 	//Keep track of total number of samples generated since starting acquisition
 	numSamples = 0;
 
-	//Start the TTL clock (50% duty cycle @ 1 / clk_period Hz)
-	startTimer(1000 * clk_period  / 2);
+	//Restart the TTL clock low at sample 0
+	sampleClock.reset();
+	lastRisingEdgeSampleNum = 0;
+	lastFallingEdgeSampleNum = 0;
+	risingEdgeProcessed = true;
+	fallingEdgeProcessed = true;
+	appliedParameterVersion = 0;
+
+	//Filter state and the like restart with the acquisition
+	preparePipeline();
+
+	generatedSamples = 0;
+	heartbeatMs = Time::getMillisecondCounterHiRes();
+
+	latencyBins.clear(LATENCY_BINS);
+	latencyCount = 0;
+	latencySumUs = 0;
+	latencyPeakUs = 0;
+	latencyMeanUs = -1.0;
+	latencyP99Us = -1.0;
+	latencyMaxUs = -1.0;
+
+}
+
+void SourceSim::updateClk(bool enable)
+{
+	parameters.update([enable](SourceParameters& p) { p.clkEnabled = enable; });
+}
+
+void SourceSim::updateClkFreq(int freq, float tol)
+{
+
+	//Picked up by the source thread at the next packet boundary
+	parameters.update([freq, tol](SourceParameters& p) {
+		p.clkPeriod = freq > 0 ? 1 / (float)freq : 0;
+		p.clkTol = tol;
+	});
+
+}
+
+void SourceSim::setGain(float gain)
+{
+	parameters.update([gain](SourceParameters& p) { p.gain = gain; });
+}
+
+void SourceSim::setHighPass(bool enable)
+{
+	parameters.update([enable](SourceParameters& p) { p.highPass = enable; });
+}
+
+void SourceSim::setReference(int mode, int electrode)
+{
+	parameters.update([mode, electrode](SourceParameters& p) {
+		p.reference = mode;
+		p.referenceElectrode = electrode;
+	});
+}
+
+void SourceSim::acquireParameters()
+{
+
+	const ParameterSnapshot<SourceParameters>::Snapshot* snapshot = parameters.acquire();
+	params = &snapshot->value;
+
+	//Only a new period or tolerance restarts the clock; toggling it keeps the phase
+	if (snapshot->version != appliedParameterVersion)
+	{
+		sampleClock.setTtl(sampleRate, params->clkPeriod, params->clkTol, numSamples);
+
+		applyParameters(*params);
+		appliedParameterVersion = snapshot->version;
+	}
+
+}
 
-	t1 = high_resolution_clock::now();
+void SourceSim::updateEventCodes()
+{
 
-	int count = 0;
+	int64_t fallingEdge = -1;
+	int64_t risingEdge = sampleClock.fillEventCodes(eventCodes.getData(), numSamples, packetSize, params->clkEnabled, &fallingEdge);
+
+	if (risingEdge >= 0)
+	{
+		lastRisingEdgeSampleNum = risingEdge;
+		risingEdgeProcessed = false;
+		TraceCapture::instant("ttl rising", risingEdge);
+	}
 
-	while (!threadShouldExit())
+	if (fallingEdge >= 0)
 	{
+		lastFallingEdgeSampleNum = fallingEdge;
+		fallingEdgeProcessed = false;
+		TraceCapture::instant("ttl falling", fallingEdge);
+	}
+
+}
 
-		//Stop the thread to simulate 
-		wait((int)(1000.0f * (float) packetSize / (float) sampleRate));
+bool SourceSim::waitForNextPacket()
+{
 
-		//Wait some more until sampling time has completely passed 
-		//while (duration_cast<duration<double>>(high_resolution_clock::now()-t1).count() < packetSize / sampleRate)
+	TRACE_SCOPE("wait");
 
-		//Set event received flag for data packet generation based on events
-		if (risingEdgeReceived)
+	if (timeScale > 0)
+	{
+		//Packet is due once its last sample has been "acquired" in scaled virtual time
+		const double dueSeconds = (double)(numSamples + packetSize) / sampleRate / timeScale;
+		const high_resolution_clock::time_point due = getStartTime() + duration_cast<high_resolution_clock::duration>(duration<double>(dueSeconds));
+		packetDue = due;
+
+		while (!threadShouldExit())
 		{
-			lastRisingEdgeSampleNum = numSamples;
-			risingEdgeReceived = false;
+			const high_resolution_clock::time_point now = high_resolution_clock::now();
+			const double remaining = duration_cast<duration<double>>(due - now).count();
+
+			if (remaining <= 0)
+				break;
+
+			//Far from the due time: millisecond waits, which stay responsive to stop requests
+			if (remaining > PRECISE_WAIT_SECONDS)
+			{
+				wait(jmin(100, (int)(1000.0 * (remaining - 0.5 * PRECISE_WAIT_SECONDS))));
+				heartbeatMs = Time::getMillisecondCounterHiRes();
+				continue;
+			}
+
+			//Close to it: sleep until the typical oversleep before the due time, then yield for the rest.
+			//Spinning only covers the OS wake-up jitter, so small packets do not cost a core each
+			const double sleepSeconds = remaining - sleepOvershoot;
+
+			if (sleepSeconds > 0)
+			{
+				const high_resolution_clock::time_point wake = now + duration_cast<high_resolution_clock::duration>(duration<double>(sleepSeconds));
+				std::this_thread::sleep_until(wake);
+
+				const double overshoot = duration_cast<duration<double>>(high_resolution_clock::now() - wake).count();
+				sleepOvershoot += (jlimit(0.0, 0.001, overshoot) - sleepOvershoot) / 16.0;
+			}
+
+			while (high_resolution_clock::now() < due && !threadShouldExit())
+				std::this_thread::yield();
+
+			break;
 		}
-		else if (fallingEdgeReceived)
+	}
+
+	//Faster than real time, wait for the consumer instead of overwriting unread samples
+	if (timeScale != 1.0)
+	{
+		while (!threadShouldExit() && buffer->getNumSamples() + packetSize > bufferSize)
+		{
+			wait(1);
+			heartbeatMs = Time::getMillisecondCounterHiRes();
+		}
+	}
+
+	return !threadShouldExit();
+
+}
+
+void SourceSim::run()
+{
+
+	heartbeatMs = Time::getMillisecondCounterHiRes();
+
+	TraceCapture::setThreadName(traceName);
+
+	applyPlacement();
+
+	const bool resumed = resumeAfterRestart;
+
+	if (resumed)
+	{
+		//Restarted by the watchdog: same timebase, flat samples over the stalled interval
+		resumeAfterRestart = false;
+		fillGap(getExpectedSamples());
+	}
+	else
+	{
+		reset();
+	}
+
+	//Trigger mode: stay armed until the trigger fires
+	const bool armed = startGate != nullptr && !resumed;
+
+	if (armed)
+	{
+		while (!startGate->wait(100))
 		{
-			lastFallingEdgeSampleNum = numSamples;
-			fallingEdgeReceived = false;
+			if (threadShouldExit())
+				return;
+
+			heartbeatMs = Time::getMillisecondCounterHiRes();
 		}
 
+		if (threadShouldExit())
+			return;
+	}
+
+	while (waitForNextPacket())
+	{
+
+		//Read the live parameters once; the whole packet is generated from this snapshot
+		acquireParameters();
+
+		//Compute TTL states and edges for the packet from the sample clock
+		updateEventCodes();
+
 		//Generate the data packet
 		generateDataPacket();
 
-		//Reset the sampling check time
-		t1 = high_resolution_clock::now();
+		//Measured once sample 0 is in the buffer, so it includes the first packet's pacing
+		if (armed && triggerLatencyUs < 0)
+			triggerLatencyUs = duration_cast<duration<double, std::micro>>(high_resolution_clock::now() - getStartTime()).count();
+
+		if (timeScale > 0)
+			recordLatency();
+
+		generatedSamples = numSamples;
+		heartbeatMs = Time::getMillisecondCounterHiRes();
 
 	}
 
-	stopTimer();
-}
\ No newline at end of file
+}
@@ -3,16 +3,69 @@
 
 #include <DataThreadHeaders.h>
 
+#include "WaveformCache.h"
+#include "GenerationStages.h"
+#include "SampleClock.h"
+#include "SourceTypes.h"
+#include "BinaryStreamWriter.h"
+#include "ParameterSnapshot.h"
+#include "ProbeGeometry.h"
+#include "DriftModel.h"
+#include "BackgroundNoise.h"
+#include "OscillationModel.h"
+#include "ActionPotentialTrain.h"
+#include "ThreadPlacement.h"
+#include "TraceCapture.h"
+
 #include <ctime>
 #include <ratio>
 #include <chrono>
+#include <atomic>
+#include <thread>
+
+/* Samples per packet of a new source; 16.7 ms at 30 kHz */
+#define DEFAULT_PACKET_SIZE 500
+
+/* Packet duration in low-latency mode, and the packet size limits of setPacketSize */
+#define LOW_LATENCY_PACKET_SECONDS 0.00025
+#define MIN_PACKET_SIZE 1
+#define MAX_PACKET_SIZE 30000
+
+/* Below this much time to the next packet the source thread stops waiting in whole milliseconds
+   and sleeps to just before the due time, then yields until it arrives */
+#define PRECISE_WAIT_SECONDS 0.002
 
-#define PI 3.14159f
+/* Packet latency histogram: 10 us bins, the last one collecting everything from 10 ms */
+#define LATENCY_BIN_US 10.0
+#define LATENCY_BINS 1000
 
 using namespace std::chrono;
 
+/* What a subprocessor emits (see SourceThread::setStreamActivity) */
+enum StreamActivity
+{
+	STREAM_ACTIVE = 0, //samples, timestamps and TTL events
+	STREAM_TTL_ONLY, //timestamps and TTL events; no data channels, nothing is generated
+	STREAM_OFF //nothing; the source thread is not started
+};
+
+/* Parameters that can change during acquisition; published to the source thread as a whole */
+struct SourceParameters
+{
+	bool clkEnabled;
+	float clkPeriod; //s, 0 holds the TTL line
+	float clkTol; //Hz
+
+	/* On-probe processing emulation (see setAllGains / setAllReferences / setFilter) */
+	float gain; //relative to the default gain of the band
+	float gainSpread; //relative per-electrode calibration spread, applied at every gain
+	bool highPass; //300 Hz first-order AP filter
+	int reference; //SourceSimPipeline::ReferenceStage::Mode
+	int referenceElectrode;
+};
+
 /* Source Simulator Class to simulate actual sources generating data into OpenEphys */
-class SourceSim : public Thread, public Timer
+class SourceSim : public Thread
 {
 public:
 
@@ -25,196 +78,364 @@ public:
 
 	DataBuffer* buffer;
 
+	/* Output channels: the enabled electrodes only, in electrode order */
 	int numChannels;
+
+	/* Electrodes of the simulated device */
+	int numElectrodes;
+
+	/* Electrode generated on each output channel; empty while every electrode is enabled */
+	Array<int> channelMap;
+
+	int getElectrode(int channel) const { return channelMap.size() > 0 ? channelMap[channel] : channel; }
+
+	/* Changes the electrode count and enables every electrode */
+	void setNumElectrodes(int electrodes);
+
+	/* Generates only electrodes whose status is non-zero (missing entries stay enabled, and a mask
+	   that disables everything is ignored); returns true if the output channels changed. Call prepare() afterwards */
+	bool setChannelMask(const Array<int>& channelStatus);
+
+	/* Samples per packet; call prepare() after changing it */
 	int packetSize;
 	float sampleRate;
+
+	/* Samples per packet of a low-latency stream at sampleRate: LOW_LATENCY_PACKET_SECONDS, at least one sample */
+	static int getLowLatencyPacketSize(float sampleRate);
 	int64 numSamples;
 
-	bool clkEnabled;
-	uint64 eventCode;
-	float clk_period;
-	float clk_tol;
-
-	void timerCallback();
-	bool risingEdgeReceived;
-	bool fallingEdgeReceived;
-	int lastRisingEdgeSampleNum;
-	int lastFallingEdgeSampleNum;
+	/* Written from any thread through updateClk / updateClkFreq, read by the source thread */
+	ParameterSnapshot<SourceParameters> parameters;
+
+	/* Snapshot used for the packet being generated; re-read once per packet */
+	const SourceParameters* params;
+
+	/* Version of the last snapshot read (0 forces a reconfigure) */
+	uint64 appliedParameterVersion;
+
+	/* Reads the latest parameter snapshot; called by the source thread before each packet */
+	void acquireParameters();
+
+	/* Timestamps and TTL clock (50% duty cycle @ 1 / clkPeriod Hz) evaluated per sample */
+	SampleClock sampleClock;
+
+	int64 lastRisingEdgeSampleNum;
+	int64 lastFallingEdgeSampleNum;
 	bool risingEdgeProcessed;
 	bool fallingEdgeProcessed;
 
-	high_resolution_clock::time_point t1;
-	high_resolution_clock::time_point t2;
+	/* Virtual time runs timeScale x faster than wall clock; 0 runs as fast as the buffer drains */
+	double timeScale;
+
+	/* Wall-clock time of sample 0, shared by all sources so they stay aligned; published atomically
+	   because the trigger and the watchdog read or move it from other threads */
+	high_resolution_clock::time_point getStartTime() const { return high_resolution_clock::time_point(high_resolution_clock::duration(startTicks.load())); }
+	void setStartTime(high_resolution_clock::time_point time) { startTicks = time.time_since_epoch().count(); }
+
+	std::atomic<high_resolution_clock::rep> startTicks;
+
+	/* Capacity of the DataBuffer this source writes into, in samples */
+	int bufferSize;
+
+	/* When set, the armed thread holds sample 0 until the gate opens; the start time is then the trigger time */
+	WaitableEvent* startGate;
+
+	/* Time from the trigger to this source's first packet being in its buffer, in microseconds: one
+	   packet of pacing plus the wake-up and generation delay (-1 if untriggered or not there yet) */
+	std::atomic<double> triggerLatencyUs;
 
 	void updateClk(bool enable);
 	void updateClkFreq(int freq, float tol);
 
-	/*Add data as a function of processor sample rate + audio card sample rate */ 
-	virtual void generateDataPacket() = 0;
+	/* Probe processing settings, applied by the source thread at the next packet boundary */
+	void setGain(float gain);
+	void setHighPass(bool enable);
+	void setReference(int mode, int electrode);
 
-};
+	/* Hands a new parameter snapshot to the generator; called on the source thread */
+	virtual void applyParameters(const SourceParameters& p) {}
 
-/* Simulates expected Neuropixels AP Band when probe is in air (60 Hz) */
-class NPX_AP_BAND : public SourceSim
-{
+	/* Fills eventCodes for the next packet and records the edges it contains */
+	void updateEventCodes();
 
-public:
-	NPX_AP_BAND(int nChannels) : SourceSim("AP", nChannels, 30000.0f) {};
-	~NPX_AP_BAND() {};
+	/* Blocks until the next packet is due; returns false if the thread should exit */
+	bool waitForNextPacket();
 
-	void generateDataPacket() {
+	/* Wall-clock time the packet being generated fell due (its last sample acquired in virtual time) */
+	high_resolution_clock::time_point packetDue;
 
-		std::vector<float> samples;
+	/* Running mean of how late the OS wakes the thread from a precise sleep, in seconds; the
+	   sleep ends this much early and the remainder is spun out */
+	double sleepOvershoot;
 
-		for (int i = 0; i < packetSize; i++)
-		{
+	/* Generation-to-buffer latency: from a packet falling due to it being in the buffer. Published
+	   by the source thread about once a second, in microseconds (-1 before the first publication) */
+	std::atomic<double> latencyMeanUs;
+	std::atomic<double> latencyP99Us;
+	std::atomic<double> latencyMaxUs;
 
-			//Generate sine wave at 60 Hz with amplitude 1000
-			for (int j = 0; j < numChannels; j++)
-			{
-				samples.push_back(1000.0f*sin(2*PI*(float)numSamples/(sampleRate / 60.0f)));
-			}
-			numSamples++;
-			buffer->addToBuffer(&samples[0], &numSamples, &eventCode, 1);
-			samples.clear();
-		}
+	/* Adds the latency of the packet just pushed; called on the source thread */
+	void recordLatency();
+
+	/* Histogram and totals since the acquisition started, owned by the source thread */
+	HeapBlock<int64> latencyBins;
+	int64 latencyCount;
+	double latencySumUs;
+	double latencyPeakUs;
+
+	/* Track of the source thread in trace captures (see TraceCapture); set before the thread starts */
+	String traceName;
+
+	/* StreamActivity of the current acquisition; set before the thread starts */
+	int activity;
+
+	/* Seed for any random component; part of the waveform cache key */
+	uint32 seed;
+
+	/* Maps (or renders once) the source waveform and allocates the packet buffers */
+	void prepare(WaveformCache& cache);
+
+	/* (Re)allocates packet, timestamps and eventCodes for packetSize samples from the calling thread */
+	void allocatePacketBuffers();
+
+	/* Placement requested for the source thread, applied each time it starts: CPU (-1 unpinned),
+	   real-time priority, and whether the packet buffers are reallocated from the pinned thread so
+	   their pages come from its NUMA node (first touch). The DataBuffer, the pipeline state and the
+	   shared caches are allocated on the message thread and stay where they are */
+	int placementCpu;
+	bool realtimePriority;
+	bool nodeLocalBuffers;
+
+	/* Placement in effect since the source thread last started */
+	ThreadPlacement getPlacement() const;
+
+	/* Applies the requested placement to the calling (source) thread */
+	void applyPlacement();
+
+	ThreadPlacement placement;
+	SpinLock placementLock;
+
+	/* Length in samples of one period of the source waveform, 0 if the source is not periodic */
+	virtual int getWaveformLength() { return 0; }
+
+	/* Renders exactly one period of the waveform, interleaved [sample][channel] */
+	virtual void renderWaveform(float* dest, int numSamples, int numChannels) {}
+
+	/* Every parameter renderWaveform depends on besides the layout and seed, for the cache key */
+	virtual String describeWaveform() const { return String(); }
+
+	/* DeviceProfileId whose site layout this stream records from, -1 for devices without sites */
+	virtual int getProbeType() const { return -1; }
+
+	/* Site positions of all electrodes (see getSitePositions), refreshed by prepare() */
+	std::vector<float> sitePositions;
+
+	/* Probe motion applied to spatial sources; set before prepare() */
+	DriftSettings drift;
+
+	/* Correlated 1/f background of streams that carry the LFP band; set before prepare() */
+	BackgroundSettings background;
+
+	/* Rhythms and ripples of streams that carry the LFP band; set before prepare() */
+	OscillationSettings oscillations;
+
+	/* Amplifier noise, artifacts and ADC step of probe streams; set before prepare() */
+	FrontEndSettings frontEnd;
+
+	/* True for streams that carry the LFP band (and so its background activity) */
+	virtual bool carriesLfp() const { return false; }
+
+	/* Spike source of action potential trains; set before prepare() */
+	SpikeTrainSettings spikeTrain;
+
+	/* True for action potential trains (and so for spikeTrain) */
+	virtual bool isSpikeTrain() const { return false; }
+
+	/* Recorded unit templates (see TemplateLibrary::getSubset) played by spatial units, or null for the
+	   built-in template; [template][electrode][sample] with templateElectrodes rows per template. Set before prepare() */
+	WaveformCache::Block::Ptr templates;
+	int templateElectrodes;
+
+	/* Writes the true drift trajectory over the first numSamples samples as CSV: one row per drift
+	   step, the displacement (um) at every 100 um of depth. Returns false if drift is off or on error */
+	bool writeDriftTrace(const File& file, int64 numSamples) const;
+
+	/* Describes this source to the stages of a generation pipeline */
+	SourceSimPipeline::StageContext getStageContext() const;
+
+	/* Called at the end of prepare() so pipeline stages can pick up the new configuration */
+	virtual void preparePipeline() {}
+
+	/* Restores the state of a freshly started acquisition (sample 0, TTL low) */
+	void reset();
+
+	/* Stamps the current packet with consecutive sample numbers and advances numSamples */
+	void stampPacket();
+
+	/* Renders, stamps and pushes the next packet into the buffer (and the recorder, if any) */
+	void generateDataPacket();
+
+	/* Stamps the rendered packet and pushes it into the buffer and the recorder */
+	void pushPacket();
+
+	/* Watchdog support: last sign of life (Time::getMillisecondCounterHiRes) and published sample count */
+	std::atomic<double> heartbeatMs;
+	std::atomic<int64> generatedSamples;
+
+	/* Set by the watchdog before restarting a stalled thread: keep the timebase and fill the gap */
+	bool resumeAfterRestart;
+
+	/* Samples (in scaled virtual time) that should have been generated by now */
+	int64 getExpectedSamples() const;
+
+	/* Pushes flat (zero) packets with continuous timestamps up to untilSample; returns the gap length */
+	int64 fillGap(int64 untilSample);
+
+	/* Tees every generated packet into writer (nullptr stops); safe while the thread runs */
+	void setRecorder(BinaryStreamWriter* writer);
+
+	/* Never blocks generation: a packet that finds the recorder busy or full is dropped */
+	std::atomic<BinaryStreamWriter*> recorder;
+	SpinLock recorderLock;
+
+	/* Packets that found recorderLock taken, not yet added to a writer's dropped count */
+	std::atomic<int64> missedRecorderPackets;
+
+	WaveformCache::Block::Ptr waveform;
+
+	HeapBlock<float> packet;
+	HeapBlock<int64> timestamps;
+	HeapBlock<uint64> eventCodes;
+
+	/* Fills packet with the next packetSize samples, starting at sample numSamples */ 
+	virtual void renderPacket() = 0;
 
-	};
 };
 
-/* Simulates expected Neuropixels LFP Band when probe is in air (60 Hz) */
-class NPX_LFP_BAND : public SourceSim
+/* Applies live parameters to the stages of a pipeline; pipelines without such stages ignore them */
+template <class PipelineType>
+inline void configurePipeline(PipelineType&, const SourceParameters&) {}
+
+inline void configurePipeline(ContinuousPipeline& pipeline, const SourceParameters& p)
+{
+	pipeline.stage<REFERENCE_STAGE>().setReference((SourceSimPipeline::ReferenceStage::Mode)p.reference, p.referenceElectrode);
+	pipeline.stage<GAIN_STAGE>().setGain(p.gain, p.gainSpread);
+	pipeline.stage<HIGHPASS_STAGE>().setEnabled(p.highPass);
+}
+
+/* Source whose packets are generated by a composed pipeline in one tiled pass */
+template <class PipelineType>
+class PipelineSourceSim : public SourceSim
 {
 public:
-	NPX_LFP_BAND(int nChannels) : SourceSim("LFP", nChannels, 2500.0f) {};
-	~NPX_LFP_BAND() {};
+	PipelineSourceSim(String name, int channels, float sampleRate) : SourceSim(name, channels, sampleRate) {};
+	~PipelineSourceSim() {};
 
-	void generateDataPacket() {
+	PipelineType pipeline;
 
-		std::vector<float> samples;
+	void preparePipeline() override {
+		pipeline.prepare(getStageContext());
+	};
 
-		for (int i = 0; i < packetSize; i++)
-		{
-			for (int j = 0; j < numChannels; j++)
-			{
-				//Generate sine wave at 60 Hz with amplitude 1000
-				samples.push_back((j % 2 == 0 ? 1.0f : -1.0f) * 1000.0f*sin(2*PI*(float)numSamples/(sampleRate / 60.0f)));
-			}
-			numSamples++;
-			buffer->addToBuffer(&samples[0], &numSamples, &eventCode, 1);
-			samples.clear();
-		}
+	void applyParameters(const SourceParameters& p) override {
+		configurePipeline(pipeline, p);
+	};
 
+	void renderPacket() override {
+		pipeline.process(packet, numChannels, packetSize, numSamples);
 	};
 };
 
-/* Simulates NIDAQ Analog + Digital acquisition w/ 60 Hz sine wave */
-class NIDAQ : public SourceSim
+/* Source of one of the simulated stream types; its settings come from getSourceType so the
+   generation tests build the same sources */
+class TypedSourceSim : public PipelineSourceSim<ContinuousPipeline>
 {
 public:
-	NIDAQ(int nChannels) : SourceSim("AI", nChannels, 30000.0f) {};
-	~NIDAQ() {};
+	TypedSourceSim(int typeId, int nChannels) :
+		PipelineSourceSim(getSourceType(typeId).name, nChannels, getSourceType(typeId).sampleRate),
+		type(getSourceType(typeId)) {
 
-	void generateDataPacket() {
+		pipeline.stage<SPATIAL_STAGE>().setSourceDensity(type.unitDensity, type.lfpDensity, 0);
 
-		std::vector<float> samples;
+		const float spread = type.gainSpread;
+		parameters.update([spread](SourceParameters& p) { p.gainSpread = spread; });
 
-		for (int i = 0; i < packetSize; i++)
+		if (type.carriesLfp)
 		{
-			for (int j = 0; j < numChannels; j++)
-			{
-				//Generate sine wave at 10 Hz with amplitude 1000
-				samples.push_back(1000.0f*sin(2*PI*(float)numSamples/(sampleRate / 10.0f)));
-			}
-			numSamples++;
-			buffer->addToBuffer(&samples[0], &numSamples, &eventCode, 1);
-			samples.clear();
+			background = DEFAULT_LFP_BACKGROUND;
+			oscillations = getDefaultOscillations();
 		}
-
 	};
-};
 
-#define INITIATION_POTENTIAL_START_TIME_IN_MS 0
-#define DEPOLARIZATION_START_TIME_IN_MS 0.8f
-#define REPOLARIZATION_START_TIME_IN_MS 1.3f
-#define HYPERPOLARIZATION_START_TIME_IN_MS 1.8f
-#define REFRACTORY_PERIOD_DURAION_IN_MS 5.0f;
+	int getProbeType() const override { return type.probeType; }
 
-#define RESTING_MEMBRANE_POTENTATION_IN_MV 10.0f
-#define THRESHOLD_POTENTIAL_IN_MV -25.0f
-#define PEAK_DEPOLARIZATION_POTENTIAL_IN_MV -100.0f
+	bool carriesLfp() const override { return type.carriesLfp; }
 
-static unsigned int g_seed;
+	int getWaveformLength() override { return getPeriodLength(sampleRate, type.waveformFrequency); }
 
-inline int fastrand() {
-  g_seed = (214013*g_seed+2531011);
-  return (g_seed>>16)&0x7FFF;
-}
+	void renderWaveform(float* dest, int numSamples, int numChannels) override {
+		renderSourceWaveform(type, sampleRate, dest, numSamples, numChannels, channelMap.size() > 0 ? channelMap.getRawDataPointer() : nullptr);
+	};
 
-/* Simulates AP signal based on crude piece-wise function */
-class APTrain : public SourceSim
+	String describeWaveform() const override {
+		return "sine" + String(type.waveformFrequency) + "Hz" + String(SOURCE_WAVEFORM_AMPLITUDE) + "uV"
+			+ (type.alternatingWaveform ? "|alternating" : "");
+	};
+
+	const SourceTypeDescription& type;
+};
+
+/* Simulates expected Neuropixels AP Band when probe is in air (60 Hz) */
+class NPX_AP_BAND : public TypedSourceSim
 {
 public:
-	APTrain(int nChannels) : SourceSim("APT", nChannels, 30000.0f) {};
-	~APTrain() {};
+	NPX_AP_BAND(int nChannels) : TypedSourceSim(AP_SOURCE, nChannels) {};
+};
+
+/* Simulates expected Neuropixels LFP Band when probe is in air (60 Hz, alternating sign) */
+class NPX_LFP_BAND : public TypedSourceSim
+{
+public:
+	NPX_LFP_BAND(int nChannels) : TypedSourceSim(LFP_SOURCE, nChannels) {};
+};
 
-	void generateDataPacket() {
+/* Simulates a Neuropixels 2.0 wideband stream when probe is in air (60 Hz) */
+class NPX2_WIDEBAND : public TypedSourceSim
+{
+public:
+	NPX2_WIDEBAND(int nChannels) : TypedSourceSim(WB_SOURCE, nChannels) {};
+};
 
-		std::vector<float> samples;
-		float sample_out;
+/* Simulates NIDAQ Analog + Digital acquisition w/ 10 Hz sine wave */
+class NIDAQ : public TypedSourceSim
+{
+public:
+	NIDAQ(int nChannels) : TypedSourceSim(AI_SOURCE, nChannels) {};
+};
 
-		for (int i = 0; i < packetSize; i++)
-		{
+/* Sample rate of action potential trains */
+#define AP_TRAIN_SAMPLE_RATE 30000.0f
 
-			float time = 1000.0f * (float)(numSamples - lastRisingEdgeSampleNum) / sampleRate;
-
-			if (!risingEdgeProcessed)
-			{
-
-				if (time < DEPOLARIZATION_START_TIME_IN_MS) 
-				{
-					sample_out = RESTING_MEMBRANE_POTENTATION_IN_MV + (THRESHOLD_POTENTIAL_IN_MV) * time / (DEPOLARIZATION_START_TIME_IN_MS);
-				}
-				else if (time < REPOLARIZATION_START_TIME_IN_MS)
-				{
-					time -= DEPOLARIZATION_START_TIME_IN_MS;
-					sample_out = THRESHOLD_POTENTIAL_IN_MV + (PEAK_DEPOLARIZATION_POTENTIAL_IN_MV - THRESHOLD_POTENTIAL_IN_MV) * time / (REPOLARIZATION_START_TIME_IN_MS - DEPOLARIZATION_START_TIME_IN_MS);
-				}
-				else if (time < HYPERPOLARIZATION_START_TIME_IN_MS)
-				{ 
-					time -= REPOLARIZATION_START_TIME_IN_MS;
-					sample_out = PEAK_DEPOLARIZATION_POTENTIAL_IN_MV + (RESTING_MEMBRANE_POTENTATION_IN_MV - PEAK_DEPOLARIZATION_POTENTIAL_IN_MV) * time / (HYPERPOLARIZATION_START_TIME_IN_MS - REPOLARIZATION_START_TIME_IN_MS);
-				}
-				else //TODO: Refractory period
-				{
-					risingEdgeProcessed = true;
-				}
-			}
-			else
-			{
-				/* TODO: Implement more meaningful simulated resting membrane potential instead of rand() numbers */
-				/*
-				srand((unsigned) std::time(NULL));
-				float randomNoise = (float) fastrand() / 2147.5;
-				sample_out = RESTING_MEMBRANE_POTENTATION_IN_MV + (randomNoise - 1.0f)*5.0f;
-				*/
-				sample_out = 0;
-			}
-			
-
-			for (int j = 0; j < numChannels; j++)
-			{
-				samples.push_back(sample_out);
-			}
-			numSamples++;
-			buffer->addToBuffer(&samples[0], &numSamples, &eventCode, 1);
-			samples.clear();
+/* Simulates an action potential train (see ActionPotentialTrain) fired by the TTL clock or at a rate */
+class APTrain : public SourceSim
+{
+public:
+	APTrain(int nChannels) : SourceSim("APT", nChannels, AP_TRAIN_SAMPLE_RATE) {};
+	~APTrain() {};
 
-		}
+	bool isSpikeTrain() const override { return true; }
 
+	/* Also called by reset(): no spike in flight, TTL low, rate process restarted */
+	void preparePipeline() override {
+		train.prepare(sampleRate, numChannels, channelMap.size() > 0 ? channelMap.getRawDataPointer() : nullptr, seed, spikeTrain);
 	};
 
+	void renderPacket() override {
+		train.scheduleRisingEdges(sampleClock, eventCodes.getData(), numSamples, packetSize, params->clkEnabled);
+		train.render(packet, packetSize, numSamples);
+	};
 
+	ActionPotentialTrain train;
 };
 
 #endif
\ No newline at end of file
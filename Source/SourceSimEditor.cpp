@@ -40,6 +40,7 @@ SourceSimEditor::SourceSimEditor(GenericProcessor* parentNode, SourceThread* t,
     canvas = nullptr;
 
     tabText = "Source Sim";
+    desiredWidth = 325;
 
 	clockFreqLabel = new Label("clkFreqLabel", "CLK (Hz)");
 	clockFreqLabel->setBounds(5,30,50,20);
@@ -70,6 +71,91 @@ SourceSimEditor::SourceSimEditor(GenericProcessor* parentNode, SourceThread* t,
 	clockTolEntry->addListener(this);
 	addAndMakeVisible(clockTolEntry);
 
+	speedLabel = new Label("speedLabel", "SPEED");
+	speedLabel->setBounds(180,30,50,20);
+	addAndMakeVisible(speedLabel);
+
+	/* Multiple of real time; 0 runs as fast as downstream processors consume */
+	speedEntry = new NumericEntry("speedEntry", "1");
+	speedEntry->setBounds(230,30,40,20);
+	speedEntry->setEditable(false, true);
+	speedEntry->setColour(Label::backgroundColourId, Colours::grey);
+	speedEntry->setColour(Label::backgroundWhenEditingColourId, Colours::white);
+	speedEntry->setJustificationType(Justification::centredRight);
+	speedEntry->setText("1", juce::NotificationType::dontSendNotification);
+	speedEntry->addListener(this);
+	addAndMakeVisible(speedEntry);
+
+	/* Tee every stream to disk in Open Ephys binary format while acquiring */
+	recordButton = new UtilityButton("REC", Font("Small Text", 12, Font::plain));
+	recordButton->setBounds(180,55,40,20);
+	recordButton->setRadius(3.0f);
+	recordButton->setClickingTogglesState(true);
+	recordButton->setTooltip("Record ground-truth output of every stream to disk");
+	recordButton->addListener(this);
+	addAndMakeVisible(recordButton);
+
+	/* Arm on acquisition start and wait for the local trigger (see LocalTrigger) */
+	triggerButton = new UtilityButton("TRIG", Font("Small Text", 12, Font::plain));
+	triggerButton->setBounds(225,55,45,20);
+	triggerButton->setRadius(3.0f);
+	triggerButton->setClickingTogglesState(true);
+	triggerButton->setTooltip("Start acquisition on an external local trigger");
+	triggerButton->addListener(this);
+	addAndMakeVisible(triggerButton);
+
+	/* Let the watchdog restart stalled sources (the timebase is preserved) */
+	autoRestartButton = new UtilityButton("AUTO", Font("Small Text", 12, Font::plain));
+	autoRestartButton->setBounds(180,80,40,20);
+	autoRestartButton->setRadius(3.0f);
+	autoRestartButton->setClickingTogglesState(true);
+	autoRestartButton->setTooltip("Automatically restart stalled sources");
+	autoRestartButton->addListener(this);
+	addAndMakeVisible(autoRestartButton);
+
+	/* Sub-millisecond packets for closed-loop latency tests (see SourceThread::setLowLatency) */
+	lowLatencyButton = new UtilityButton("LAT", Font("Small Text", 12, Font::plain));
+	lowLatencyButton->setBounds(225,80,45,20);
+	lowLatencyButton->setRadius(3.0f);
+	lowLatencyButton->setClickingTogglesState(true);
+	lowLatencyButton->setTooltip("Low-latency mode: generate packets of a fraction of a millisecond");
+	lowLatencyButton->addListener(this);
+	addAndMakeVisible(lowLatencyButton);
+
+	/* Leave every stream off when nothing downstream can consume it (see SourceThread::setAutoIdle) */
+	autoIdleButton = new UtilityButton("IDLE", Font("Small Text", 12, Font::plain));
+	autoIdleButton->setBounds(180,105,40,20);
+	autoIdleButton->setRadius(3.0f);
+	autoIdleButton->setClickingTogglesState(true);
+	autoIdleButton->setTooltip("Skip generation when no processor follows this one");
+	autoIdleButton->addListener(this);
+	addAndMakeVisible(autoIdleButton);
+
+	/* Per-stream activity: active, TTL only or off */
+	streamsButton = new UtilityButton("STRM", Font("Small Text", 12, Font::plain));
+	streamsButton->setBounds(225,105,45,20);
+	streamsButton->setRadius(3.0f);
+	streamsButton->setTooltip("Choose which streams are generated");
+	streamsButton->addListener(this);
+	addAndMakeVisible(streamsButton);
+
+	/* Timeline capture of the generation threads; written to a trace file when switched off */
+	traceButton = new UtilityButton("TRC", Font("Small Text", 12, Font::plain));
+	traceButton->setBounds(275,30,45,20);
+	traceButton->setRadius(3.0f);
+	traceButton->setClickingTogglesState(true);
+	traceButton->setTooltip("Capture a timeline of the generation threads; switch off to write it as a Chrome trace");
+	traceButton->addListener(this);
+	addAndMakeVisible(traceButton);
+
+	/* Capacity sweep in the background; a second click cancels it */
+	capacityButton = new UtilityButton("CAP", Font("Small Text", 12, Font::plain));
+	capacityButton->setBounds(275,55,45,20);
+	capacityButton->setRadius(3.0f);
+	capacityButton->setTooltip("Find the largest configuration this machine generates in real time (JSON report)");
+	capacityButton->addListener(this);
+	addAndMakeVisible(capacityButton);
+
 	//Add title labels
 	deviceLabel = new Label("Dev:", "Dev:");
 	deviceLabel->setBounds(5,55,120,20);
@@ -83,9 +169,14 @@ SourceSimEditor::SourceSimEditor(GenericProcessor* parentNode, SourceThread* t,
 	quantityLabel->setBounds(130,55,40,20);
 	addAndMakeVisible(quantityLabel);
 
-	NPXDeviceLabel = new Label("NPX1 Probe", "NPX1 Probe");
-	NPXDeviceLabel->setBounds(5,80,120,20);
-	addAndMakeVisible(NPXDeviceLabel);
+	/* Probe model; limits and streams come from its DeviceProfile */
+	probeTypeSelector = new ComboBox("probeTypeSelector");
+	probeTypeSelector->setBounds(5,80,88,20);
+	probeTypeSelector->addItem(getDeviceProfile(NPX1_PROBE).name, NPX1_PROBE + 1);
+	probeTypeSelector->addItem(getDeviceProfile(NPX2_4SHANK_PROBE).name, NPX2_4SHANK_PROBE + 1);
+	probeTypeSelector->setSelectedId(t->probeType + 1, dontSendNotification);
+	probeTypeSelector->addListener(this);
+	addAndMakeVisible(probeTypeSelector);
 
 	NPXChannelsEntry = new NumericEntry("NPXChannelsEntry", "0");
 	NPXChannelsEntry->setBounds(95,80,40,20);
@@ -107,7 +198,7 @@ SourceSimEditor::SourceSimEditor(GenericProcessor* parentNode, SourceThread* t,
 	NPXQuantityEntry->addListener(this);
 	addAndMakeVisible(NPXQuantityEntry);
 
-	NIDAQDeviceLabel = new Label("NIDAQ", "NIDAQ-Sim");
+	NIDAQDeviceLabel = new Label("NIDAQ", getDeviceProfile(NIDAQ_DEVICE).name);
 	NIDAQDeviceLabel->setBounds(5,105,120,20);
 	addAndMakeVisible(NIDAQDeviceLabel);
 
@@ -146,6 +237,7 @@ void SourceSimEditor::labelTextChanged (Label* label)
 
 	int freq = clockFreqEntry->getText().getIntValue();
 	float tol = clockTolEntry->getText().getFloatValue();
+	bool layoutChanged = false;
 
 	if (label == clockFreqEntry)
 	{
@@ -161,54 +253,74 @@ void SourceSimEditor::labelTextChanged (Label* label)
 			tol = 0;
 		}
 	}
+	else if (label == speedEntry)
+	{
+		float scale = speedEntry->getText().getFloatValue();
+		if (scale < 0)
+		{
+			scale = 1;
+			speedEntry->setText("1", juce::NotificationType::dontSendNotification);
+		}
+		thread->setTimeScale(scale);
+	}
 	else if (label == NPXChannelsEntry)
 	{
 		int channels = NPXChannelsEntry->getText().getIntValue();
-		if (channels < 0 || channels > 384)
+		if (channels < 0 || channels > thread->getProbeProfile().maxChannels)
 		{
-		    channels = 384;
+		    channels = thread->getProbeProfile().defaultChannels;
             NPXChannelsEntry->setText(String(channels), juce::NotificationType::sendNotification);
 		}
-        thread->updateNPXChannels(channels);
+        layoutChanged = thread->updateNPXChannels(channels);
 	}
 	else if (label == NPXQuantityEntry)
 	{
 		int numProbes = NPXQuantityEntry->getText().getIntValue();
-		if (numProbes < 0 || numProbes > 10)
+		if (numProbes < 0 || numProbes > thread->getProbeProfile().maxDevices)
 		{
 		    numProbes = 1;
             NPXQuantityEntry->setText(String(numProbes), juce::NotificationType::sendNotification);
 		}
-		thread->updateNumProbes(numProbes);
+		layoutChanged = thread->updateNumProbes(numProbes);
 	}
 	else if (label == NIDAQChannelsEntry)
 	{
 		int channels = NIDAQChannelsEntry->getText().getIntValue();
-		if (channels < 0 || channels > 32)
+		if (channels < 0 || channels > getDeviceProfile(NIDAQ_DEVICE).maxChannels)
 		{
-		    channels = 8;
+		    channels = getDeviceProfile(NIDAQ_DEVICE).defaultChannels;
             NIDAQChannelsEntry->setText(String(channels), juce::NotificationType::sendNotification);
 		}
-		thread->updateNIDAQChannels(channels);
+		layoutChanged = thread->updateNIDAQChannels(channels);
 	}
 	else if (label == NIDAQQuantityEntry)
 	{
 		int numDevices = NIDAQQuantityEntry->getText().getIntValue();
-		if (numDevices < 0 || numDevices > 2)
+		if (numDevices < 0 || numDevices > getDeviceProfile(NIDAQ_DEVICE).maxDevices)
 		{
 		    numDevices = 1;
             NIDAQQuantityEntry->setText(String(numDevices), juce::NotificationType::sendNotification);
 		}
-		thread->updateNIDAQDeviceCount(numDevices);
+		layoutChanged = thread->updateNIDAQDeviceCount(numDevices);
 	}
 
 	thread->updateClkFreq(freq, tol);
-    CoreServices::updateSignalChain(this);	
+
+	//Clock and speed are read by the sources directly; only layout changes need a new signal chain
+	if (layoutChanged)
+		CoreServices::updateSignalChain(this);
 	
 }
 
 void SourceSimEditor::startAcquisition()
 {
+	speedEntry->setEnabled(false);
+	recordButton->setEnabled(false);
+	triggerButton->setEnabled(false);
+	lowLatencyButton->setEnabled(false);
+	streamsButton->setEnabled(false);
+	capacityButton->setEnabled(false);
+	probeTypeSelector->setEnabled(false);
 	NPXChannelsEntry->setEnabled(false);
 	NPXQuantityEntry->setEnabled(false);
 	NIDAQChannelsEntry->setEnabled(false);
@@ -217,6 +329,13 @@ void SourceSimEditor::startAcquisition()
 
 void SourceSimEditor::stopAcquisition()
 {
+	speedEntry->setEnabled(true);
+	recordButton->setEnabled(true);
+	triggerButton->setEnabled(true);
+	lowLatencyButton->setEnabled(true);
+	streamsButton->setEnabled(true);
+	capacityButton->setEnabled(true);
+	probeTypeSelector->setEnabled(true);
 	NPXChannelsEntry->setEnabled(true);
 	NPXQuantityEntry->setEnabled(true);
 	NIDAQChannelsEntry->setEnabled(true);
@@ -231,6 +350,15 @@ void SourceSimEditor::collapsedStateChanged()
 void SourceSimEditor::comboBoxChanged(ComboBox* comboBox)
 {
 
+	if (comboBox == probeTypeSelector)
+	{
+		if (thread->setProbeType(probeTypeSelector->getSelectedId() - 1))
+			CoreServices::updateSignalChain(this);
+
+		//The new model may have clamped the channel count
+		NPXChannelsEntry->setText(String(thread->numChannelsPerProbe), dontSendNotification);
+		NPXQuantityEntry->setText(String(thread->numProbes), dontSendNotification);
+	}
 
 }
 
@@ -239,49 +367,296 @@ void SourceSimEditor::comboBoxChanged(ComboBox* comboBox)
 void SourceSimEditor::buttonEvent(Button* button)
 {
 
+	if (button == recordButton)
+	{
+		thread->setRecordMode(recordButton->getToggleState());
+	}
+	else if (button == triggerButton)
+	{
+		thread->setTriggerMode(triggerButton->getToggleState());
+	}
+	else if (button == autoRestartButton)
+	{
+		thread->setAutoRestart(autoRestartButton->getToggleState());
+	}
+	else if (button == lowLatencyButton)
+	{
+		thread->setLowLatency(lowLatencyButton->getToggleState());
+	}
+	else if (button == autoIdleButton)
+	{
+		thread->setAutoIdle(autoIdleButton->getToggleState());
+	}
+	else if (button == streamsButton)
+	{
+		showStreamMenu();
+	}
+	else if (button == capacityButton)
+	{
+		if (thread->isCapacityProbeRunning())
+			thread->stopCapacityProbe();
+		else
+			thread->startCapacityProbe();
+	}
+	else if (button == traceButton)
+	{
+		thread->setTraceCapture(traceButton->getToggleState());
+
+		if (!traceButton->getToggleState())
+			thread->dumpTrace();
+	}
+
+}
+
+
+void SourceSimEditor::showStreamMenu()
+{
 
+	static const char* const activityNames[] = { "Active", "TTL only", "Off" };
+	const int numActivities = STREAM_OFF + 1;
+
+	PopupMenu menu;
+
+	for (int slot = 0; slot < thread->sources.size(); slot++)
+	{
+		PopupMenu activities;
+
+		for (int activity = 0; activity < numActivities; activity++)
+			activities.addItem(slot * numActivities + activity + 1, activityNames[activity], true, thread->getStreamActivity(slot) == activity);
+
+		menu.addSubMenu(thread->sources[slot]->name + " " + String(slot), activities);
+	}
+
+	menu.showMenuAsync(PopupMenu::Options().withTargetComponent(streamsButton),
+		ModalCallbackFunction::create([this, numActivities](int result) {
+			if (result <= 0)
+				return;
+
+			//Idle streams declare no data channels, so a change of activity is a change of layout
+			if (thread->setStreamActivity((result - 1) / numActivities, (result - 1) % numActivities))
+				CoreServices::updateSignalChain(this);
+		}));
 
 }
 
+void SourceSimEditor::saveCustomParameters(XmlElement* xml)
+{
+	saveEditorParameters(xml);
+}
+
+void SourceSimEditor::loadCustomParameters(XmlElement* xml)
+{
+	loadEditorParameters(xml);
+}
 
 void SourceSimEditor::saveEditorParameters(XmlElement* xml)
 {
-    /*
-	std::cout << "Saving Neuropix editor." << std::endl;
 
-	XmlElement* xmlNode = xml->createNewChildElement("NEUROPIXELS_EDITOR");
+	std::cout << "Saving Source Sim editor." << std::endl;
+
+	XmlElement* xmlNode = xml->createNewChildElement("SOURCESIM_EDITOR");
+
+	xmlNode->setAttribute("ProbeType", thread->probeType);
+	xmlNode->setAttribute("RecordToDisk", recordButton->getToggleState() ? 1 : 0);
+	xmlNode->setAttribute("ExternalTrigger", triggerButton->getToggleState() ? 1 : 0);
+	xmlNode->setAttribute("AutoRestart", autoRestartButton->getToggleState() ? 1 : 0);
+	xmlNode->setAttribute("LowLatency", lowLatencyButton->getToggleState() ? 1 : 0);
+	xmlNode->setAttribute("AutoIdle", autoIdleButton->getToggleState() ? 1 : 0);
+
+	/* Action potential trains have no controls of their own; they are configured through these attributes */
+	xmlNode->setAttribute("APTrains", thread->numAPTrains);
+	xmlNode->setAttribute("APTrainChannels", thread->numChannelsPerAPTrain);
+
+	SpikeTrainSettings spikeTrain = thread->getSpikeTrain();
+	xmlNode->setAttribute("SpikeTrigger", spikeTrain.trigger);
+	xmlNode->setAttribute("SpikeRate", spikeTrain.rate);
+	xmlNode->setAttribute("SpikeChannelDelay", spikeTrain.channelDelay);
+
+	for (int slot = 0; slot < thread->sources.size(); slot++)
+	{
+		xmlNode->setAttribute("Slot" + String(slot) + "Directory", thread->getDirectoryForSlot(slot).getFullPathName());
+
+		if (thread->getRequestedPacketSize(slot) > 0)
+			xmlNode->setAttribute("Slot" + String(slot) + "PacketSize", thread->getRequestedPacketSize(slot));
+
+		if (thread->getStreamActivity(slot) != STREAM_ACTIVE)
+			xmlNode->setAttribute("Slot" + String(slot) + "Activity", thread->getStreamActivity(slot));
+	}
 
-	for (int slot = 0; slot < thread->getNumBasestations(); slot++)
+	/* Probe motion has no controls of its own; it is configured through these attributes */
+	DriftSettings drift = thread->getDrift();
+	xmlNode->setAttribute("DriftAmplitude", drift.amplitude);
+	xmlNode->setAttribute("DriftFrequency", drift.frequency);
+	xmlNode->setAttribute("DriftRandomWalk", drift.randomWalk);
+	xmlNode->setAttribute("DriftNonRigid", drift.nonRigid);
+	xmlNode->setAttribute("DriftStep", drift.stepSeconds);
+
+	BackgroundSettings background = thread->getBackground();
+	xmlNode->setAttribute("BackgroundRms", background.rms);
+	xmlNode->setAttribute("BackgroundExponent", background.exponent);
+	xmlNode->setAttribute("BackgroundCorrelation", background.correlationLength);
+
+	FrontEndSettings frontEnd = thread->getFrontEnd();
+	xmlNode->setAttribute("NoiseRms", frontEnd.noiseRms);
+	xmlNode->setAttribute("ArtifactInterval", frontEnd.artifactInterval);
+	xmlNode->setAttribute("ArtifactAmplitude", frontEnd.artifactAmplitude);
+	xmlNode->setAttribute("ArtifactDecay", frontEnd.artifactDecay);
+	xmlNode->setAttribute("AdcStep", frontEnd.adcStep);
+
+	OscillationSettings oscillations = thread->getOscillations();
+	xmlNode->setAttribute("RippleRate", oscillations.rippleRate);
+	xmlNode->setAttribute("RippleFrequency", oscillations.rippleFrequency);
+	xmlNode->setAttribute("RippleDuration", oscillations.rippleDuration);
+	xmlNode->setAttribute("RippleAmplitude", oscillations.rippleAmplitude);
+	xmlNode->setAttribute("RippleExtent", oscillations.rippleExtent);
+
+	for (int b = 0; b < oscillations.numBands; b++)
 	{
-		String directory_name = savingDirectories[slot].getFullPathName();
-		if (directory_name.length() == 2)
-			directory_name += "\\\\";
-		xmlNode->setAttribute("Slot" + String(slot) + "Directory", directory_name);
+		const OscillationBand& band = oscillations.bands[b];
+		XmlElement* bandNode = xmlNode->createNewChildElement("OSCILLATION");
+		bandNode->setAttribute("Frequency", band.frequency);
+		bandNode->setAttribute("Amplitude", band.amplitude);
+		bandNode->setAttribute("AmDepth", band.amDepth);
+		bandNode->setAttribute("AmFrequency", band.amFrequency);
+		bandNode->setAttribute("FmDeviation", band.fmDeviation);
+		bandNode->setAttribute("FmFrequency", band.fmFrequency);
+		bandNode->setAttribute("WaveSpeed", band.waveSpeed);
 	}
-    */
+
+	/* Thread placement (see SourceThread::setPlacement) */
+	PlacementSettings placement = thread->getPlacement();
+	xmlNode->setAttribute("PlacementCpus", placement.cpus);
+	xmlNode->setAttribute("RealtimePriority", placement.realtime ? 1 : 0);
+	xmlNode->setAttribute("NodeLocalBuffers", placement.nodeLocal ? 1 : 0);
+
+	/* Likewise the recorded template library played by the units */
+	xmlNode->setAttribute("TemplateLibrary", thread->getTemplateLibraryFile().getFullPathName());
+	xmlNode->setAttribute("TemplatesPerProbe", thread->getTemplatesPerProbe());
 
 }
 
 void SourceSimEditor::loadEditorParameters(XmlElement* xml)
 {
-    /*
+
 	forEachXmlChildElement(*xml, xmlNode)
 	{
-		if (xmlNode->hasTagName("NEUROPIXELS_EDITOR"))
+		if (xmlNode->hasTagName("SOURCESIM_EDITOR"))
 		{
-			std::cout << "Found parameters for Neuropixels editor" << std::endl;
+			std::cout << "Found parameters for Source Sim editor" << std::endl;
+
+			probeTypeSelector->setSelectedId(xmlNode->getIntAttribute("ProbeType", NPX1_PROBE) + 1, sendNotificationSync);
+
+			bool record = xmlNode->getIntAttribute("RecordToDisk", 0) != 0;
+			recordButton->setToggleState(record, dontSendNotification);
+			thread->setRecordMode(record);
 
-			for (int slot = 0; slot < thread->getNumBasestations(); slot++)
+			bool trigger = xmlNode->getIntAttribute("ExternalTrigger", 0) != 0;
+			triggerButton->setToggleState(trigger, dontSendNotification);
+			thread->setTriggerMode(trigger);
+
+			bool restart = xmlNode->getIntAttribute("AutoRestart", 0) != 0;
+			autoRestartButton->setToggleState(restart, dontSendNotification);
+			thread->setAutoRestart(restart);
+
+			bool lowLatency = xmlNode->getIntAttribute("LowLatency", 0) != 0;
+			lowLatencyButton->setToggleState(lowLatency, dontSendNotification);
+			thread->setLowLatency(lowLatency);
+
+			bool autoIdle = xmlNode->getIntAttribute("AutoIdle", 0) != 0;
+			autoIdleButton->setToggleState(autoIdle, dontSendNotification);
+			thread->setAutoIdle(autoIdle);
+
+			//Trains come before the slot settings, which may belong to their streams
+			const DeviceProfile& trains = getDeviceProfile(AP_TRAIN_DEVICE);
+			bool layoutChanged = thread->updateAPTrainChannels(jlimit(1, trains.maxChannels, xmlNode->getIntAttribute("APTrainChannels", trains.defaultChannels)));
+			layoutChanged |= thread->updateAPTrainCount(jlimit(0, trains.maxDevices, xmlNode->getIntAttribute("APTrains", trains.defaultDevices)));
+
+			SpikeTrainSettings spikeTrain = thread->getSpikeTrain();
+			spikeTrain.trigger = xmlNode->getIntAttribute("SpikeTrigger", spikeTrain.trigger);
+			spikeTrain.rate = (float)xmlNode->getDoubleAttribute("SpikeRate", spikeTrain.rate);
+			spikeTrain.channelDelay = (float)xmlNode->getDoubleAttribute("SpikeChannelDelay", spikeTrain.channelDelay);
+			thread->setSpikeTrain(spikeTrain);
+
+			bool activityChanged = false;
+
+			for (int slot = 0; slot < thread->sources.size(); slot++)
+			{
+				String directory = xmlNode->getStringAttribute("Slot" + String(slot) + "Directory");
+				if (directory.isNotEmpty())
+					thread->setDirectoryForSlot(slot, File(directory));
+
+				thread->setPacketSize(slot, xmlNode->getIntAttribute("Slot" + String(slot) + "PacketSize", 0));
+
+				activityChanged |= thread->setStreamActivity(slot, xmlNode->getIntAttribute("Slot" + String(slot) + "Activity", STREAM_ACTIVE));
+			}
+
+			if (layoutChanged || activityChanged)
+				CoreServices::updateSignalChain(this);
+
+			DriftSettings drift = thread->getDrift();
+			drift.amplitude = (float)xmlNode->getDoubleAttribute("DriftAmplitude", drift.amplitude);
+			drift.frequency = (float)xmlNode->getDoubleAttribute("DriftFrequency", drift.frequency);
+			drift.randomWalk = (float)xmlNode->getDoubleAttribute("DriftRandomWalk", drift.randomWalk);
+			drift.nonRigid = (float)xmlNode->getDoubleAttribute("DriftNonRigid", drift.nonRigid);
+			drift.stepSeconds = (float)xmlNode->getDoubleAttribute("DriftStep", drift.stepSeconds);
+			thread->setDrift(drift);
+
+			BackgroundSettings background = thread->getBackground();
+			background.rms = (float)xmlNode->getDoubleAttribute("BackgroundRms", background.rms);
+			background.exponent = (float)xmlNode->getDoubleAttribute("BackgroundExponent", background.exponent);
+			background.correlationLength = (float)xmlNode->getDoubleAttribute("BackgroundCorrelation", background.correlationLength);
+			thread->setBackground(background);
+
+			FrontEndSettings frontEnd = thread->getFrontEnd();
+			frontEnd.noiseRms = (float)xmlNode->getDoubleAttribute("NoiseRms", frontEnd.noiseRms);
+			frontEnd.artifactInterval = (float)xmlNode->getDoubleAttribute("ArtifactInterval", frontEnd.artifactInterval);
+			frontEnd.artifactAmplitude = (float)xmlNode->getDoubleAttribute("ArtifactAmplitude", frontEnd.artifactAmplitude);
+			frontEnd.artifactDecay = (float)xmlNode->getDoubleAttribute("ArtifactDecay", frontEnd.artifactDecay);
+			frontEnd.adcStep = (float)xmlNode->getDoubleAttribute("AdcStep", frontEnd.adcStep);
+			thread->setFrontEnd(frontEnd);
+
+			//Saved bands replace the defaults; configurations without any keep them
+			OscillationSettings oscillations = thread->getOscillations();
+			oscillations.rippleRate = (float)xmlNode->getDoubleAttribute("RippleRate", oscillations.rippleRate);
+			oscillations.rippleFrequency = (float)xmlNode->getDoubleAttribute("RippleFrequency", oscillations.rippleFrequency);
+			oscillations.rippleDuration = (float)xmlNode->getDoubleAttribute("RippleDuration", oscillations.rippleDuration);
+			oscillations.rippleAmplitude = (float)xmlNode->getDoubleAttribute("RippleAmplitude", oscillations.rippleAmplitude);
+			oscillations.rippleExtent = (float)xmlNode->getDoubleAttribute("RippleExtent", oscillations.rippleExtent);
+
+			if (xmlNode->getChildByName("OSCILLATION") != nullptr)
 			{
-				File directory = File(xmlNode->getStringAttribute("Slot" + String(slot) + "Directory"));
-				std::cout << "Setting thread directory for slot " << slot << std::endl;
-				thread->setDirectoryForSlot(slot, directory);
-				directoryButtons[slot]->setLabel(directory.getFullPathName().substring(0, 2));
-				savingDirectories.set(slot, directory);
+				oscillations.numBands = 0;
+
+				forEachXmlChildElementWithTagName(*xmlNode, bandNode, "OSCILLATION")
+				{
+					if (oscillations.numBands == MAX_OSCILLATION_BANDS)
+						break;
+
+					OscillationBand& band = oscillations.bands[oscillations.numBands++];
+					band.frequency = (float)bandNode->getDoubleAttribute("Frequency", 7.0);
+					band.amplitude = (float)bandNode->getDoubleAttribute("Amplitude", 0.0);
+					band.amDepth = (float)bandNode->getDoubleAttribute("AmDepth", 0.0);
+					band.amFrequency = (float)bandNode->getDoubleAttribute("AmFrequency", 0.0);
+					band.fmDeviation = (float)bandNode->getDoubleAttribute("FmDeviation", 0.0);
+					band.fmFrequency = (float)bandNode->getDoubleAttribute("FmFrequency", 0.0);
+					band.waveSpeed = (float)bandNode->getDoubleAttribute("WaveSpeed", 0.0);
+				}
 			}
+
+			thread->setOscillations(oscillations);
+
+			PlacementSettings placement = thread->getPlacement();
+			placement.cpus = xmlNode->getStringAttribute("PlacementCpus", placement.cpus);
+			placement.realtime = xmlNode->getIntAttribute("RealtimePriority", placement.realtime ? 1 : 0) != 0;
+			placement.nodeLocal = xmlNode->getIntAttribute("NodeLocalBuffers", placement.nodeLocal ? 1 : 0) != 0;
+			thread->setPlacement(placement);
+
+			String templates = xmlNode->getStringAttribute("TemplateLibrary");
+			if (templates.isNotEmpty())
+				thread->setTemplateLibrary(File(templates), xmlNode->getIntAttribute("TemplatesPerProbe", 0));
 		}
 	}
-    */
+
 }
 
 
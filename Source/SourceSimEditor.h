@@ -55,6 +55,9 @@ public:
 	void labelTextChanged (Label*);
 	void buttonEvent(Button*) override;
 
+	void saveCustomParameters(XmlElement*) override;
+	void loadCustomParameters(XmlElement*) override;
+
 	void saveEditorParameters(XmlElement*);
 	void loadEditorParameters(XmlElement*);
 
@@ -69,11 +72,26 @@ private:
 	ScopedPointer<Label> clockTolLabel;
 	ScopedPointer<NumericEntry> clockTolEntry;
 
+	ScopedPointer<Label> speedLabel;
+	ScopedPointer<NumericEntry> speedEntry;
+
+	ScopedPointer<UtilityButton> recordButton;
+	ScopedPointer<UtilityButton> triggerButton;
+	ScopedPointer<UtilityButton> autoRestartButton;
+	ScopedPointer<UtilityButton> lowLatencyButton;
+	ScopedPointer<UtilityButton> autoIdleButton;
+	ScopedPointer<UtilityButton> streamsButton;
+	ScopedPointer<UtilityButton> traceButton;
+	ScopedPointer<UtilityButton> capacityButton;
+
+	/* Menu of the subprocessors, each with its StreamActivity choices */
+	void showStreamMenu();
+
 	ScopedPointer<Label> deviceLabel;
 	ScopedPointer<Label> channelsLabel;
 	ScopedPointer<Label> quantityLabel;
 
-	ScopedPointer<Label> NPXDeviceLabel;
+	ScopedPointer<ComboBox> probeTypeSelector;
 	ScopedPointer<NumericEntry> NPXChannelsEntry;
 	ScopedPointer<NumericEntry> NPXQuantityEntry;
 
@@ -23,14 +23,28 @@
 
 #include "SourceThread.h"
 #include "SourceSimEditor.h"
+#include "SessionRenderer.h"
 #include <cmath>
 
-#define NUM_PROBES 6
-#define NUM_NI_DEVICES 1
-#define AP_CHANNELS 384
-#define LFP_CHANNELS 384
-#define APT_CHANNELS 384
-#define NIDAQ_CHANNELS 8
+// Neuropixels 1.0 gain settings (setAllGains index -> gain) and the defaults the simulated bands are scaled for
+static const float probeGains[] = { 50.0f, 125.0f, 250.0f, 500.0f, 1000.0f, 1500.0f, 2000.0f, 3000.0f };
+#define DEFAULT_AP_GAIN_INDEX 3
+#define DEFAULT_LFP_GAIN_INDEX 2
+
+// setAllReferences ids: 0 external, 1 tip, 2 internal (electrode 192), 3 common average
+#define INTERNAL_REFERENCE_ELECTRODE 191
+
+// 4 MB blocks queued per recorded slot before packets are dropped
+#define RECORD_QUEUE_BLOCKS 8
+
+// Watchdog: check period, silence after which a source counts as stalled, and time a stalled
+// thread gets to exit before the pending restart is reported
+#define WATCHDOG_INTERVAL_MS 100
+#define WATCHDOG_STALL_MS 1000
+#define WATCHDOG_EXIT_MS 2000
+
+// Time the started sources get beyond their first packet to report the trigger latency
+#define TRIGGER_REPORT_MARGIN_MS 100
 
 DataThread* SourceThread::createDataThread(SourceNode *sn)
 {
@@ -38,137 +52,1112 @@ DataThread* SourceThread::createDataThread(SourceNode *sn)
 }
 
 
-GenericEditor* SourceThread::createEditor(SourceNode* sn)
-{
-    return new SourceSimEditor(sn, this, true);
-}
+GenericEditor* SourceThread::createEditor(SourceNode* sn)
+{
+    return new SourceSimEditor(sn, this, true);
+}
+
+
+SourceThread::SourceThread(SourceNode* sn) : 
+	DataThread(sn),
+    probeType(NPX1_PROBE),
+    numProbes(getDeviceProfile(NPX1_PROBE).defaultDevices),
+    numChannelsPerProbe(getDeviceProfile(NPX1_PROBE).defaultChannels),
+	numNIDevices(getDeviceProfile(NIDAQ_DEVICE).defaultDevices),
+	numChannelsPerNIDAQDevice(getDeviceProfile(NIDAQ_DEVICE).defaultChannels),
+    numAPTrains(getDeviceProfile(AP_TRAIN_DEVICE).defaultDevices),
+    numChannelsPerAPTrain(getDeviceProfile(AP_TRAIN_DEVICE).defaultChannels),
+    clkFreq(1),
+    clkTol(0),
+    timeScale(1.0f),
+	recordingTimer(this),
+    externalTrigger(false),
+    triggerGate(true),
+    triggerWaiter(this),
+    autoIdle(false),
+    lowLatency(false),
+    autoRestart(false),
+    recordToDisk(false)
+{
+    drift = DriftSettings{ 0.0f, 0.0f, 0.0f, 0.0f, 0.1f, 0 };
+    background = DEFAULT_LFP_BACKGROUND;
+    oscillations = getDefaultOscillations();
+    frontEnd = FrontEndSettings{ 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+    spikeTrain = DEFAULT_SPIKE_TRAIN;
+    templatesPerProbe = 0;
+    placement = PlacementSettings{ String(), false, false };
+    generateBuffers();
+}
+
+SourceThread::~SourceThread()
+{
+    stopCapacityProbe();
+    stopRecording();
+}
+
+void SourceThread::updateClkFreq(int freq, float tol)
+{
+    clkFreq = freq;
+    clkTol = tol;
+
+    for (auto source : sources)
+        source->updateClkFreq(freq, tol);
+}
+
+void SourceThread::setTimeScale(float scale)
+{
+    timeScale = jmax(0.0f, scale);
+}
+
+
+void SourceThread::updateClkEnable(int subProcIdx, bool enable)
+{
+    sources[subProcIdx]->updateClk(enable);
+}
+
+bool SourceThread::updateNPXChannels(int channels)
+{
+    numChannelsPerProbe = channels;
+    return applyLayout();
+}
+
+bool SourceThread::updateNumProbes(int probes)
+{
+    numProbes = probes;
+    return applyLayout();
+}
+	
+bool SourceThread::updateNIDAQChannels(int channels)
+{
+    numChannelsPerNIDAQDevice = channels;
+    return applyLayout();
+}
+
+bool SourceThread::updateNIDAQDeviceCount(int count)
+{
+    numNIDevices = count; 
+    return applyLayout();
+}
+
+bool SourceThread::updateAPTrainChannels(int channels)
+{
+    numChannelsPerAPTrain = channels;
+    return applyLayout();
+}
+
+bool SourceThread::updateAPTrainCount(int count)
+{
+    numAPTrains = count;
+    return applyLayout();
+}
+
+bool SourceThread::setProbeType(int profileId)
+{
+    if (profileId < 0 || profileId >= NUM_DEVICE_PROFILES || profileId == NIDAQ_DEVICE || profileId == AP_TRAIN_DEVICE)
+        return false;
+
+    probeType = profileId;
+    numChannelsPerProbe = jmin(numChannelsPerProbe, getProbeProfile().maxChannels);
+    numProbes = jmin(numProbes, getProbeProfile().maxDevices);
+    return applyLayout();
+}
+
+bool SourceThread::setDrift(const DriftSettings& settings)
+{
+
+    if (isThreadRunning())
+        return false;
+
+    drift = settings;
+
+    for (auto source : sources)
+    {
+        if (source->getProbeType() < 0)
+            continue;
+
+        source->drift = drift;
+        source->prepare(waveformCache);
+    }
+
+    return true;
+
+}
+
+bool SourceThread::setBackground(const BackgroundSettings& settings)
+{
+
+    if (isThreadRunning())
+        return false;
+
+    background = settings;
+
+    for (auto source : sources)
+    {
+        if (!source->carriesLfp())
+            continue;
+
+        source->background = background;
+        source->prepare(waveformCache);
+    }
+
+    return true;
+
+}
+
+bool SourceThread::setOscillations(const OscillationSettings& settings)
+{
+
+    if (isThreadRunning())
+        return false;
+
+    oscillations = settings;
+
+    for (auto source : sources)
+    {
+        if (!source->carriesLfp())
+            continue;
+
+        source->oscillations = oscillations;
+        source->prepare(waveformCache);
+    }
+
+    return true;
+
+}
+
+bool SourceThread::setSpikeTrain(const SpikeTrainSettings& settings)
+{
+
+    if (isThreadRunning())
+        return false;
+
+    spikeTrain = settings;
+
+    for (auto source : sources)
+    {
+        if (!source->isSpikeTrain())
+            continue;
+
+        source->spikeTrain = spikeTrain;
+        source->prepare(waveformCache);
+    }
+
+    return true;
+
+}
+
+bool SourceThread::setFrontEnd(const FrontEndSettings& settings)
+{
+
+    if (isThreadRunning())
+        return false;
+
+    frontEnd = settings;
+
+    for (auto source : sources)
+    {
+        if (source->getProbeType() < 0)
+            continue;
+
+        source->frontEnd = frontEnd;
+        source->prepare(waveformCache);
+    }
+
+    return true;
+
+}
+
+bool SourceThread::setTemplateLibrary(const File& file, int count)
+{
+
+    if (isThreadRunning())
+        return false;
+
+    ScopedPointer<TemplateLibrary> library;
+
+    if (file != File())
+    {
+        library = new TemplateLibrary(file);
+
+        if (!library->isValid())
+        {
+            std::cout << "Source Sim: cannot use template library " << file.getFullPathName() << ": " << library->getError() << std::endl;
+            return false;
+        }
+
+    }
+
+    templateLibrary = library.release();
+    templatesPerProbe = count;
+
+    for (int i = 0; i < sources.size(); i++)
+    {
+        assignTemplates(i);
+        sources[i]->prepare(waveformCache);
+    }
+
+    waveformCache.releaseUnused();
+
+    return true;
+
+}
+
+void SourceThread::assignTemplates(int slot)
+{
+
+    SourceSim* source = sources[slot];
+    int first, end;
+
+    //Units only fire in streams recorded at the templates' rate (AP and wideband)
+    if (templateLibrary == nullptr || source->sampleRate != TEMPLATE_SAMPLE_RATE || !getProbeStreams(slot, first, end))
+    {
+        source->templates = nullptr;
+        source->templateElectrodes = 0;
+        return;
+    }
+
+    //Each probe draws its own subset; its streams share it
+    const int probe = first / (end - first);
+
+    source->templates = templateLibrary->getSubset(waveformCache, templatesPerProbe, (uint32) probe);
+    source->templateElectrodes = templateLibrary->getNumElectrodes();
+
+}
+
+bool SourceThread::setPlacement(const PlacementSettings& settings)
+{
+
+    if (isThreadRunning())
+        return false;
+
+    Array<int> cpus;
+
+    if (!ThreadPlacement::parseCpuList(settings.cpus, cpus))
+    {
+        std::cout << "Source Sim: invalid CPU list \"" << settings.cpus << "\"" << std::endl;
+        return false;
+    }
+
+    placement = settings;
+    placementCpus.swapWith(cpus);
+
+    return true;
+
+}
+
+void SourceThread::assignPlacement()
+{
+
+    const int numCpus = placementCpus.size();
+
+    for (int i = 0; i < sources.size(); i++)
+    {
+        sources[i]->placementCpu = numCpus > 0 ? placementCpus[i % numCpus] : -1;
+        sources[i]->realtimePriority = placement.realtime;
+        sources[i]->nodeLocalBuffers = placement.nodeLocal;
+    }
+
+}
+
+bool SourceThread::setStreamActivity(int subProcessorIdx, int activity)
+{
+
+    if (isThreadRunning() || subProcessorIdx < 0 || activity < STREAM_ACTIVE || activity > STREAM_OFF)
+        return false;
+
+    while (streamActivity.size() <= subProcessorIdx)
+        streamActivity.add(STREAM_ACTIVE);
+
+    const bool wasActive = getStreamActivity(subProcessorIdx) == STREAM_ACTIVE;
+    streamActivity.set(subProcessorIdx, activity);
+
+    //Only becoming idle or active changes the declared channels
+    if (subProcessorIdx >= sources.size() || wasActive == (activity == STREAM_ACTIVE))
+        return false;
+
+    SourceSim* source = sources[subProcessorIdx];
+    sourceBuffers[subProcessorIdx]->resize(activity == STREAM_ACTIVE ? source->numChannels : 0, 1000);
+
+    return true;
+
+}
+
+int SourceThread::getStreamActivity(int subProcessorIdx) const
+{
+    return subProcessorIdx >= 0 && subProcessorIdx < streamActivity.size() ? streamActivity[subProcessorIdx] : STREAM_ACTIVE;
+}
+
+void SourceThread::setAutoIdle(bool enable)
+{
+    autoIdle = enable;
+}
+
+bool SourceThread::setLowLatency(bool enable)
+{
+
+    if (isThreadRunning())
+        return false;
+
+    lowLatency = enable;
+
+    for (int i = 0; i < sources.size(); i++)
+    {
+        if (assignPacketSize(i))
+            sources[i]->prepare(waveformCache);
+    }
+
+    return true;
+
+}
+
+bool SourceThread::setPacketSize(int subProcessorIdx, int samples)
+{
+
+    if (isThreadRunning() || subProcessorIdx < 0)
+        return false;
+
+    while (packetSizes.size() <= subProcessorIdx)
+        packetSizes.add(0);
+
+    packetSizes.set(subProcessorIdx, samples > 0 ? jlimit(MIN_PACKET_SIZE, MAX_PACKET_SIZE, samples) : 0);
+
+    if (subProcessorIdx < sources.size() && assignPacketSize(subProcessorIdx))
+        sources[subProcessorIdx]->prepare(waveformCache);
+
+    return true;
+
+}
+
+int SourceThread::getRequestedPacketSize(int subProcessorIdx) const
+{
+    return subProcessorIdx >= 0 && subProcessorIdx < packetSizes.size() ? packetSizes[subProcessorIdx] : 0;
+}
+
+bool SourceThread::assignPacketSize(int slot)
+{
+
+    SourceSim* source = sources[slot];
+    int size = getRequestedPacketSize(slot);
+
+    if (size == 0)
+        size = lowLatency ? SourceSim::getLowLatencyPacketSize(source->sampleRate) : DEFAULT_PACKET_SIZE;
+
+    if (size == source->packetSize)
+        return false;
+
+    source->packetSize = size;
+    return true;
+
+}
+
+bool SourceThread::isAnalogStream(int subProcessorIdx) const
+{
+    return sources[subProcessorIdx]->name == "AI";
+}
+
+bool SourceThread::getProbeStreams(int slot, int& first, int& end) const
+{
+
+    //Slots are subprocessor indices; settings apply to every stream of the probe owning the slot
+    const int streamsPerProbe = getProbeProfile().splitBands ? 2 : 1;
+    const int probe = slot / streamsPerProbe;
+
+    if (slot < 0 || probe >= numProbes || slot >= sources.size())
+        return false;
+
+    first = probe * streamsPerProbe;
+    end = first + streamsPerProbe;
+    return true;
+
+}
+
+void SourceThread::setAllGains(unsigned char slot, signed char port, unsigned char apGain, unsigned char lfpGain)
+{
+
+    int first, end;
+
+    if (!getProbeStreams(slot, first, end) || apGain >= numElementsInArray(probeGains) || lfpGain >= numElementsInArray(probeGains))
+        return;
+
+    //Simulated amplitudes correspond to the default gains; other settings scale relative to them
+    for (int i = first; i < end; i++)
+    {
+        if (sources[i]->name == "LFP")
+            sources[i]->setGain(probeGains[lfpGain] / probeGains[DEFAULT_LFP_GAIN_INDEX]);
+        else
+            sources[i]->setGain(probeGains[apGain] / probeGains[DEFAULT_AP_GAIN_INDEX]);
+    }
+
+}
+
+void SourceThread::setAllReferences(unsigned char slot, signed char port, int refId)
+{
+
+    int first, end;
+
+    if (!getProbeStreams(slot, first, end))
+        return;
+
+    int mode = SourceSimPipeline::ReferenceStage::NONE;
+
+    //External and tip references are already what the simulated signals are relative to
+    if (refId == 2)
+        mode = SourceSimPipeline::ReferenceStage::ELECTRODE;
+    else if (refId == 3)
+        mode = SourceSimPipeline::ReferenceStage::AVERAGE;
+
+    for (int i = first; i < end; i++)
+        sources[i]->setReference(mode, INTERNAL_REFERENCE_ELECTRODE);
+
+}
+
+void SourceThread::setFilter(unsigned char slot, signed char port, bool filterState)
+{
+
+    int first, end;
+
+    if (!getProbeStreams(slot, first, end))
+        return;
+
+    //The 300 Hz high-pass sits on the AP path (the whole wideband stream on NP2.0)
+    for (int i = first; i < end; i++)
+    {
+        if (sources[i]->name != "LFP")
+            sources[i]->setHighPass(filterState);
+    }
+
+}
+
+void SourceThread::selectElectrodes(unsigned char slot, signed char port, Array<int> channelStatus)
+{
+
+    int first, end;
+
+    if (!getProbeStreams(slot, first, end))
+        return;
+
+    if (isThreadRunning())
+    {
+        std::cout << "Source Sim: electrode selection can't change during acquisition" << std::endl;
+        return;
+    }
+
+    bool changed = false;
+
+    for (int i = first; i < end; i++)
+    {
+        SourceSim* source = sources[i];
+
+        if (!source->setChannelMask(channelStatus))
+            continue;
+
+        //Only enabled electrodes are generated, buffered and recorded
+        sourceBuffers[i]->resize(source->numChannels, 1000);
+        source->prepare(waveformCache);
+        changed = true;
+    }
+
+    if (changed)
+    {
+        waveformCache.releaseUnused();
+        sn->update();
+    }
+
+}
+
+bool SourceThread::applyLayout()
+{
+    //Pure parameter edits leave the layout, and so the signal chain, untouched
+    if (!generateBuffers())
+        return false;
+
+    sn->update();
+    return true;
+}
+
+static SourceSim* createSource(const String& type, int channels)
+{
+    if (type == "AP")
+        return new NPX_AP_BAND(channels);
+    else if (type == "WB")
+        return new NPX2_WIDEBAND(channels);
+    else if (type == "LFP")
+        return new NPX_LFP_BAND(channels);
+    else if (type == "APT")
+        return new APTrain(channels);
+    else
+        return new NIDAQ(channels);
+}
+
+/* Number of entries before index whose type equals that of entry index */
+template <typename TypeOf>
+static int getOrdinal(int index, TypeOf typeOf)
+{
+    int ordinal = 0;
+    for (int i = 0; i < index; i++)
+        ordinal += typeOf(i) == typeOf(index) ? 1 : 0;
+    return ordinal;
+}
+
+bool SourceThread::generateBuffers()
+{
+
+    const double start = Time::getMillisecondCounterHiRes();
+
+    //Planned layout: an AP/LFP pair (or one wideband stream) per probe, one AI stream per NIDAQ device,
+    //then one stream per action potential train
+    StringArray plannedTypes;
+    Array<int> plannedChannels;
+
+    for (int i = 0; i < numProbes; i++)
+    {
+        if (getProbeProfile().splitBands)
+        {
+            plannedTypes.add("AP");
+            plannedChannels.add(numChannelsPerProbe);
+            plannedTypes.add("LFP");
+            plannedChannels.add(numChannelsPerProbe);
+        }
+        else
+        {
+            plannedTypes.add("WB");
+            plannedChannels.add(numChannelsPerProbe);
+        }
+    }
+
+    for (int i = 0; i < numNIDevices; i++)
+    {
+        plannedTypes.add("AI");
+        plannedChannels.add(numChannelsPerNIDAQDevice);
+    }
+
+    for (int i = 0; i < numAPTrains; i++)
+    {
+        plannedTypes.add("APT");
+        plannedChannels.add(numChannelsPerAPTrain);
+    }
+
+    OwnedArray<SourceSim> previousSources;
+    OwnedArray<DataBuffer> previousBuffers;
+    previousSources.swapWith(sources);
+    previousBuffers.swapWith(sourceBuffers);
+
+    const int numPrevious = previousSources.size();
+
+    //Position of every existing source among the sources of its type, taken before any are reused
+    Array<int> previousOrdinals;
+    for (int j = 0; j < numPrevious; j++)
+        previousOrdinals.add(getOrdinal(j, [&](int k) { return previousSources[k]->name; }));
+
+    //The n-th stream of each type keeps its source and buffer across reconfigurations
+    Array<int> matches;
+
+    for (int i = 0; i < plannedTypes.size(); i++)
+    {
+        const int ordinal = getOrdinal(i, [&](int k) { return plannedTypes[k]; });
+        int match = -1;
+
+        for (int j = 0; j < numPrevious && match < 0; j++)
+        {
+            if (previousSources[j]->name == plannedTypes[i] && previousOrdinals[j] == ordinal)
+                match = j;
+        }
+
+        matches.add(match);
+    }
+
+    //Activity, packet size and directory are requested per slot: they follow their stream to its
+    //new slot, and new streams start from the defaults
+    Array<int> previousActivity, previousPacketSizes;
+    Array<File> previousDirectories;
+    previousActivity.swapWith(streamActivity);
+    previousPacketSizes.swapWith(packetSizes);
+    previousDirectories.swapWith(slotDirectories);
+
+    for (int i = 0; i < plannedTypes.size(); i++)
+    {
+        const int match = matches[i];
+
+        streamActivity.add(match >= 0 && match < previousActivity.size() ? previousActivity[match] : (int) STREAM_ACTIVE);
+        packetSizes.add(match >= 0 && match < previousPacketSizes.size() ? previousPacketSizes[match] : 0);
+        slotDirectories.add(match >= 0 && match < previousDirectories.size() ? previousDirectories[match] : File());
+    }
+
+    int kept = 0;
+    int resized = 0;
+    int added = 0;
+
+    for (int i = 0; i < plannedTypes.size(); i++)
+    {
+
+        const int match = matches[i];
+
+        if (match < 0)
+        {
+            sources.add(createSource(plannedTypes[i], plannedChannels[i]));
+            sourceBuffers.add(new DataBuffer(sources.getLast()->numChannels,1000));
+            sources.getLast()->buffer = sourceBuffers.getLast();
+            sources.getLast()->drift = drift;
+            if (sources.getLast()->getProbeType() >= 0)
+                sources.getLast()->frontEnd = frontEnd;
+            if (sources.getLast()->carriesLfp())
+            {
+                sources.getLast()->background = background;
+                sources.getLast()->oscillations = oscillations;
+            }
+            if (sources.getLast()->isSpikeTrain())
+                sources.getLast()->spikeTrain = spikeTrain;
+            sources.getLast()->seed = (uint32) i;
+            assignTemplates(sources.size() - 1);
+            assignPacketSize(sources.size() - 1);
+            sources.getLast()->prepare(waveformCache);
+            added++;
+            continue;
+        }
+
+        SourceSim* source = previousSources[match];
+        DataBuffer* buffer = previousBuffers[match];
+        previousSources.set(match, nullptr, false);
+        previousBuffers.set(match, nullptr, false);
+
+        sources.add(source);
+        sourceBuffers.add(buffer);
+
+        //Seeded by slot, as SessionRenderer::createSources, so a source moved to another slot is regenerated
+        const bool reseeded = source->seed != (uint32) i;
+        source->seed = (uint32) i;
+
+        //A new electrode count invalidates the electrode selection; otherwise it is kept
+        if (source->numElectrodes != plannedChannels[i])
+        {
+            source->setNumElectrodes(plannedChannels[i]);
+            buffer->resize(getStreamActivity(i) == STREAM_ACTIVE ? source->numChannels : 0, 1000);
+            assignPacketSize(sources.size() - 1);
+            source->prepare(waveformCache);
+            resized++;
+        }
+        else
+        {
+            //The packet size request moved with the source; a new slot still means a new seed
+            if (assignPacketSize(sources.size() - 1) || reseeded)
+                source->prepare(waveformCache);
+            kept++;
+        }
+    }
+
+    //Whatever was not reused is deleted with previousSources / previousBuffers
+    const int removed = numPrevious - kept - resized;
+    const bool changed = added + resized + removed > 0;
+
+    if (changed)
+        waveformCache.releaseUnused();
+
+    lastReconfiguration = "Reconfigured in " + String(Time::getMillisecondCounterHiRes() - start, 1) + " ms (kept " + String(kept)
+        + ", resized " + String(resized) + ", added " + String(added) + ", removed " + String(removed) + ")";
+
+    return changed;
+
+}
+
+bool SourceThread::foundInputSource()
+{
+    return true;
+}
+
+bool SourceThread::startAcquisition()
+{
+
+    //A sweep would compete with the sources for the cores
+    if (isCapacityProbeRunning())
+        stopCapacityProbe();
+
+    //Every source measures its pacing from the same instant so streams stay aligned
+    high_resolution_clock::time_point startTime = high_resolution_clock::now();
+
+    //Nothing downstream and nothing recorded: no stream has a consumer
+    const bool unconsumed = autoIdle && !recordToDisk && sn->getDestNode() == nullptr;
+
+    for (int i = 0; i < sources.size(); i++)
+    {
+        SourceSim* source = sources[i];
+        source->activity = unconsumed ? STREAM_OFF : getStreamActivity(i);
+
+        //Room for several packets, more when running faster than real time
+        int packetsBuffered = timeScale == 1.0f ? 4 : (timeScale > 0 ? 4 * (int)std::ceil(timeScale) : 64);
+        source->bufferSize = jmax(1000, packetsBuffered * source->packetSize);
+        sourceBuffers[i]->resize(getStreamActivity(i) == STREAM_ACTIVE ? source->numChannels : 0, source->bufferSize);
+        sourceBuffers[i]->clear();
+
+        source->timeScale = timeScale;
+        source->setStartTime(startTime);
+        source->traceName = source->name + " " + String(i);
+        source->updateClkFreq(clkFreq, clkTol);
+    }
+
+    assignPlacement();
+
+    //Attach the recorders before the first packet so recordings start at sample 0
+    if (recordToDisk)
+        startRecording();
+
+    triggerGate.reset();
+
+    for (int i = 0; i < sources.size(); i++)
+    {
+        sources[i]->startGate = externalTrigger ? &triggerGate : nullptr;
+        sources[i]->triggerLatencyUs = -1.0;
+        sources[i]->resumeAfterRestart = false;
+
+        if (sources[i]->activity != STREAM_OFF)
+            sources[i]->startThread();
+    }
+
+    health.clearQuick();
+    health.insertMultiple(0, SourceHealth{ false, 0.0, false }, sources.size());
 
+    if (externalTrigger)
+    {
+        if (trigger.isValid())
+        {
+            //Ignore triggers fired before we were armed
+            trigger.arm();
+            triggerWaiter.startThread(10);
+        }
+        else
+        {
+            std::cout << "Source Sim: local trigger unavailable, starting immediately" << std::endl;
+            triggerReceived();
+        }
+    }
 
-SourceThread::SourceThread(SourceNode* sn) : 
-	DataThread(sn),
-	recordingTimer(this),
-    numProbes(NUM_PROBES),
-    numChannelsPerProbe(AP_CHANNELS),
-	numNIDevices(NUM_NI_DEVICES),
-	numChannelsPerNIDAQDevice(NIDAQ_CHANNELS)
-{
-    generateBuffers();
+    this->startThread();
+	
+    return true;
 }
 
-SourceThread::~SourceThread()
+void SourceThread::timerCallback()
 {
+	sources.getLast()->startThread();
+    stopTimer();
+}
 
+void SourceThread::setTriggerMode(bool trigger)
+{
+    externalTrigger = trigger;
 }
 
-void SourceThread::updateClkFreq(int freq, float tol)
+void SourceThread::triggerReceived()
 {
-    std::cout << "Update clk freq: " << freq << " tol: " << tol << std::endl;
+
+    //The trigger instant becomes the time of sample 0 for every source
+    high_resolution_clock::time_point triggerTime = high_resolution_clock::now();
+
+    for (auto source : sources)
+        source->setStartTime(triggerTime);
+
+    triggerGate.signal();
+
+    //Report how long the started sources took to deliver sample 0; off streams never start
+    Array<SourceSim*> started;
+    double firstPacketMs = 0;
 
     for (auto source : sources)
     {
-        if (source->isTimerRunning())
-            source->updateClkFreq(freq, tol);
+        if (source->activity == STREAM_OFF)
+            continue;
+
+        started.add(source);
+
+        //The first packet is paced like every other one
+        if (source->timeScale > 0)
+            firstPacketMs = jmax(firstPacketMs, 1000.0 * source->packetSize / source->sampleRate / source->timeScale);
+    }
+
+    if (started.size() == 0)
+        return;
+
+    const double deadlineMs = Time::getMillisecondCounterHiRes() + firstPacketMs + TRIGGER_REPORT_MARGIN_MS;
+
+    double minLatency = -1;
+    double maxLatency = -1;
+    int reported = 0;
+
+    while (true)
+    {
+        minLatency = maxLatency = -1;
+        reported = 0;
+
+        for (auto source : started)
+        {
+            double latency = source->triggerLatencyUs;
+
+            if (latency < 0)
+                continue;
+
+            minLatency = minLatency < 0 ? latency : jmin(minLatency, latency);
+            maxLatency = jmax(maxLatency, latency);
+            reported++;
+        }
+
+        if (reported == started.size() || triggerWaiter.threadShouldExit() || Time::getMillisecondCounterHiRes() > deadlineMs)
+            break;
+
+        Thread::sleep(1);
     }
+
+    if (reported > 0)
+        std::cout << "Source Sim: triggered, trigger-to-first-sample latency " << minLatency << " - " << maxLatency << " us ("
+                  << reported << " of " << started.size() << " sources)" << std::endl;
+
 }
 
+void SourceThread::setRecordMode(bool record)
+{
+    recordToDisk = record;
+}
 
-void SourceThread::updateClkEnable(int subProcIdx, bool enable)
+void SourceThread::setDirectoryForSlot(int slotIndex, File directory)
 {
-    sources[subProcIdx]->updateClk(enable);
+    if (slotIndex < 0)
+        return;
+
+    while (slotDirectories.size() <= slotIndex)
+        slotDirectories.add(File());
+
+    slotDirectories.set(slotIndex, directory);
 }
 
-void SourceThread::updateNPXChannels(int channels)
+File SourceThread::getDirectoryForSlot(int slotIndex)
 {
-    numChannelsPerProbe = channels;
-    generateBuffers();
-    sn->update();
+    if (slotIndex >= 0 && slotIndex < slotDirectories.size() && slotDirectories[slotIndex] != File())
+        return slotDirectories[slotIndex];
+
+    return File::getSpecialLocation(File::userDocumentsDirectory).getChildFile("SourceSim");
 }
 
-void SourceThread::updateNumProbes(int probes)
+bool SourceThread::startCapacityProbe()
 {
-    numProbes = probes;
-    generateBuffers();
-    sn->update();
+
+    if (isThreadRunning() || isCapacityProbeRunning())
+        return false;
+
+    File file = getDirectoryForSlot(0).getChildFile("capacity_" + Time::getCurrentTime().formatted("%Y-%m-%d_%H-%M-%S") + ".json");
+
+    capacityProbe = new CapacityProbe(CapacityProbe::Config(), file);
+    capacityProbe->startThread();
+
+    return true;
+
 }
-	
-void SourceThread::updateNIDAQChannels(int channels)
+
+void SourceThread::stopCapacityProbe()
 {
-    numChannelsPerNIDAQDevice = channels;
-    generateBuffers();
-    sn->update();
+    if (isCapacityProbeRunning())
+        capacityProbe->stopThread(5000);
 }
 
-void SourceThread::updateNIDAQDeviceCount(int count)
+void SourceThread::setTraceCapture(bool enable)
 {
-    numNIDevices = count; 
-    generateBuffers();
-    sn->update();
+    TraceCapture::setEnabled(enable);
 }
 
-void SourceThread::generateBuffers()
+File SourceThread::dumpTrace()
 {
 
-    sources.clear();
-    sourceBuffers.clear();
+    File directory = getDirectoryForSlot(0);
+    File file = directory.getChildFile("trace_" + Time::getCurrentTime().formatted("%Y-%m-%d_%H-%M-%S") + ".json");
 
-    for (int i = 0; i < numProbes; i++)
+    const int64 events = directory.createDirectory().failed() ? -1 : TraceCapture::dump(file);
+
+    if (events < 0)
+    {
+        std::cout << "Source Sim: could not write trace to " << file.getFullPathName() << std::endl;
+        return File();
+    }
+
+    lastTrace = "Trace: " + String(events) + " events in " + file.getFileName();
+
+    return file;
+
+}
+
+void SourceThread::startRecording()
+{
+
+    if (recorders.size() > 0)
+        return;
+
+    String sessionName = Time::getCurrentTime().formatted("%Y-%m-%d_%H-%M-%S");
+
+    //Slots sharing a directory share one recording (and one structure.oebin)
+    Array<File> recordingDirectories;
+    Array<SourceSim*> recordedSources;
+    Array<int> recordedSlots;
+
+    for (int slot = 0; slot < sources.size(); slot++)
     {
+        SourceSim* source = sources[slot];
+        File recordingDirectory = getDirectoryForSlot(slot).getChildFile(sessionName)
+            .getChildFile("experiment1").getChildFile("recording1");
+        String folder = SessionRenderer::getStreamFolderName(slot);
 
-        //Add Neuropixels AP Band
-        sources.add(new NPX_AP_BAND(numChannelsPerProbe));
-        sourceBuffers.add(new DataBuffer(sources.getLast()->numChannels,1000));
-        sources.getLast()->buffer = sourceBuffers.getLast();
+        BinaryStreamWriter* writer = new BinaryStreamWriter(recordingDirectory.getChildFile("continuous").getChildFile(folder),
+            recordingDirectory.getChildFile("events").getChildFile(folder),
+            source->numChannels, getBitVolts(nullptr), source->packetSize, RECORD_QUEUE_BLOCKS);
+
+        recorders.add(writer);
+
+        //Idle streams generate nothing to record
+        if (source->activity != STREAM_ACTIVE)
+            continue;
+
+        if (!writer->open())
+        {
+            std::cout << "Source Sim: could not record slot " << slot << " to " << recordingDirectory.getFullPathName() << std::endl;
+            continue;
+        }
 
-        //Add Neuropixels LFP Band
-        sources.add(new NPX_LFP_BAND(numChannelsPerProbe));
-        sourceBuffers.add(new DataBuffer(sources.getLast()->numChannels,1000));
-        sources.getLast()->buffer = sourceBuffers.getLast();
+        source->setRecorder(writer);
 
+        recordingDirectories.add(recordingDirectory);
+        recordedSources.add(source);
+        recordedSlots.add(slot);
     }
 
-    // //Add NIDAQ Band
-    for (int i = 0; i < numNIDevices; i++)
+    for (int i = 0; i < recordingDirectories.size(); i++)
     {
-        sources.add(new NIDAQ(numChannelsPerNIDAQDevice));
-        sourceBuffers.add(new DataBuffer(sources.getLast()->numChannels,1000));
-        sources.getLast()->buffer = sourceBuffers.getLast();
-    }	
+        if (recordingDirectories.indexOf(recordingDirectories[i]) != i)
+            continue;
 
-}
+        Array<SourceSim*> slotSources;
+        Array<int> slotIndices;
+
+        for (int j = i; j < recordingDirectories.size(); j++)
+        {
+            if (recordingDirectories[j] == recordingDirectories[i])
+            {
+                slotSources.add(recordedSources[j]);
+                slotIndices.add(recordedSlots[j]);
+            }
+        }
+
+        SessionRenderer::writeStructureFile(recordingDirectories[i], slotSources, slotIndices);
+    }
 
-bool SourceThread::foundInputSource()
-{
-    return true;
 }
 
-bool SourceThread::startAcquisition()
+void SourceThread::stopRecording()
 {
 
-	sourceBuffers.getLast()->clear();
+    lastRecording = String();
 
-    for (int i = 0; i < sources.size(); i++)
+    for (int slot = 0; slot < recorders.size(); slot++)
     {
-        sources[i]->startThread();
+        if (slot < sources.size())
+            sources[slot]->setRecorder(nullptr);
+
+        recorders[slot]->close();
+
+        //Ground truth for motion-correction scoring, next to the stream it applies to
+        if (slot < sources.size() && sources[slot]->drift.isEnabled())
+            sources[slot]->writeDriftTrace(recorders[slot]->getContinuousDirectory().getChildFile("drift_trace.csv"),
+                recorders[slot]->getNumSamplesWritten());
+
+        lastRecording += "Slot " + String(slot) + ": " + String(recorders[slot]->getNumSamplesWritten()) + " samples recorded, "
+            + String(recorders[slot]->getNumDroppedPackets()) + " packets dropped\n";
     }
 
-    this->startThread();
-	
-    return true;
-}
+    recorders.clear();
 
-void SourceThread::timerCallback()
-{
-	sources.getLast()->startThread();
-    stopTimer();
 }
 
-void SourceThread::startRecording()
+int64 SourceThread::getNumDroppedPackets(int slotIndex) const
 {
+    if (slotIndex >= 0 && slotIndex < recorders.size())
+        return recorders[slotIndex]->getNumDroppedPackets();
 
+    return 0;
 }
 
-void SourceThread::stopRecording()
+String SourceThread::getInfoString()
 {
+
+    String info = String(sources.size()) + " simulated subprocessors\n";
+
+    if (lastReconfiguration.isNotEmpty())
+        info += lastReconfiguration + "\n";
+
+    for (int i = 0; i < sources.size(); i++)
+    {
+        if (sources[i]->channelMap.size() > 0)
+            info += sources[i]->name + " " + String(i) + ": " + String(sources[i]->numChannels) + " of "
+                + String(sources[i]->numElectrodes) + " electrodes\n";
+    }
+
+    if (templateLibrary != nullptr)
+        info += "Template library " + templateLibrary->getFile().getFileName() + ": " + String(templateLibrary->getNumTemplates())
+            + " templates of " + String(templateLibrary->getNumSamples()) + " samples x " + String(templateLibrary->getNumElectrodes()) + " electrodes\n";
+
+    if (triggerWaiter.isThreadRunning())
+        info += "Armed, waiting for trigger \"" + String(DEFAULT_TRIGGER_NAME) + "\"\n";
+
+    {
+        const ScopedLock sl(displayMutex);
+
+        for (int i = 0; i < incidents.size(); i++)
+            info += incidents[i] + "\n";
+    }
+
+    if (externalTrigger)
+    {
+        for (int i = 0; i < sources.size(); i++)
+        {
+            if (sources[i]->triggerLatencyUs >= 0)
+                info += sources[i]->name + " " + String(i) + ": trigger-to-first-sample " + String(sources[i]->triggerLatencyUs.load(), 1) + " us\n";
+        }
+    }
+
+    for (int i = 0; i < sources.size(); i++)
+    {
+        if (sources[i]->latencyMeanUs >= 0)
+            info += sources[i]->name + " " + String(i) + ": " + String(sources[i]->packetSize) + "-sample packets, latency mean "
+                + String(sources[i]->latencyMeanUs.load(), 1) + " us, p99 " + String(sources[i]->latencyP99Us.load(), 0)
+                + " us, max " + String(sources[i]->latencyMaxUs.load(), 1) + " us\n";
+    }
+
+    for (int i = 0; i < sources.size(); i++)
+    {
+        if (sources[i]->activity == STREAM_TTL_ONLY)
+            info += sources[i]->name + " " + String(i) + ": idle (TTL only)\n";
+        else if (sources[i]->activity == STREAM_OFF)
+            info += sources[i]->name + " " + String(i) + ": off\n";
+    }
+
+    if (placement.cpus.isNotEmpty() || placement.realtime)
+    {
+        for (int i = 0; i < sources.size(); i++)
+            info += sources[i]->name + " " + String(i) + ": " + sources[i]->getPlacement().toString() + "\n";
+    }
+
+    for (int slot = 0; slot < recorders.size(); slot++)
+    {
+        info += "Slot " + String(slot) + ": " + String(recorders[slot]->getNumSamplesWritten()) + " samples recorded, "
+            + String(recorders[slot]->getNumDroppedPackets()) + " packets dropped\n";
+    }
+
+    if (recorders.size() == 0)
+        info += lastRecording;
+
+    if (lastTrace.isNotEmpty())
+        info += lastTrace + "\n";
+
+    if (isCapacityProbeRunning())
+        info += "Capacity probe running: " + capacityProbe->getProgress() + "\n";
+    else if (capacityProbe != nullptr)
+        info += "Capacity (" + capacityProbe->getReportFile().getFileName() + "):\n" + capacityProbe->getSummary();
+
+    return info;
+
 }
 
 /** Stops data transfer.*/
@@ -178,9 +1167,24 @@ bool SourceThread::stopAcquisition()
     for (auto source : sources)
         source->signalThreadShouldExit();
 
+    if (triggerWaiter.isThreadRunning())
+    {
+        trigger.cancel();
+        triggerWaiter.stopThread(1000);
+    }
+
+    //Release sources still armed so they can exit
+    triggerGate.signal();
+
+    //startAcquisition resizes and clears the source buffers, so no source may still be pushing
+    for (auto source : sources)
+        source->stopThread(WATCHDOG_EXIT_MS);
+
     if (isThreadRunning())
         signalThreadShouldExit();
 
+    stopRecording();
+
     return true;
 }
 
@@ -192,46 +1196,31 @@ bool SourceThread::usesCustomNames() const
 void SourceThread::setDefaultChannelNames()
 {
 
-    int absChannel = 0;
-
-    for (int i = 0; i < 2*numProbes; i+=2)
-    {
-
-        //AP
-        for (int j = 0; j < sources[i]->numChannels; j++)
-        {
-            ChannelCustomInfo info;
-            info.name = "AP" + String(j + 1);
-            info.gain = 1.0f;
-            channelInfo.set(absChannel, info);
-            absChannel++;
-        }
+    //Idle streams declare no data channels (see getNumDataOutputs), so they take no names
+    int numChannels = 0;
+    for (int i = 0; i < sources.size(); i++)
+        numChannels += getStreamActivity(i) == STREAM_ACTIVE ? sources[i]->numChannels : 0;
 
-        //LFP
-        for (int j = 0; j < sources[i+1]->numChannels; j++)
-        {
-            ChannelCustomInfo info;
-            info.name = "LFP" + String(j + 1);
-            info.gain = 1.0f;
-            channelInfo.set(absChannel, info);
-            absChannel++;
-        }
+    channelInfo.ensureStorageAllocated(numChannels);
 
-    }
+    //Channels are named per stream after the electrode they carry: AP1..APn, LFP1..LFPn, WB1..WBn, AI1..AIn, APT1..APTn
+    int absChannel = 0;
 
-    //NIDAQ
-    for (int i = 0; i < numNIDevices; i++)
+    for (int i = 0; i < sources.size(); i++)
     {
+        SourceSim* source = sources[i];
 
-        for (int i = 0; i < sources[sources.size()-1]->numChannels; i++)
+        if (getStreamActivity(i) != STREAM_ACTIVE)
+            continue;
+
+        for (int j = 0; j < source->numChannels; j++)
         {
             ChannelCustomInfo info;
-            info.name = "AI" + String(i + 1);
+            info.name = source->name + String(source->getElectrode(j) + 1);
             info.gain = 1.0f;
             channelInfo.set(absChannel, info);
             absChannel++;
         }
-
     }
 
 }
@@ -247,9 +1236,13 @@ unsigned int SourceThread::getNumSubProcessors() const
 int SourceThread::getNumDataOutputs(DataChannel::DataChannelTypes type, int subProcessorIdx) const
 {
 
-	if (type == DataChannel::DataChannelTypes::HEADSTAGE_CHANNEL && subProcessorIdx < 2 * numProbes)
+	//Idle streams only carry timestamps and TTL events
+	if (getStreamActivity(subProcessorIdx) != STREAM_ACTIVE)
+		return 0;
+
+	if (type == DataChannel::DataChannelTypes::HEADSTAGE_CHANNEL && !isAnalogStream(subProcessorIdx))
         return sources[subProcessorIdx]->numChannels;
-	else if (type == DataChannel::DataChannelTypes::ADC_CHANNEL && subProcessorIdx >= 2 * numProbes)
+	else if (type == DataChannel::DataChannelTypes::ADC_CHANNEL && isAnalogStream(subProcessorIdx))
 		return sources[subProcessorIdx]->numChannels;
     
     return 0;
@@ -259,7 +1252,7 @@ int SourceThread::getNumDataOutputs(DataChannel::DataChannelTypes type, int subP
 /** Returns the number of TTL channels that each subprocessor generates*/
 int SourceThread::getNumTTLOutputs(int subProcessorIdx) const 
 {
-    if (subProcessorIdx < 2 * numProbes)
+    if (!isAnalogStream(subProcessorIdx))
 	    return 1;
     else 
         return numChannelsPerNIDAQDevice;
@@ -281,7 +1274,123 @@ float SourceThread::getBitVolts(const DataChannel* chan) const
 
 bool SourceThread::updateBuffer()
 {
+
+    //Sources push their own packets; this thread only watches over them
+    checkSources();
+
+    //Parameter snapshots replaced by live edits are freed here, never on the source threads
+    for (auto source : sources)
+        source->parameters.reclaim();
+
+    wait(WATCHDOG_INTERVAL_MS);
+
     return true;
+
+}
+
+void SourceThread::setAutoRestart(bool restart)
+{
+    autoRestart = restart;
+}
+
+void SourceThread::checkSources()
+{
+
+    const double now = Time::getMillisecondCounterHiRes();
+
+    for (int i = 0; i < sources.size() && i < health.size(); i++)
+    {
+        SourceSim* source = sources[i];
+
+        if (health[i].restartRequestedMs > 0)
+        {
+            completeRestart(i, now);
+            continue;
+        }
+
+        //Armed sources are legitimately idle until the trigger fires; streams that are off never start
+        if ((source->startGate != nullptr && source->triggerLatencyUs < 0) || source->activity == STREAM_OFF)
+            continue;
+
+        const double packetMs = 1000.0 * source->packetSize / source->sampleRate / (source->timeScale > 0 ? source->timeScale : 1.0);
+        const double silenceMs = now - source->heartbeatMs;
+
+        if (silenceMs < jmax((double) WATCHDOG_STALL_MS, 10.0 * packetMs))
+        {
+            health.getReference(i).stalled = false;
+            continue;
+        }
+
+        if (!health[i].stalled)
+        {
+            health.getReference(i).stalled = true;
+            logIncident(source->name + " " + String(i) + " stalled at sample " + String(source->generatedSamples.load())
+                + " (no heartbeat for " + String(silenceMs, 0) + " ms)");
+        }
+
+        if (autoRestart)
+            restartSource(i);
+    }
+
+}
+
+void SourceThread::restartSource(int index)
+{
+
+    //Other sources and this source's sample count are left untouched. A stalled thread may take a
+    //while to see the request, so the watchdog (and with it updateBuffer) never waits for it here
+    sources[index]->signalThreadShouldExit();
+
+    SourceHealth& h = health.getReference(index);
+    h.restartRequestedMs = Time::getMillisecondCounterHiRes();
+    h.restartOverdue = false;
+
+    completeRestart(index, h.restartRequestedMs);
+
+}
+
+void SourceThread::completeRestart(int index, double now)
+{
+
+    SourceSim* source = sources[index];
+    SourceHealth& h = health.getReference(index);
+
+    if (source->isThreadRunning())
+    {
+        //Reported once; the restart still happens if the thread exits later
+        if (!h.restartOverdue && now - h.restartRequestedMs > WATCHDOG_EXIT_MS)
+        {
+            h.restartOverdue = true;
+            logIncident(source->name + " " + String(index) + " has not stopped after " + String(WATCHDOG_EXIT_MS)
+                + " ms; restart pending");
+        }
+
+        return;
+    }
+
+    const int64 resumeSample = source->generatedSamples;
+
+    source->resumeAfterRestart = true;
+    source->heartbeatMs = Time::getMillisecondCounterHiRes();
+    source->startThread();
+
+    h = SourceHealth{ false, 0.0, false };
+
+    logIncident(source->name + " " + String(index) + " restarted at sample " + String(resumeSample)
+        + ", gap up to sample " + String(source->getExpectedSamples()) + " filled with flat samples");
+
+}
+
+void SourceThread::logIncident(const String& message)
+{
+
+    String entry = Time::getCurrentTime().toString(true, true, true, true) + " " + message;
+
+    std::cout << "Source Sim watchdog: " << entry << std::endl;
+
+    const ScopedLock sl(displayMutex);
+    incidents.add(entry);
+
 }
 
 
@@ -290,6 +1399,17 @@ RecordingTimer::RecordingTimer(SourceThread* t_)
 	thread = t_;
 }
 
+TriggerWaiter::TriggerWaiter(SourceThread* t_) : Thread("Source Sim trigger")
+{
+	thread = t_;
+}
+
+void TriggerWaiter::run()
+{
+	if (thread->trigger.wait())
+		thread->triggerReceived();
+}
+
 void RecordingTimer::timerCallback()
 {
 	thread->startRecording();
@@ -26,6 +26,11 @@
 #define __SOURCESIMTHREAD_H__
 
 #include "SourceSim.h"
+#include "BinaryStreamWriter.h"
+#include "LocalTrigger.h"
+#include "DeviceProfile.h"
+#include "TemplateLibrary.h"
+#include "CapacityProbe.h"
 
 #include <DataThreadHeaders.h>
 #include <stdio.h>
@@ -45,6 +50,18 @@ public:
 	SourceThread* thread;
 };
 
+/* Blocks on the local trigger at high priority and releases the armed sources */
+class TriggerWaiter : public Thread
+{
+
+public:
+
+	TriggerWaiter(SourceThread* t_);
+	void run() override;
+
+	SourceThread* thread;
+};
+
 
 /**
 
@@ -64,19 +81,109 @@ public:
 	SourceThread(SourceNode* sn);
 	~SourceThread();
 
+	/* Probe model (a DeviceProfileId); NIDAQ devices always use the NIDAQ_DEVICE profile */
+	int probeType;
+
 	int numProbes;
 	int numChannelsPerProbe;
 	int numNIDevices;
 	int numChannelsPerNIDAQDevice;
 
-	void generateBuffers();
+	/* Action potential trains (AP_TRAIN_DEVICE profile), after the NIDAQ devices; none by default */
+	int numAPTrains;
+	int numChannelsPerAPTrain;
+
+	/** Limits and stream layout of the selected probe model.*/
+	const DeviceProfile& getProbeProfile() const { return getDeviceProfile(probeType); }
+
+	/** Switches the probe model, clamping the channel count to its limit. Returns true if the layout changed.*/
+	bool setProbeType(int profileId);
+
+	/** Sets the probe motion of every probe stream; recordings then include each stream's true
+	    drift trace (continuous/<stream>/drift_trace.csv). Returns false while acquiring.*/
+	bool setDrift(const DriftSettings& settings);
+
+	DriftSettings getDrift() const { return drift; }
+
+	/** Sets the correlated 1/f background of every stream carrying the LFP band (rms 0 disables it).
+	    Returns false while acquiring.*/
+	bool setBackground(const BackgroundSettings& settings);
+
+	BackgroundSettings getBackground() const { return background; }
+
+	/** Sets the rhythms and ripple events of every stream carrying the LFP band. Returns false while acquiring.*/
+	bool setOscillations(const OscillationSettings& settings);
+
+	OscillationSettings getOscillations() const { return oscillations; }
+
+	/** Sets the spike source (TTL edges or a rate) and conduction delay of every action potential train.
+	    Returns false while acquiring.*/
+	bool setSpikeTrain(const SpikeTrainSettings& settings);
+
+	SpikeTrainSettings getSpikeTrain() const { return spikeTrain; }
+
+	/** Sets the amplifier noise, stimulation artifacts and ADC step of every probe stream (all off
+	    by default). Returns false while acquiring.*/
+	bool setFrontEnd(const FrontEndSettings& settings);
+
+	FrontEndSettings getFrontEnd() const { return frontEnd; }
+
+	/** Makes the units of every probe play recorded templates from an .npy library, templatesPerProbe
+	    (0 = all) drawn per probe; File() restores the built-in template. Returns false while
+	    acquiring or if the file is not a usable template array.*/
+	bool setTemplateLibrary(const File& file, int templatesPerProbe);
+
+	File getTemplateLibraryFile() const { return templateLibrary != nullptr ? templateLibrary->getFile() : File(); }
+	int getTemplatesPerProbe() const { return templatesPerProbe; }
+
+	/** Low-latency mode: every stream without a packet size of its own generates packets of
+	    LOW_LATENCY_PACKET_SECONDS (a few samples) instead of DEFAULT_PACKET_SIZE. Returns false while acquiring.*/
+	bool setLowLatency(bool enable);
+
+	bool getLowLatency() const { return lowLatency; }
+
+	/** Sets the packet size of one subprocessor (clamped to MIN_PACKET_SIZE..MAX_PACKET_SIZE);
+	    0 returns it to the size of the current mode. Returns false while acquiring.*/
+	bool setPacketSize(int subProcessorIdx, int samples);
+
+	/** Packet size requested for a subprocessor with setPacketSize, 0 if it follows the mode.*/
+	int getRequestedPacketSize(int subProcessorIdx) const;
+
+	/** Pins the source threads (in subprocessor order) to the listed CPUs in turn, optionally with real-time priority and node-local packet buffers; takes effect at the
+	    next acquisition start. Returns false while acquiring or if the CPU list is invalid.*/
+	bool setPlacement(const PlacementSettings& settings);
+
+	PlacementSettings getPlacement() const { return placement; }
+
+	/** Sets what a subprocessor emits (a StreamActivity). Idle streams (TTL only or off) declare no
+	    data channels and are never generated. Returns true if the stream layout changed; false
+	    otherwise or while acquiring.*/
+	bool setStreamActivity(int subProcessorIdx, int activity);
+
+	int getStreamActivity(int subProcessorIdx) const;
+
+	/** With auto-idle, an acquisition in which nothing can consume the streams (no processor follows
+	    the source node and ground-truth recording is off) leaves every stream off.*/
+	void setAutoIdle(bool enable);
+
+	bool getAutoIdle() const { return autoIdle; }
+
+	/** True for NIDAQ subprocessors, false for probe streams and action potential trains.*/
+	bool isAnalogStream(int subProcessorIdx) const;
+
+	/** Brings sources and buffers in line with the configuration, reusing every source whose
+	    type and position are unchanged. Returns true if the stream layout changed.*/
+	bool generateBuffers();
 
 	bool updateBuffer();
 
-	void updateNPXChannels(int channels);
-	void updateNumProbes(int probes);
-	void updateNIDAQChannels(int channels);
-	void updateNIDAQDeviceCount(int count);
+	/** Configuration setters; return true if the stream layout (and so the signal chain) changed.*/
+	bool updateNPXChannels(int channels);
+	bool updateNumProbes(int probes);
+	bool updateNIDAQChannels(int channels);
+	bool updateNIDAQDeviceCount(int count);
+	bool updateAPTrainChannels(int channels);
+	bool updateAPTrainCount(int count);
 
 	/** Returns true if the data source is connected, false otherwise.*/
 	bool foundInputSource();
@@ -121,10 +228,10 @@ public:
 	/** Selects which electrode is connected to each channel. */
 	void selectElectrodes(unsigned char slot, signed char port, Array<int> channelStatus);
 
-	/** Selects which reference is used for each channel. */
+	/** Selects which reference is used for each channel (0 external, 1 tip, 2 internal, 3 common average). */
 	void setAllReferences(unsigned char slot, signed char port, int refId);
 
-	/** Sets the gain for each channel. */
+	/** Sets the gain for each channel (Neuropixels 1.0 gain indices 0-7). */
 	void setAllGains(unsigned char slot, signed char port, unsigned char apGain, unsigned char lfpGain);
 
 	/** Sets the filter for all channels. */
@@ -133,6 +240,9 @@ public:
 	/** Toggles between internal and external triggering. */
 	void setTriggerMode(bool trigger);
 
+	/** Called by the trigger waiter: timestamps sample 0 and releases every armed source. */
+	void triggerReceived();
+
 	/** Toggles between saving to NPX file. */
 	void setRecordMode(bool record);
 
@@ -142,9 +252,35 @@ public:
 	/** Select directory for saving NPX files. */
 	File getDirectoryForSlot(int slotIndex);
 
+	/** Starts capturing the timeline of the source threads (see TraceCapture), or stops.
+	    The capture keeps running across acquisitions.*/
+	void setTraceCapture(bool enable);
+
+	bool getTraceCapture() const { return TraceCapture::isEnabled(); }
+
+	/** Writes the captured timeline as a Chrome / Perfetto trace (trace_<date>.json) into the slot 0
+	    directory. Returns the file, or File() on errors.*/
+	File dumpTrace();
+
+	/** Starts a capacity sweep (see CapacityProbe) in the background; its JSON report goes into the slot 0
+	    directory. Returns false while acquiring or sweeping. Starting an acquisition cancels the sweep.*/
+	bool startCapacityProbe();
+
+	/** Cancels a running capacity sweep.*/
+	void stopCapacityProbe();
+
+	bool isCapacityProbeRunning() const { return capacityProbe != nullptr && capacityProbe->isThreadRunning(); }
+
 	/** Toggles between auto-restart setting. */
 	void setAutoRestart(bool restart);
 
+	/** Watchdog pass: flags sources whose heartbeat stopped and, with auto-restart, restarts them. */
+	void checkSources();
+
+	/** Asks a stalled source to stop; once its thread has exited, the watchdog starts it again without
+	    resetting its timebase and the gap is filled with flat samples. Never blocks. */
+	void restartSource(int index);
+
 	/** Starts data acquisition after a certain time.*/
 	void timerCallback();
 
@@ -154,6 +290,9 @@ public:
 	/** Stops recording.*/
 	void stopRecording();
 
+	/** Number of packets the recorder for a slot had to drop because its queue was full.*/
+	int64 getNumDroppedPackets(int slotIndex) const;
+
 	CriticalSection* getMutex()
 	{
 		return &displayMutex;
@@ -168,14 +307,105 @@ public:
 	void updateClkFreq(int freq, float tol);
 	void updateClkEnable(int subProcIdx, bool enable);
 
+	/** Runs virtual time scale x faster than real time (0 = as fast as downstream consumes).
+	    Samples, timestamps and TTL edges are identical to a 1x run. */
+	void setTimeScale(float scale);
+
+	int clkFreq;
+	float clkTol;
+	float timeScale;
+
 	JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SourceThread);
 
 private:
 
+	friend class TriggerWaiter;
+
 	CriticalSection displayMutex;
 
 	RecordingTimer recordingTimer;
 
+	/* Pre-rendered source waveforms, shared by sources with identical configurations */
+	WaveformCache waveformCache;
+
+	/* External trigger mode: sources arm on startAcquisition and wait for the local trigger */
+	bool externalTrigger;
+	LocalTrigger trigger;
+	WaitableEvent triggerGate;
+	TriggerWaiter triggerWaiter;
+
+	/* Range [first, end) of the subprocessors of the probe that owns slot; false if slot is not a probe stream */
+	bool getProbeStreams(int slot, int& first, int& end) const;
+
+	/* Probe motion given to every probe stream */
+	DriftSettings drift;
+
+	/* Background activity and rhythms given to every stream carrying the LFP band */
+	BackgroundSettings background;
+	FrontEndSettings frontEnd;
+	OscillationSettings oscillations;
+
+	/* Spike source given to every action potential train */
+	SpikeTrainSettings spikeTrain;
+
+	/* Recorded unit templates (null for the built-in template) and the subset size drawn per probe */
+	ScopedPointer<TemplateLibrary> templateLibrary;
+
+	/* Last capacity sweep, kept for its summary */
+	ScopedPointer<CapacityProbe> capacityProbe;
+	int templatesPerProbe;
+
+	/* Gives the source in slot its probe's template subset (before prepare) */
+	void assignTemplates(int slot);
+
+	/* Thread placement and the CPUs it lists */
+	PlacementSettings placement;
+	Array<int> placementCpus;
+
+	/* Hands every source its CPU before the threads start */
+	void assignPlacement();
+
+	/* StreamActivity requested per slot (missing entries are active) */
+	Array<int> streamActivity;
+	bool autoIdle;
+
+	/* Low-latency mode and the packet sizes requested per slot (0 follows the mode) */
+	bool lowLatency;
+	Array<int> packetSizes;
+
+	/* Gives the source in slot its packet size (before prepare); returns true if it changed */
+	bool assignPacketSize(int slot);
+
+	/* Regenerates buffers and notifies the source node only if the layout changed */
+	bool applyLayout();
+
+	/* Watchdog state per source, updated from this thread's updateBuffer() loop */
+	struct SourceHealth
+	{
+		bool stalled;
+		double restartRequestedMs; //0 unless a restart waits for the thread to exit
+		bool restartOverdue; //reported that the thread has not exited yet
+	};
+
+	bool autoRestart;
+	Array<SourceHealth> health;
+	StringArray incidents;
+
+	/* Outcome of the last reconfiguration, recording and trace dump, for the info string */
+	String lastReconfiguration;
+	String lastRecording;
+	String lastTrace;
+
+	/* Starts a source whose restart was requested once its thread has exited */
+	void completeRestart(int index, double now);
+
+	void logIncident(const String& message);
+
+	/* Record mode: one writer thread per slot (subprocessor) */
+	bool recordToDisk;
+	Array<File> slotDirectories;
+	OwnedArray<BinaryStreamWriter> recorders;
+
 };
 
 
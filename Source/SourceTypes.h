@@ -0,0 +1,131 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Allen Institute for Brain Science and Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __SOURCETYPES_H__
+#define __SOURCETYPES_H__
+
+#include "DeviceProfile.h"
+
+#include <cmath>
+#include <cstdint>
+
+/* Kept at the simulator's original precision so cached waveforms and session hashes do not change */
+#define SOURCE_WAVEFORM_PI 3.14159f
+
+/* Amplitude (uV) of the periodic waveform every source carries */
+#define SOURCE_WAVEFORM_AMPLITUDE 1000.0f
+
+/* Per-electrode gain calibration spread of the simulated probe amplifiers */
+#define PROBE_GAIN_SPREAD 0.02f
+
+/**
+
+	The stream types the simulator generates (NPX_AP_BAND, NPX_LFP_BAND, NPX2_WIDEBAND and
+	NIDAQ in SourceSim.h): rate, device, spatial source density and the periodic waveform.
+	Free of JUCE so the generation tests build exactly these sources.
+
+*/
+
+enum SourceTypeId
+{
+	AP_SOURCE = 0,
+	LFP_SOURCE,
+	WB_SOURCE,
+	AI_SOURCE,
+	NUM_SOURCE_TYPES
+};
+
+struct SourceTypeDescription
+{
+	/* Stream name prefix */
+	const char* name;
+
+	float sampleRate;
+
+	/* DeviceProfileId of the probe the stream records from, -1 for devices without sites */
+	int probeType;
+
+	/* Units and LFP dipoles per 100 electrodes (see SpatialStage::setSourceDensity) */
+	float unitDensity;
+	float lfpDensity;
+
+	/* Carries the LFP band: correlated background and oscillations are on by default */
+	bool carriesLfp;
+
+	/* Frequency (Hz) of the periodic waveform, and whether its sign alternates between electrodes */
+	float waveformFrequency;
+	bool alternatingWaveform;
+
+	/* Relative per-electrode gain spread (see GainStage), applied at every gain */
+	float gainSpread;
+};
+
+inline const SourceTypeDescription& getSourceType(int id)
+{
+	static const SourceTypeDescription types[NUM_SOURCE_TYPES] = {
+		{ "AP",  30000.0f, NPX1_PROBE,        12.0f, 0.0f, false, 60.0f, false, PROBE_GAIN_SPREAD },
+		{ "LFP", 2500.0f,  NPX1_PROBE,        0.0f,  1.0f, true,  60.0f, true,  PROBE_GAIN_SPREAD },
+		{ "WB",  30000.0f, NPX2_4SHANK_PROBE, 12.0f, 1.0f, true,  60.0f, false, PROBE_GAIN_SPREAD },
+		{ "AI",  30000.0f, -1,                0.0f,  0.0f, false, 10.0f, false, 0.0f }
+	};
+
+	return types[id >= 0 && id < NUM_SOURCE_TYPES ? id : 0];
+}
+
+/* Samples after which a sinusoid of frequency repeats exactly at sampleRate: rate / gcd(rate, frequency)
+   for integer values (all simulated devices), the rounded period otherwise */
+inline int getPeriodLength(float sampleRate, float frequency)
+{
+	int64_t a = (int64_t)sampleRate;
+	int64_t b = (int64_t)frequency;
+
+	if ((float)a != sampleRate || (float)b != frequency || b <= 0)
+		return (int)std::lround(sampleRate / frequency);
+
+	while (b != 0)
+	{
+		const int64_t t = a % b;
+		a = b;
+		b = t;
+	}
+
+	return (int)((int64_t)sampleRate / a);
+}
+
+/* Renders numSamples of the waveform of a source type, interleaved [sample][channel]; channelMap gives
+   the electrode of each channel, or is null when every electrode is generated in order */
+inline void renderSourceWaveform(const SourceTypeDescription& type, float sampleRate, float* dest, int numSamples, int numChannels, const int* channelMap)
+{
+	for (int i = 0; i < numSamples; i++)
+	{
+		const float sample = SOURCE_WAVEFORM_AMPLITUDE * std::sin(2 * SOURCE_WAVEFORM_PI * (float)i / (sampleRate / type.waveformFrequency));
+
+		for (int j = 0; j < numChannels; j++)
+		{
+			const int electrode = channelMap != nullptr ? channelMap[j] : j;
+			*dest++ = type.alternatingWaveform && electrode % 2 != 0 ? -sample : sample;
+		}
+	}
+}
+
+#endif  // __SOURCETYPES_H__
@@ -0,0 +1,205 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Allen Institute for Brain Science and Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "TemplateLibrary.h"
+
+TemplateLibrary::TemplateLibrary(const File& file_) :
+    file(file_),
+    data(nullptr),
+    numTemplates(0),
+    numSamples(0),
+    numElectrodes(0)
+{
+
+    mappedFile = new MemoryMappedFile(file, MemoryMappedFile::readOnly);
+
+    const char* bytes = static_cast<const char*>(mappedFile->getData());
+    const size_t size = mappedFile->getSize();
+
+    if (bytes == nullptr)
+    {
+        error = "cannot map " + file.getFullPathName();
+        mappedFile = nullptr;
+        return;
+    }
+
+    int shape[3];
+    const size_t offset = parseHeader(bytes, size, shape, error);
+
+    if (offset == 0)
+    {
+        mappedFile = nullptr;
+        return;
+    }
+
+    if ((size - offset) / sizeof(float) < (size_t) shape[0] * shape[1] * shape[2])
+    {
+        error = "array data is truncated";
+        mappedFile = nullptr;
+        return;
+    }
+
+    numTemplates = shape[0];
+    numSamples = shape[1];
+    numElectrodes = shape[2];
+    data = reinterpret_cast<const float*>(bytes + offset);
+
+}
+
+TemplateLibrary::~TemplateLibrary()
+{
+}
+
+size_t TemplateLibrary::parseHeader(const char* bytes, size_t size, int shape[3], String& error)
+{
+
+    //Magic, version, then a little-endian header length: 2 bytes in version 1, 4 bytes after
+    if (size < 10 || memcmp(bytes, "\x93NUMPY", 6) != 0)
+    {
+        error = "not an .npy file";
+        return 0;
+    }
+
+    const uint8* header = reinterpret_cast<const uint8*>(bytes);
+    const int major = header[6];
+
+    size_t start;
+    size_t length;
+
+    if (major == 1)
+    {
+        start = 10;
+        length = header[8] | (header[9] << 8);
+    }
+    else if (size >= 12 && (major == 2 || major == 3))
+    {
+        start = 12;
+        length = header[8] | (header[9] << 8) | (header[10] << 16) | ((size_t) header[11] << 24);
+    }
+    else
+    {
+        error = "unsupported .npy version " + String(major);
+        return 0;
+    }
+
+    if (start + length > size)
+    {
+        error = "header is truncated";
+        return 0;
+    }
+
+    //The header is a Python dict literal, e.g. {'descr': '<f4', 'fortran_order': False, 'shape': (300, 82, 384), }
+    const String dict(bytes + start, length);
+
+    const String descr = dict.fromFirstOccurrenceOf("'descr'", false, false).fromFirstOccurrenceOf("'", false, false).upToFirstOccurrenceOf("'", false, false);
+
+    if (descr != "<f4")
+    {
+        error = "templates must be little-endian float32, not " + descr;
+        return 0;
+    }
+
+    if (dict.fromFirstOccurrenceOf("'fortran_order'", false, false).trimCharactersAtStart(": ").startsWith("True"))
+    {
+        error = "templates must be stored in C order";
+        return 0;
+    }
+
+    StringArray dims;
+    dims.addTokens(dict.fromFirstOccurrenceOf("'shape'", false, false).fromFirstOccurrenceOf("(", false, false).upToFirstOccurrenceOf(")", false, false), ",", "");
+    dims.trim();
+    dims.removeEmptyStrings();
+
+    if (dims.size() != 3)
+    {
+        error = "templates must have shape (templates, samples, electrodes)";
+        return 0;
+    }
+
+    for (int i = 0; i < 3; i++)
+    {
+        shape[i] = dims[i].getIntValue();
+
+        if (shape[i] <= 0)
+        {
+            error = "empty template array";
+            return 0;
+        }
+    }
+
+    return start + length;
+
+}
+
+Array<int> TemplateLibrary::selectTemplates(int count, uint32 seed) const
+{
+
+    Array<int> order;
+
+    for (int i = 0; i < numTemplates; i++)
+        order.add(i);
+
+    if (count <= 0 || count > numTemplates)
+        count = numTemplates;
+
+    Random random((int64) seed);
+
+    for (int i = 0; i < count; i++)
+        order.swap(i, i + random.nextInt(numTemplates - i));
+
+    order.resize(count);
+
+    return order;
+
+}
+
+WaveformCache::Block::Ptr TemplateLibrary::getSubset(WaveformCache& cache, int count, uint32 seed) const
+{
+
+    if (!isValid())
+        return nullptr;
+
+    const Array<int> selection = selectTemplates(count, seed);
+
+    //Keyed on the file's identity, so an edited library is transposed again
+    String description = "templates|" + file.getFullPathName() + "|" + String(file.getSize()) + "|"
+        + String(file.getLastModificationTime().toMilliseconds()) + "|" + String(selection.size()) + "|seed" + String((int64) seed);
+
+    return cache.getBlock(description, selection.size() * numElectrodes, numSamples,
+        [this, &selection](float* dest, int rows, int length)
+        {
+            for (int t = 0; t < selection.size(); t++)
+            {
+                const float* source = data + (size_t) selection[t] * numSamples * numElectrodes;
+
+                for (int e = 0; e < numElectrodes; e++)
+                {
+                    float* waveform = dest + ((size_t) t * numElectrodes + e) * length;
+
+                    for (int i = 0; i < length; i++)
+                        waveform[i] = source[(size_t) i * numElectrodes + e];
+                }
+            }
+        });
+
+}
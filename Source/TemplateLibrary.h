@@ -0,0 +1,93 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Allen Institute for Brain Science and Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __TEMPLATELIBRARY_H__
+#define __TEMPLATELIBRARY_H__
+
+#include <DataThreadHeaders.h>
+
+#include "WaveformCache.h"
+
+/* Sample rate of the recordings templates come from (Neuropixels AP band) */
+#define TEMPLATE_SAMPLE_RATE 30000.0f
+
+/**
+
+	Read-only library of recorded spike templates stored as a NumPy .npy array
+	(e.g. templates.npy of a sorted dataset): little-endian float32, C order, shape
+	(templates, samples, electrodes).
+
+	The file is memory-mapped rather than read, so opening a library of thousands of
+	templates only parses the short header. A probe draws its subset with getSubset(),
+	which transposes the chosen templates once into [template][electrode][sample] (each
+	electrode's waveform contiguous, as spike rendering reads it) and stores the result
+	in the WaveformCache, so later runs with the same library and selection map it
+	straight from disk.
+
+*/
+
+class TemplateLibrary
+{
+public:
+
+	TemplateLibrary(const File& file);
+	~TemplateLibrary();
+
+	/** False if the file could not be mapped or is not a supported .npy array; see getError().*/
+	bool isValid() const { return data != nullptr; }
+	const String& getError() const { return error; }
+
+	const File& getFile() const { return file; }
+
+	int getNumTemplates() const { return numTemplates; }
+	int getNumSamples() const { return numSamples; }
+	int getNumElectrodes() const { return numElectrodes; }
+
+	/** Returns count templates (all if count <= 0 or larger than the library) chosen without
+	    repetition from seed, transposed to [template][electrode][sample]: a block of
+	    count * getNumElectrodes() rows of getNumSamples() floats.*/
+	WaveformCache::Block::Ptr getSubset(WaveformCache& cache, int count, uint32 seed) const;
+
+	/** Parses an .npy header; returns the offset of the array data, or 0 if unsupported.*/
+	static size_t parseHeader(const char* bytes, size_t size, int shape[3], String& error);
+
+private:
+
+	/* Indices of count distinct templates drawn from seed (partial Fisher-Yates) */
+	Array<int> selectTemplates(int count, uint32 seed) const;
+
+	File file;
+	String error;
+
+	ScopedPointer<MemoryMappedFile> mappedFile;
+	const float* data;
+
+	int numTemplates;
+	int numSamples;
+	int numElectrodes;
+
+	JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(TemplateLibrary);
+
+};
+
+#endif  // __TEMPLATELIBRARY_H__
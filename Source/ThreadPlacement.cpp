@@ -0,0 +1,232 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Allen Institute for Brain Science and Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "ThreadPlacement.h"
+
+#ifdef WIN32
+#include <Windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+ThreadPlacement::ThreadPlacement() :
+    cpu(-1),
+    node(-1),
+    priority(NORMAL_PRIORITY),
+    level(0),
+    nodeLocal(false)
+{
+}
+
+String ThreadPlacement::toString() const
+{
+
+    String text = cpu >= 0 ? "cpu " + String(cpu) : String("unpinned");
+
+    if (node >= 0)
+        text += " (node " + String(node) + ")";
+
+#ifdef WIN32
+    const String realtimeName = "time-critical priority";
+    const String raisedName = "priority";
+#else
+    const String realtimeName = "SCHED_FIFO";
+    const String raisedName = "nice";
+#endif
+
+    if (priority == REALTIME_PRIORITY)
+        text += ", " + realtimeName + " " + String(level);
+    else if (priority == RAISED_PRIORITY)
+        text += ", " + raisedName + " " + String(level);
+    else
+        text += ", normal priority";
+
+    if (nodeLocal)
+        text += ", node-local packet buffers";
+
+    return text;
+
+}
+
+#ifdef WIN32
+
+ThreadPlacement ThreadPlacement::applyToCurrentThread(int cpu, bool realtime)
+{
+
+    ThreadPlacement placement;
+    HANDLE thread = GetCurrentThread();
+
+    //Affinity masks only reach the first 64 CPUs (processor group 0)
+    if (cpu >= 0 && cpu < 64 && SetThreadAffinityMask(thread, (DWORD_PTR) 1 << cpu) != 0)
+    {
+        placement.cpu = cpu;
+        placement.node = getNodeOfCpu(cpu);
+    }
+
+    if (realtime)
+    {
+        if (SetThreadPriority(thread, THREAD_PRIORITY_TIME_CRITICAL))
+        {
+            placement.priority = REALTIME_PRIORITY;
+            placement.level = THREAD_PRIORITY_TIME_CRITICAL;
+        }
+        else if (SetThreadPriority(thread, THREAD_PRIORITY_HIGHEST))
+        {
+            placement.priority = RAISED_PRIORITY;
+            placement.level = THREAD_PRIORITY_HIGHEST;
+        }
+    }
+
+    return placement;
+
+}
+
+int ThreadPlacement::getNodeOfCpu(int cpu)
+{
+
+    UCHAR node = 0;
+
+    if (cpu < 0 || cpu > 255 || !GetNumaProcessorNode((UCHAR) cpu, &node) || node == 0xFF)
+        return -1;
+
+    return node;
+
+}
+
+#else
+
+ThreadPlacement ThreadPlacement::applyToCurrentThread(int cpu, bool realtime)
+{
+
+    ThreadPlacement placement;
+
+#ifdef __linux__
+    if (cpu >= 0 && cpu < CPU_SETSIZE)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+
+        //Fails for CPUs outside the process's cpuset; the thread then stays unpinned
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0)
+        {
+            placement.cpu = cpu;
+            placement.node = getNodeOfCpu(cpu);
+        }
+    }
+#endif
+
+    if (!realtime)
+        return placement;
+
+    sched_param param;
+    param.sched_priority = jmin(REALTIME_FIFO_PRIORITY, sched_get_priority_max(SCHED_FIFO));
+
+    if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0)
+    {
+        placement.priority = REALTIME_PRIORITY;
+        placement.level = param.sched_priority;
+        return placement;
+    }
+
+#ifdef __linux__
+    //Without CAP_SYS_NICE or an RLIMIT_RTPRIO allowance: the lowest nice value RLIMIT_NICE permits
+    const pid_t tid = (pid_t) syscall(SYS_gettid);
+
+    for (int nice = -10; nice < 0; nice++)
+    {
+        if (setpriority(PRIO_PROCESS, (id_t) tid, nice) == 0)
+        {
+            placement.priority = RAISED_PRIORITY;
+            placement.level = nice;
+            break;
+        }
+    }
+#endif
+
+    return placement;
+
+}
+
+int ThreadPlacement::getNodeOfCpu(int cpu)
+{
+
+#ifdef __linux__
+    //The kernel links each CPU to its node: /sys/devices/system/cpu/cpuN/nodeM
+    Array<File> nodes;
+    File("/sys/devices/system/cpu/cpu" + String(cpu)).findChildFiles(nodes, File::findDirectories, false, "node*");
+
+    for (auto& node : nodes)
+    {
+        const String index = node.getFileName().substring(4);
+
+        if (index.containsOnly("0123456789") && index.isNotEmpty())
+            return index.getIntValue();
+    }
+#endif
+
+    return -1;
+
+}
+
+#endif
+
+bool ThreadPlacement::parseCpuList(const String& text, Array<int>& cpus)
+{
+
+    cpus.clear();
+
+    StringArray ranges;
+    ranges.addTokens(text, ",", "");
+    ranges.trim();
+    ranges.removeEmptyStrings();
+
+    for (auto& range : ranges)
+    {
+        const String first = range.upToFirstOccurrenceOf("-", false, false).trim();
+        const String last = range.contains("-") ? range.fromFirstOccurrenceOf("-", false, false).trim() : first;
+
+        if (!first.containsOnly("0123456789") || !last.containsOnly("0123456789") || first.isEmpty() || last.isEmpty())
+            return false;
+
+        const int begin = first.getIntValue();
+        const int end = last.getIntValue();
+
+        //CPU ids may exceed the CPU count under a restricted cpuset; CPUs the thread cannot use leave it unpinned
+        if (end < begin || end >= MAX_PLACEMENT_CPUS)
+            return false;
+
+        for (int cpu = begin; cpu <= end; cpu++)
+            cpus.addIfNotAlreadyThere(cpu);
+    }
+
+    return true;
+
+}
@@ -0,0 +1,84 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Allen Institute for Brain Science and Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __THREADPLACEMENT_H__
+#define __THREADPLACEMENT_H__
+
+#include <DataThreadHeaders.h>
+
+/* SCHED_FIFO priority requested for generation threads: above ordinary and GUI threads,
+   below the kernel's own real-time threads */
+#define REALTIME_FIFO_PRIORITY 50
+
+/* Highest CPU id accepted in a CPU list */
+#define MAX_PLACEMENT_CPUS 1024
+
+/* Where the generation threads run (see SourceThread::setPlacement) */
+struct PlacementSettings
+{
+	String cpus; //CPU list ("2-9,12") the threads are pinned to in turn, empty leaves them unpinned
+	bool realtime; //SCHED_FIFO (Windows: time-critical), else the highest priority permitted
+	bool nodeLocal; //allocate each source's packet buffers from its own pinned thread
+};
+
+/**
+
+	Placement of one thread: the CPU it is pinned to, that CPU's NUMA node and the
+	scheduling it obtained.
+
+	applyToCurrentThread() never fails outright: a request the OS refuses (no permission
+	for SCHED_FIFO, a CPU outside the process's allowed set) falls back to the next best
+	option and the result records what actually took effect. Pinning and NUMA nodes are
+	supported on Linux and Windows; other platforms only raise the priority.
+
+*/
+
+class ThreadPlacement
+{
+public:
+
+	enum Priority { NORMAL_PRIORITY = 0, RAISED_PRIORITY, REALTIME_PRIORITY };
+
+	ThreadPlacement();
+
+	int cpu; //-1 if unpinned
+	int node; //-1 if unknown
+	Priority priority;
+	int level; //SCHED_FIFO priority, nice value or Windows priority level
+	bool nodeLocal; //packet buffers were allocated after pinning
+
+	/** One-line description for the source info.*/
+	String toString() const;
+
+	/** Pins the calling thread to cpu (if >= 0) and, with realtime, raises its priority.*/
+	static ThreadPlacement applyToCurrentThread(int cpu, bool realtime);
+
+	/** Parses a CPU list such as "0-3,8"; false on syntax errors.*/
+	static bool parseCpuList(const String& text, Array<int>& cpus);
+
+	/** NUMA node of a CPU, -1 if unknown.*/
+	static int getNodeOfCpu(int cpu);
+
+};
+
+#endif  // __THREADPLACEMENT_H__
@@ -0,0 +1,259 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Allen Institute for Brain Science and Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "TraceCapture.h"
+#include <chrono>
+#include <vector>
+
+/* Written only by the thread that owns it; dump() reads it concurrently and drops whatever
+   was overwritten while it copied */
+struct TraceCapture::Ring
+{
+    Ring(const String& name_, int id_) :
+        events(TRACE_EVENTS_PER_THREAD),
+        head(0),
+        first(0),
+        owned(true),
+        name(name_),
+        id(id_)
+    {
+    }
+
+    std::vector<Event> events;
+
+    /* Events ever recorded, and the first that belongs to the current name */
+    std::atomic<uint64> head;
+    std::atomic<uint64> first;
+
+    std::atomic<bool> owned;
+
+    /* Changed under registryLock only */
+    String name;
+    int id;
+};
+
+struct TraceCapture::Track
+{
+    Track() : ring(nullptr), claimed(false) {}
+
+    ~Track()
+    {
+        if (ring != nullptr)
+            ring->owned.store(false, std::memory_order_release);
+    }
+
+    String name;
+    Ring* ring;
+    bool claimed;
+};
+
+std::atomic<bool> TraceCapture::enabled(false);
+std::atomic<int64> TraceCapture::captureStart(0);
+thread_local TraceCapture::Track TraceCapture::track;
+
+CriticalSection TraceCapture::registryLock;
+OwnedArray<TraceCapture::Ring>* TraceCapture::registry = nullptr;
+
+void TraceCapture::setEnabled(bool enable)
+{
+    if (enable)
+        captureStart = now();
+
+    enabled = enable;
+}
+
+void TraceCapture::setThreadName(const String& name)
+{
+
+    if (track.name == name)
+        return;
+
+    track.name = name;
+
+    //Claim the ring of the new name at the next event
+    if (track.ring != nullptr)
+        track.ring->owned.store(false, std::memory_order_release);
+
+    track.ring = nullptr;
+    track.claimed = false;
+
+}
+
+int64 TraceCapture::now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void TraceCapture::span(const char* name, int64 start, int64 end, int64 sample)
+{
+    record(name, start, end - start, sample);
+}
+
+void TraceCapture::instant(const char* name, int64 sample)
+{
+    if (isEnabled())
+        record(name, now(), -1, sample);
+}
+
+void TraceCapture::record(const char* name, int64 start, int64 duration, int64 sample)
+{
+
+    Ring* ring = getRing();
+
+    if (ring == nullptr)
+        return;
+
+    const uint64 head = ring->head.load(std::memory_order_relaxed);
+
+    Event& event = ring->events[head % TRACE_EVENTS_PER_THREAD];
+    event.name = name;
+    event.start = start;
+    event.duration = duration;
+    event.sample = sample;
+
+    ring->head.store(head + 1, std::memory_order_release);
+
+}
+
+TraceCapture::Ring* TraceCapture::getRing()
+{
+
+    if (track.ring != nullptr || track.claimed)
+        return track.ring;
+
+    //Once per thread (and name): a failed claim is not retried
+    track.claimed = true;
+
+    const ScopedLock lock(registryLock);
+
+    if (registry == nullptr)
+        registry = new OwnedArray<Ring>();
+
+    const String name = track.name.isNotEmpty() ? track.name : "Thread " + String(registry->size() + 1);
+    Ring* reusable = nullptr;
+
+    for (auto ring : *registry)
+    {
+        if (ring->owned.load(std::memory_order_acquire))
+            continue;
+
+        //A restarted thread continues its own track
+        if (ring->name == name)
+        {
+            ring->owned = true;
+            return track.ring = ring;
+        }
+
+        if (reusable == nullptr)
+            reusable = ring;
+    }
+
+    if (registry->size() < MAX_TRACE_THREADS)
+    {
+        registry->add(new Ring(name, registry->size() + 1));
+        return track.ring = registry->getLast();
+    }
+
+    //Out of rings: take over the track of a thread that has ended
+    if (reusable != nullptr)
+    {
+        reusable->owned = true;
+        reusable->name = name;
+        reusable->first = reusable->head.load();
+    }
+
+    return track.ring = reusable;
+
+}
+
+int64 TraceCapture::dump(const File& file)
+{
+
+    file.deleteFile();
+
+    FileOutputStream out(file);
+
+    if (out.failedToOpen())
+        return -1;
+
+    const int64 origin = captureStart;
+
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+    out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"Source Sim\"}}";
+
+    const ScopedLock lock(registryLock);
+
+    const int numRings = registry != nullptr ? registry->size() : 0;
+    std::vector<Event> events;
+    int64 written = 0;
+
+    for (int i = 0; i < numRings; i++)
+    {
+        Ring* ring = (*registry)[i];
+        const String tid = String(ring->id);
+
+        out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << tid
+            << ",\"args\":{\"name\":" << JSON::toString(var(ring->name)) << "}}";
+
+        //Copy the live part of the ring, then keep what the owner did not overwrite meanwhile
+        const uint64 head = ring->head.load(std::memory_order_acquire);
+        const uint64 first = jmax(ring->first.load(), head > TRACE_EVENTS_PER_THREAD ? head - TRACE_EVENTS_PER_THREAD : (uint64) 0);
+
+        events.resize((size_t)(head - first));
+
+        for (uint64 n = first; n < head; n++)
+            events[(size_t)(n - first)] = ring->events[n % TRACE_EVENTS_PER_THREAD];
+
+        //The slot of the next event may be half written, so one more is dropped
+        const uint64 after = ring->head.load(std::memory_order_acquire);
+        const uint64 valid = after + 1 > TRACE_EVENTS_PER_THREAD ? after + 1 - TRACE_EVENTS_PER_THREAD : 0;
+
+        for (uint64 n = jmax(first, valid); n < head; n++)
+        {
+            const Event& event = events[(size_t)(n - first)];
+
+            if (event.start < origin)
+                continue;
+
+            out << ",\n{\"name\":\"" << event.name << "\",\"pid\":1,\"tid\":" << tid
+                << ",\"ts\":" << String((event.start - origin) / 1000.0, 3);
+
+            if (event.duration >= 0)
+                out << ",\"ph\":\"X\",\"dur\":" << String(event.duration / 1000.0, 3);
+            else
+                out << ",\"ph\":\"i\",\"s\":\"t\"";
+
+            if (event.sample >= 0)
+                out << ",\"args\":{\"sample\":" << String(event.sample) << "}";
+
+            out << "}";
+            written++;
+        }
+    }
+
+    out << "\n]}\n";
+    out.flush();
+
+    return out.getStatus().wasOk() ? written : -1;
+
+}
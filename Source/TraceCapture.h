@@ -0,0 +1,124 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Allen Institute for Brain Science and Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __TRACECAPTURE_H__
+#define __TRACECAPTURE_H__
+
+#include <DataThreadHeaders.h>
+#include <atomic>
+
+/* Events kept per thread; the oldest are overwritten */
+#define TRACE_EVENTS_PER_THREAD 32768
+
+/* Threads that can be traced; further threads record nothing */
+#define MAX_TRACE_THREADS 256
+
+/**
+
+	Timeline capture of the generation threads, dumped as a Chrome / Perfetto trace (JSON).
+
+	Each thread records into a ring of its own, so recording takes no lock and never waits:
+	it costs two clock reads and a few stores. While capture is off, a trace scope is a
+	single relaxed load. Rings are kept per thread name, so a restarted thread continues
+	on its own track.
+
+	Event names must be string literals. The argument of an event is a sample number (-1 for none).
+
+*/
+
+class TraceCapture
+{
+public:
+
+	/** Starts capturing (events recorded before are no longer dumped) or stops.*/
+	static void setEnabled(bool enable);
+
+	static bool isEnabled() { return enabled.load(std::memory_order_relaxed); }
+
+	/** Names the calling thread's track; call when the thread starts.*/
+	static void setThreadName(const String& name);
+
+	/** Current time on the trace clock, in nanoseconds.*/
+	static int64 now();
+
+	/** Records a span from start to end (trace clock) on the calling thread.*/
+	static void span(const char* name, int64 start, int64 end, int64 sample = -1);
+
+	/** Records an instant event at the current time on the calling thread.*/
+	static void instant(const char* name, int64 sample = -1);
+
+	/** Writes every event captured since capture last started. Returns the number of events written,
+	    -1 on I/O errors.*/
+	static int64 dump(const File& file);
+
+	/* Records its own lifetime as a span; see TRACE_SCOPE */
+	class Scope
+	{
+	public:
+		Scope(const char* name_, int64 sample_ = -1) : name(name_), sample(sample_), start(isEnabled() ? now() : -1) {}
+		~Scope() { if (start >= 0) span(name, start, now(), sample); }
+
+	private:
+		const char* name;
+		int64 sample;
+		int64 start;
+	};
+
+private:
+
+	struct Event
+	{
+		const char* name;
+		int64 start;
+		int64 duration; //-1 for instants
+		int64 sample;
+	};
+
+	struct Ring;
+
+	/* Name and ring of a thread; releases the ring when the thread ends */
+	struct Track;
+	static thread_local Track track;
+
+	/* Ring of the calling thread, claimed on first use; null if every ring is taken */
+	static Ring* getRing();
+
+	static void record(const char* name, int64 start, int64 duration, int64 sample);
+
+	static std::atomic<bool> enabled;
+	static std::atomic<int64> captureStart;
+
+	/* Every ring ever claimed; rings live as long as the process */
+	static CriticalSection registryLock;
+	static OwnedArray<Ring>* registry;
+
+};
+
+#define TRACE_JOIN_(a, b) a##b
+#define TRACE_JOIN(a, b) TRACE_JOIN_(a, b)
+
+/* Traces the rest of the enclosing block */
+#define TRACE_SCOPE(name) TraceCapture::Scope TRACE_JOIN(traceScope, __LINE__)(name)
+#define TRACE_SCOPE_SAMPLE(name, sample) TraceCapture::Scope TRACE_JOIN(traceScope, __LINE__)(name, sample)
+
+#endif  // __TRACECAPTURE_H__
@@ -0,0 +1,175 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Allen Institute for Brain Science and Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __TTLCLOCK_H__
+#define __TTLCLOCK_H__
+
+#include <cstdint>
+#include <cmath>
+
+/**
+
+	50% duty cycle TTL clock evaluated in the sample domain.
+
+	Edge k (k >= 1) falls at origin + k * period / 2 seconds, optionally displaced by a
+	bounded, deterministic jitter derived from the frequency tolerance. Edge positions
+	depend only on the sample index, never on wall-clock time, so they are identical
+	whatever speed the simulation runs at and line up across sources of different rates.
+
+*/
+
+class TtlClock
+{
+public:
+
+	TtlClock() : sampleRate(1.0), halfPeriod(0.0), jitter(0.0), originSample(0), originLevel(0) {}
+
+	/* Restarts the clock at originSample with the given level; frequency <= 0 holds the level */
+	void configure(double rate, double frequency, double tolerance, int64_t origin, int level)
+	{
+		sampleRate = rate;
+		halfPeriod = frequency > 0.0 ? 0.5 / frequency : 0.0;
+
+		//Tolerance is in Hz; keep jitter below a quarter period so edges never reorder
+		jitter = frequency > 0.0 ? std::fmin(halfPeriod * tolerance / frequency, halfPeriod / 4.0) : 0.0;
+
+		originSample = origin;
+		originLevel = level & 1;
+	}
+
+	/* Absolute sample index of edge k (k >= 1) */
+	int64_t getEdgeSample(int64_t k) const
+	{
+		double t = (double)k * halfPeriod;
+
+		if (jitter > 0.0)
+			t += jitter * (2.0 * unitRandom((uint64_t)k) - 1.0);
+
+		return originSample + (int64_t)std::llround(t * sampleRate);
+	}
+
+	/* Level of the clock at an absolute sample index */
+	int getLevel(int64_t sample) const
+	{
+		if (halfPeriod <= 0.0 || sample < originSample)
+			return originLevel;
+
+		const int64_t k = getEdgesUpTo(sample);
+		return originLevel ^ (int)(k & 1);
+	}
+
+	/**
+		Writes the clock level of samples [first, first + count) into codes and returns the
+		sample index of the last rising edge in that range (or -1 if there was none).
+	*/
+	template <typename CodeType>
+	int64_t fill(CodeType* codes, int64_t first, int count, int64_t* lastFallingEdge = nullptr) const
+	{
+		int64_t lastRising = -1;
+
+		if (halfPeriod <= 0.0)
+		{
+			for (int i = 0; i < count; i++)
+				codes[i] = (CodeType)originLevel;
+			return lastRising;
+		}
+
+		int64_t k = first < originSample ? 0 : getEdgesUpTo(first);
+		int level = originLevel ^ (int)(k & 1);
+		int64_t next = getEdgeSample(k + 1);
+
+		for (int i = 0; i < count; i++)
+		{
+			const int64_t n = first + i;
+
+			while (n >= next)
+			{
+				k++;
+				level ^= 1;
+
+				if (level)
+					lastRising = next;
+				else if (lastFallingEdge != nullptr)
+					*lastFallingEdge = next;
+
+				next = getEdgeSample(k + 1);
+			}
+
+			codes[i] = (CodeType)level;
+		}
+
+		return lastRising;
+	}
+
+	/* Calls visit(sample) for every rising edge in [first, first + count), in order, stepping from
+	   edge to edge rather than over the samples in between */
+	template <typename Visitor>
+	void forEachRisingEdge(int64_t first, int count, Visitor visit) const
+	{
+		if (halfPeriod <= 0.0 || count <= 0)
+			return;
+
+		int64_t k = first <= originSample ? 0 : getEdgesUpTo(first - 1);
+
+		for (int64_t next = getEdgeSample(k + 1); next < first + count; next = getEdgeSample(++k + 1))
+		{
+			//Edge k + 1 sets the level to originLevel ^ ((k + 1) & 1)
+			if (next >= first && (originLevel ^ (int)((k + 1) & 1)) != 0)
+				visit(next);
+		}
+	}
+
+private:
+
+	/* Number of edges at or before sample (sample >= originSample) */
+	int64_t getEdgesUpTo(int64_t sample) const
+	{
+		int64_t k = (int64_t)std::floor((double)(sample - originSample) / (halfPeriod * sampleRate));
+
+		//Jitter can move the neighbouring edges across the nominal boundary
+		while (k > 0 && getEdgeSample(k) > sample)
+			k--;
+		while (getEdgeSample(k + 1) <= sample)
+			k++;
+
+		return k;
+	}
+
+	static double unitRandom(uint64_t k)
+	{
+		uint64_t z = k * 0x9E3779B97F4A7C15ULL;
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		z ^= z >> 31;
+		return (double)(z >> 11) / 9007199254740992.0;
+	}
+
+	double sampleRate;
+	double halfPeriod;
+	double jitter;
+	int64_t originSample;
+	int originLevel;
+
+};
+
+#endif  // __TTLCLOCK_H__
@@ -0,0 +1,235 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Allen Institute for Brain Science and Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "WaveformCache.h"
+
+#define CACHE_FORMAT_VERSION 1
+#define CACHE_HEADER_SIZE 64
+#define CACHE_ALIGNMENT 64
+
+/* Fixed-size header preceding the samples; padded so the data stays 64-byte aligned */
+struct CacheFileHeader
+{
+    char magic[8];
+    int32 version;
+    int32 headerSize;
+    int64 key;
+    int32 numSamples;
+    int32 numChannels;
+    char reserved[CACHE_HEADER_SIZE - 32];
+};
+
+static_assert(sizeof(CacheFileHeader) == CACHE_HEADER_SIZE, "Cache header must be 64 bytes");
+
+static const char cacheMagic[8] = { 'O', 'E', 'S', 'I', 'M', 'W', 'F', 'C' };
+
+WaveformCache::Block::Block(int64 key_, int numSamples_, int numChannels_) :
+    key(key_),
+    numSamples(numSamples_),
+    numChannels(numChannels_),
+    samples(nullptr)
+{
+}
+
+WaveformCache::WaveformCache(File directory_) : directory(directory_)
+{
+    directory.createDirectory();
+}
+
+WaveformCache::~WaveformCache()
+{
+}
+
+File WaveformCache::getDefaultDirectory()
+{
+    return File::getSpecialLocation(File::tempDirectory).getChildFile("SourceSimCache");
+}
+
+int64 WaveformCache::getKey(const String& description)
+{
+    return (description + "|v" + String(CACHE_FORMAT_VERSION)).hashCode64();
+}
+
+File WaveformCache::getFileForKey(int64 key) const
+{
+    return directory.getChildFile(String::toHexString(key) + ".wfc");
+}
+
+WaveformCache::Block::Ptr WaveformCache::getBlock(const String& description, int numSamples, int numChannels, RenderFunction render)
+{
+    const int64 key = getKey(description);
+
+    const ScopedLock sl(lock);
+
+    //Already mapped this session (e.g. several probes with the same configuration)
+    for (int i = 0; i < blocks.size(); i++)
+    {
+        Block* block = blocks[i];
+        if (block->key == key && block->numSamples == numSamples && block->numChannels == numChannels)
+            return block;
+    }
+
+    Block::Ptr block = new Block(key, numSamples, numChannels);
+
+    if (!mapFromDisk(block))
+    {
+        //Render once into an aligned scratch block, persist it and map the persisted copy
+        const size_t numBytes = (size_t) numSamples * numChannels * sizeof(float);
+        block->fallback.calloc(numBytes + CACHE_ALIGNMENT);
+
+        char* aligned = block->fallback.getData();
+        aligned += (CACHE_ALIGNMENT - ((pointer_sized_int) aligned % CACHE_ALIGNMENT)) % CACHE_ALIGNMENT;
+        float* data = reinterpret_cast<float*>(aligned);
+
+        render(data, numSamples, numChannels);
+
+        if (writeToDisk(block, data) && mapFromDisk(block))
+            block->fallback.free();
+        else
+            block->samples = data;
+    }
+
+    blocks.add(block);
+
+    return block;
+}
+
+bool WaveformCache::mapFromDisk(Block* block)
+{
+    File file = getFileForKey(block->key);
+
+    if (!file.existsAsFile())
+        return false;
+
+    const int64 expectedSize = CACHE_HEADER_SIZE + (int64) block->numSamples * block->numChannels * sizeof(float);
+
+    if (file.getSize() != expectedSize)
+    {
+        file.deleteFile();
+        return false;
+    }
+
+    ScopedPointer<MemoryMappedFile> map = new MemoryMappedFile(file, MemoryMappedFile::readOnly);
+
+    if (map->getData() == nullptr || (int64) map->getSize() != expectedSize)
+        return false;
+
+    const CacheFileHeader* header = static_cast<const CacheFileHeader*>(map->getData());
+
+    if (memcmp(header->magic, cacheMagic, sizeof(cacheMagic)) != 0
+        || header->version != CACHE_FORMAT_VERSION
+        || header->key != block->key
+        || header->numSamples != block->numSamples
+        || header->numChannels != block->numChannels)
+    {
+        map = nullptr;
+        file.deleteFile();
+        return false;
+    }
+
+    block->samples = reinterpret_cast<const float*>(static_cast<const char*>(map->getData()) + CACHE_HEADER_SIZE);
+    block->mappedFile = map.release();
+
+    file.setLastAccessTime(Time::getCurrentTime());
+
+    return true;
+}
+
+bool WaveformCache::writeToDisk(const Block* block, const float* data)
+{
+    if (!directory.isDirectory() && directory.createDirectory().failed())
+        return false;
+
+    File target = getFileForKey(block->key);
+    File temp = target.getNonexistentSibling();
+
+    CacheFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+    header.version = CACHE_FORMAT_VERSION;
+    header.headerSize = CACHE_HEADER_SIZE;
+    header.key = block->key;
+    header.numSamples = block->numSamples;
+    header.numChannels = block->numChannels;
+
+    {
+        FileOutputStream out(temp, 1 << 20);
+
+        if (!out.openedOk())
+            return false;
+
+        bool ok = out.write(&header, sizeof(header))
+            && out.write(data, (size_t) block->numSamples * block->numChannels * sizeof(float));
+        out.flush();
+
+        if (!ok)
+        {
+            temp.deleteFile();
+            return false;
+        }
+    }
+
+    //Rename so a concurrent reader never maps a half-written block
+    return temp.moveFileTo(target);
+}
+
+void WaveformCache::releaseUnused(int64 maxBytes)
+{
+    const ScopedLock sl(lock);
+
+    for (int i = blocks.size(); --i >= 0;)
+    {
+        if (blocks[i]->getReferenceCount() == 1)
+            blocks.remove(i);
+    }
+
+    Array<File> files;
+    directory.findChildFiles(files, File::findFiles, false, "*.wfc");
+
+    int64 totalBytes = 0;
+    for (auto& file : files)
+        totalBytes += file.getSize();
+
+    //Evict least recently used blocks that are not currently mapped
+    while (totalBytes > maxBytes && files.size() > 0)
+    {
+        int oldest = -1;
+
+        for (int i = 0; i < files.size(); i++)
+        {
+            bool inUse = false;
+            for (int j = 0; j < blocks.size(); j++)
+                inUse |= (files[i] == getFileForKey(blocks[j]->key));
+
+            if (!inUse && (oldest < 0 || files[i].getLastAccessTime() < files[oldest].getLastAccessTime()))
+                oldest = i;
+        }
+
+        if (oldest < 0)
+            break;
+
+        totalBytes -= files[oldest].getSize();
+        files[oldest].deleteFile();
+        files.remove(oldest);
+    }
+}
@@ -0,0 +1,107 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Allen Institute for Brain Science and Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __WAVEFORMCACHE_H__
+#define __WAVEFORMCACHE_H__
+
+#include <DataThreadHeaders.h>
+
+#include <functional>
+
+/**
+
+	Persistent store of pre-rendered sample blocks (periodic loops, noise blocks, templates).
+
+	Each block is an interleaved [sample][channel] float array keyed by a 64-bit hash of
+	the description of whatever generated it (source type, dimensions, seed...). Blocks
+	are written once to disk and memory-mapped on every later request, so identical
+	configurations share one mapping within a session and skip rendering across sessions.
+	Changing the configuration changes the key, so stale blocks are never reused.
+
+*/
+
+class WaveformCache
+{
+public:
+
+	class Block : public ReferenceCountedObject
+	{
+	public:
+
+		typedef ReferenceCountedObjectPtr<Block> Ptr;
+
+		Block(int64 key, int numSamples, int numChannels);
+
+		/** Returns the first sample of the (64-byte aligned) interleaved block.*/
+		const float* getSamples() const { return samples; }
+
+		const int64 key;
+		const int numSamples;
+		const int numChannels;
+
+	private:
+
+		friend class WaveformCache;
+
+		const float* samples;
+
+		ScopedPointer<MemoryMappedFile> mappedFile;
+		HeapBlock<char> fallback;
+
+		JUCE_DECLARE_NON_COPYABLE(Block);
+	};
+
+	typedef std::function<void(float* dest, int numSamples, int numChannels)> RenderFunction;
+
+	WaveformCache(File directory = getDefaultDirectory());
+	~WaveformCache();
+
+	/** Returns the block matching description, rendering and storing it first if needed.*/
+	Block::Ptr getBlock(const String& description, int numSamples, int numChannels, RenderFunction render);
+
+	/** Drops in-memory blocks no source refers to and trims the directory to maxBytes.*/
+	void releaseUnused(int64 maxBytes = DEFAULT_MAX_BYTES);
+
+	static int64 getKey(const String& description);
+
+	static File getDefaultDirectory();
+
+	static const int64 DEFAULT_MAX_BYTES = 1024LL * 1024LL * 1024LL;
+
+private:
+
+	bool mapFromDisk(Block* block);
+	bool writeToDisk(const Block* block, const float* data);
+
+	File getFileForKey(int64 key) const;
+
+	File directory;
+
+	ReferenceCountedArray<Block> blocks;
+	CriticalSection lock;
+
+	JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(WaveformCache);
+
+};
+
+#endif  // __WAVEFORMCACHE_H__
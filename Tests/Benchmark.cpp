@@ -0,0 +1,319 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Allen Institute for Brain Science and Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "TestSources.h"
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+using namespace SourceSimTests;
+
+/* Packet size of the simulator's sources (DEFAULT_PACKET_SIZE) */
+#define BENCHMARK_PACKET_SIZE 500
+
+/* Each trial renders for at least this long; the best of the trials is kept */
+#define BENCHMARK_TRIAL_SECONDS 0.3
+#define BENCHMARK_TRIALS 3
+
+/* Channel-samples per second one thread generates for a source type, best of the trials */
+static double measureThroughput(int type)
+{
+	TestSource source(type, type == AI_SOURCE ? 8 : 384);
+
+	std::vector<float> packet((size_t)BENCHMARK_PACKET_SIZE * source.numChannels);
+	int64_t first = 0;
+	double best = 0.0;
+
+	for (int trial = 0; trial < BENCHMARK_TRIALS; trial++)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		int64_t samples = 0;
+		double seconds = 0.0;
+
+		while (seconds < BENCHMARK_TRIAL_SECONDS)
+		{
+			for (int i = 0; i < 10; i++)
+			{
+				source.render(packet.data(), BENCHMARK_PACKET_SIZE, first);
+				first += BENCHMARK_PACKET_SIZE;
+				samples += BENCHMARK_PACKET_SIZE;
+			}
+
+			seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		}
+
+		best = std::max(best, (double)samples * source.numChannels / seconds);
+	}
+
+	return best;
+}
+
+/* Channel-samples per second of a fixed kernel on the same packets: the waveform copied and scaled
+   into a 384-channel packet. Baselines are stored relative to it, so they carry over between
+   machines of a similar kind far better than absolute rates */
+static double measureReference()
+{
+	const int numChannels = 384;
+	const int period = 3000;
+
+	std::vector<float> waveform((size_t)period * numChannels);
+	std::vector<float> packet((size_t)BENCHMARK_PACKET_SIZE * numChannels);
+
+	for (size_t i = 0; i < waveform.size(); i++)
+		waveform[i] = (float)(i % 1021) - 510.0f;
+
+	volatile float sink = 0.0f;
+	int64_t first = 0;
+	double best = 0.0;
+
+	for (int trial = 0; trial < BENCHMARK_TRIALS; trial++)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		int64_t samples = 0;
+		double seconds = 0.0;
+
+		while (seconds < BENCHMARK_TRIAL_SECONDS)
+		{
+			for (int i = 0; i < 10; i++)
+			{
+				for (int s = 0; s < BENCHMARK_PACKET_SIZE; s++)
+				{
+					const float* from = waveform.data() + (size_t)((first + s) % period) * numChannels;
+					float* to = packet.data() + (size_t)s * numChannels;
+
+					for (int c = 0; c < numChannels; c++)
+						to[c] = from[c] * 0.5f + 1.0f;
+				}
+
+				sink = sink + packet[(size_t)(first % packet.size())];
+				first += BENCHMARK_PACKET_SIZE;
+				samples += BENCHMARK_PACKET_SIZE;
+			}
+
+			seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		}
+
+		best = std::max(best, (double)samples * numChannels / seconds);
+	}
+
+	return best;
+}
+
+/* The common average reference as a single-accumulator reduction, for comparison with ReferenceStage */
+static void subtractAverageScalar(float* data, int numChannels, int numSamples)
+{
+	const float scale = 1.0f / (float)numChannels;
+
+	for (int s = 0; s < numSamples; s++)
+	{
+		float* row = data + (size_t)s * numChannels;
+		float sum = 0.0f;
+
+		for (int c = 0; c < numChannels; c++)
+			sum += row[c];
+
+		const float mean = sum * scale;
+
+		for (int c = 0; c < numChannels; c++)
+			row[c] -= mean;
+	}
+}
+
+/* Channel-samples per second of the common average reference over packets of a 384-channel
+   stream, with ReferenceStage or with the single-accumulator loop, best of the trials */
+static double measureCommonAverage(bool scalar)
+{
+	const int numChannels = 384;
+
+	SourceSimPipeline::StageContext context = SourceSimPipeline::StageContext();
+	context.numChannels = numChannels;
+	context.numElectrodes = numChannels;
+
+	SourceSimPipeline::ReferenceStage stage;
+	stage.prepare(context);
+	stage.setReference(SourceSimPipeline::ReferenceStage::AVERAGE, 0);
+
+	std::vector<float> packet((size_t)BENCHMARK_PACKET_SIZE * numChannels);
+
+	for (size_t i = 0; i < packet.size(); i++)
+		packet[i] = (float)(i % 1021) - 510.0f;
+
+	SourceSimPipeline::Tile tile;
+	tile.data = packet.data();
+	tile.stride = numChannels;
+	tile.firstChannel = 0;
+	tile.numChannels = numChannels;
+	tile.firstSample = 0;
+	tile.numSamples = BENCHMARK_PACKET_SIZE;
+
+	double best = 0.0;
+
+	for (int trial = 0; trial < BENCHMARK_TRIALS; trial++)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		int64_t samples = 0;
+		double seconds = 0.0;
+
+		while (seconds < BENCHMARK_TRIAL_SECONDS)
+		{
+			for (int i = 0; i < 100; i++)
+			{
+				if (scalar)
+					subtractAverageScalar(packet.data(), numChannels, BENCHMARK_PACKET_SIZE);
+				else
+					stage.process(tile);
+
+				samples += BENCHMARK_PACKET_SIZE;
+			}
+
+			seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		}
+
+		best = std::max(best, (double)samples * numChannels / seconds);
+	}
+
+	return best;
+}
+
+/* Baseline of a source type from a file of "<type> <throughput relative to the reference kernel>"
+   lines, -1 if missing */
+static double readBaseline(const std::string& file, const std::string& type)
+{
+	std::ifstream in(file);
+	std::string line;
+
+	while (std::getline(in, line))
+	{
+		std::istringstream fields(line);
+		std::string name;
+		double value;
+
+		if (fields >> name >> value && name == type)
+			return value;
+	}
+
+	return -1.0;
+}
+
+/* Replaces (or appends) the baseline of a source type, keeping every other line */
+static bool writeBaseline(const std::string& file, const std::string& type, double value)
+{
+	char entry[64];
+	std::snprintf(entry, sizeof(entry), "%s %.3e", type.c_str(), value);
+
+	std::ifstream in(file);
+	std::ostringstream out;
+	std::string line;
+	bool replaced = false;
+
+	while (std::getline(in, line))
+	{
+		std::istringstream fields(line);
+		std::string name;
+
+		if (fields >> name && name == type)
+		{
+			out << entry << "\n";
+			replaced = true;
+		}
+		else
+		{
+			out << line << "\n";
+		}
+	}
+
+	if (!replaced)
+		out << entry << "\n";
+
+	in.close();
+
+	std::ofstream result(file);
+	result << out.str();
+
+	return (bool)result;
+}
+
+/**
+	sourcesim_benchmark <type> <baselines> <tolerance> [--update]
+	sourcesim_benchmark CAR
+
+	Measures the generation throughput of one source type (AP, LFP, WB or AI) relative to the
+	reference kernel (see measureReference) and fails if it is more than tolerance (a fraction)
+	below the stored baseline. --update stores the measurement as the new baseline instead.
+
+	CAR compares the common average reference of ReferenceStage with a single-accumulator
+	reduction and fails if the stage is not faster.
+*/
+int main(int argc, char** argv)
+{
+	if (argc == 2 && std::string(argv[1]) == "CAR")
+	{
+		const double scalar = measureCommonAverage(true);
+		const double stage = measureCommonAverage(false);
+
+		std::printf("CAR: %.1f M channel-samples/s (single accumulator %.1f): %.2fx\n", stage / 1e6, scalar / 1e6, stage / scalar);
+
+		return stage > scalar ? 0 : 1;
+	}
+
+	if (argc < 4 || findSourceType(argv[1]) < 0)
+	{
+		std::printf("Usage: sourcesim_benchmark <AP|LFP|WB|AI> <baselines> <tolerance> [--update]\n       sourcesim_benchmark CAR\n");
+		return 2;
+	}
+
+	const std::string type = argv[1];
+	const std::string baselines = argv[2];
+	const double tolerance = std::atof(argv[3]);
+	const bool update = argc > 4 && std::string(argv[4]) == "--update";
+
+	const double throughput = measureThroughput(findSourceType(argv[1]));
+	const double reference = measureReference();
+	const double measured = throughput / reference;
+
+	if (update)
+	{
+		std::printf("%s: %.1f M channel-samples/s, %.4f of the reference kernel, stored as the new baseline\n", type.c_str(),
+			throughput / 1e6, measured);
+		return writeBaseline(baselines, type, measured) ? 0 : 1;
+	}
+
+	const double baseline = readBaseline(baselines, type);
+
+	if (baseline <= 0.0)
+	{
+		std::printf("%s: %.1f M channel-samples/s, %.4f of the reference kernel, no baseline in %s\n", type.c_str(),
+			throughput / 1e6, measured, baselines.c_str());
+		return 1;
+	}
+
+	const double minimum = baseline * (1.0 - tolerance);
+
+	std::printf("%s: %.1f M channel-samples/s, %.4f of the reference kernel (baseline %.4f, minimum %.4f): %.0f%% of baseline\n",
+		type.c_str(), throughput / 1e6, measured, baseline, minimum, 100.0 * measured / baseline);
+
+	return measured >= minimum ? 0 : 1;
+}
@@ -0,0 +1,417 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Allen Institute for Brain Science and Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "TestHarness.h"
+#include "DriftModel.h"
+#include "ProbeGeometry.h"
+#include "BackgroundNoise.h"
+#include "GenerationStages.h"
+#include "OscillationModel.h"
+
+TEST_CASE(DriftModel, periodicMotion)
+{
+	DriftModel model;
+	model.configure(DriftSettings{ 20.0f, 0.5f, 0.0f, 0.0f, 0.1f, 1 }, 3840.0f);
+
+	CHECK(model.isEnabled());
+
+	//Step starts and the step of a sample agree at any rate
+	bool consistent = true;
+	for (float rate : { 2500.0f, 30000.0f })
+	{
+		for (int64_t step = 1; step < 1000; step++)
+		{
+			const int64_t start = model.getStepStart(step, rate);
+			consistent &= model.getStep(start, rate) == step && model.getStep(start - 1, rate) == step - 1;
+		}
+	}
+
+	CHECK(consistent);
+
+	//Steps of 0.1 s at 0.5 Hz: a quarter period is step 5
+	CHECK_NEAR(model.getDisplacement(0, 100.0f), 0.0f, 1e-4f);
+	CHECK_NEAR(model.getDisplacement(5, 100.0f), 20.0f, 1e-3f);
+	CHECK_NEAR(model.getDisplacement(15, 100.0f), -20.0f, 1e-3f);
+}
+
+/* The random walk depends on the step only, not on the order steps are asked for */
+TEST_CASE(DriftModel, randomWalkIsDeterministic)
+{
+	const DriftSettings settings{ 0.0f, 0.0f, 5.0f, 0.5f, 0.1f, 9 };
+
+	DriftModel sequential;
+	sequential.configure(settings, 3840.0f);
+
+	DriftModel jumping;
+	jumping.configure(settings, 3840.0f);
+	jumping.getDisplacement(500, 0.0f);
+
+	bool same = true;
+	bool moves = false;
+
+	for (int64_t step = 0; step <= 500; step++)
+	{
+		const float displacement = sequential.getDisplacement(step, 1920.0f);
+		same &= displacement == jumping.getDisplacement(step, 1920.0f);
+		moves |= displacement != 0.0f;
+	}
+
+	CHECK(same);
+	CHECK(moves);
+
+	//Non-rigid: the top moves (1 + nonRigid) and the tip (1 - nonRigid) times the middle
+	const float middle = sequential.getDisplacement(300, 1920.0f);
+	CHECK_NEAR(sequential.getDisplacement(300, 3840.0f), 1.5f * middle, 1e-3f);
+	CHECK_NEAR(sequential.getDisplacement(300, 0.0f), 0.5f * middle, 1e-3f);
+}
+
+TEST_CASE(ProbeGeometry, neuropixels1)
+{
+	std::vector<float> positions;
+	CHECK(getSitePositions(NPX1_PROBE, 384, positions));
+	CHECK(positions.size() == 768);
+
+	//Staggered columns, 20 um rows
+	CHECK(positions[0] == 43.0f && positions[1] == 0.0f);
+	CHECK(positions[2] == 11.0f && positions[3] == 0.0f);
+	CHECK(positions[4] == 59.0f && positions[5] == 20.0f);
+	CHECK(positions[6] == 27.0f && positions[7] == 20.0f);
+	CHECK(positions[767] == 191 * NPX1_ROW_PITCH);
+}
+
+TEST_CASE(ProbeGeometry, neuropixels2FourShank)
+{
+	std::vector<float> positions;
+	CHECK(getSitePositions(NPX2_4SHANK_PROBE, 384, positions));
+
+	//96 electrodes per shank, each shank starting at its tip
+	CHECK(positions[2 * 95] == NPX2_COLUMN_PITCH && positions[2 * 95 + 1] == 47 * NPX2_ROW_PITCH);
+	CHECK(positions[2 * 96] == NPX2_SHANK_PITCH && positions[2 * 96 + 1] == 0.0f);
+	CHECK(positions[2 * 383] == 3 * NPX2_SHANK_PITCH + NPX2_COLUMN_PITCH);
+}
+
+TEST_CASE(ProbeGeometry, devicesWithoutSites)
+{
+	std::vector<float> positions(4, 1.0f);
+	CHECK(!getSitePositions(NIDAQ_DEVICE, 8, positions));
+	CHECK(positions.empty());
+}
+
+namespace
+{
+	/* Overlap-adds blocks 0..numBlocks-1 of a synth into one signal [sample][channel] */
+	std::vector<float> overlapAdd(SpectralBlockSynth& synth, int numBlocks)
+	{
+		const int length = synth.getLength();
+		const int hop = synth.getHop();
+		const int channels = synth.getNumChannels();
+
+		std::vector<float> block((size_t)length * channels);
+		std::vector<float> signal((size_t)(numBlocks * hop + length) * channels, 0.0f);
+
+		for (int k = 0; k < numBlocks; k++)
+		{
+			synth.render(k, block.data());
+
+			for (size_t i = 0; i < block.size(); i++)
+				signal[(size_t)k * hop * channels + i] += block[i];
+		}
+
+		return signal;
+	}
+}
+
+/* Overlap-added blocks give noise of the requested rms; a block depends only on its index and the seed */
+TEST_CASE(BackgroundNoise, rmsAndDeterminism)
+{
+	std::vector<float> sites;
+	getSitePositions(NPX1_PROBE, 32, sites);
+
+	std::vector<int> electrodes;
+	for (int e = 0; e < 32; e++)
+		electrodes.push_back(e);
+
+	const BackgroundSettings settings = DEFAULT_LFP_BACKGROUND;
+
+	SpectralBlockSynth synth;
+	synth.configure(settings, 2500.0f, 7, sites, electrodes);
+
+	const int numBlocks = 64;
+	const std::vector<float> signal = overlapAdd(synth, numBlocks);
+
+	//Skip the first and last half blocks, where only one window contributes
+	const size_t from = (size_t)synth.getHop() * 32;
+	const size_t to = (size_t)numBlocks * synth.getHop() * 32;
+
+	double power = 0.0;
+	for (size_t i = from; i < to; i++)
+		power += (double)signal[i] * signal[i];
+
+	CHECK_NEAR(std::sqrt(power / (to - from)), settings.rms, 0.2 * settings.rms);
+
+	SpectralBlockSynth again;
+	again.configure(settings, 2500.0f, 7, sites, electrodes);
+
+	std::vector<float> a((size_t)synth.getLength() * 32);
+	std::vector<float> b(a.size());
+	synth.render(41, a.data());
+	again.render(41, b.data());
+
+	CHECK(a == b);
+
+	again.configure(settings, 2500.0f, 8, sites, electrodes);
+	again.render(41, b.data());
+
+	CHECK(a != b);
+}
+
+/* Neighbouring sites are correlated, distant ones are not */
+TEST_CASE(BackgroundNoise, spatialCorrelation)
+{
+	std::vector<float> sites;
+	getSitePositions(NPX1_PROBE, 384, sites);
+
+	std::vector<int> electrodes;
+	for (int e = 0; e < 384; e++)
+		electrodes.push_back(e);
+
+	SpectralBlockSynth synth;
+	synth.configure(DEFAULT_LFP_BACKGROUND, 2500.0f, 3, sites, electrodes);
+
+	const std::vector<float> signal = overlapAdd(synth, 32);
+	const size_t samples = signal.size() / 384;
+
+	auto correlation = [&](int x, int y)
+	{
+		double xy = 0.0, xx = 0.0, yy = 0.0;
+
+		for (size_t n = 0; n < samples; n++)
+		{
+			const double a = signal[n * 384 + x];
+			const double b = signal[n * 384 + y];
+			xy += a * b;
+			xx += a * a;
+			yy += b * b;
+		}
+
+		return xy / std::sqrt(xx * yy);
+	};
+
+	CHECK(correlation(100, 102) > 0.8);
+	CHECK(std::fabs(correlation(0, 380)) < 0.5);
+}
+
+namespace
+{
+	/* Runs a background stage over numSamples in packets of the given sizes (cycled) */
+	std::vector<float> renderStage(SourceSimPipeline::BackgroundStage& stage, int channels, int numSamples, const std::vector<int>& sizes)
+	{
+		std::vector<float> output((size_t)numSamples * channels, 0.0f);
+
+		for (int first = 0, p = 0; first < numSamples; p++)
+		{
+			const int count = std::min(sizes[p % sizes.size()], numSamples - first);
+
+			stage.beginPacket(first, count);
+			stage.process(SourceSimPipeline::Tile{ output.data() + (size_t)first * channels, channels, 0, channels, first, count });
+			first += count;
+		}
+
+		return output;
+	}
+}
+
+/* The stage overlap-adds the synthesiser's blocks whatever the packet sizes, rendering ahead or not */
+TEST_CASE(BackgroundNoise, continuousStage)
+{
+	const int channels = 64;
+	const BackgroundSettings settings = DEFAULT_LFP_BACKGROUND;
+
+	std::vector<float> sites;
+	getSitePositions(NPX1_PROBE, channels, sites);
+
+	std::vector<int> electrodes;
+	for (int e = 0; e < channels; e++)
+		electrodes.push_back(e);
+
+	SourceSimPipeline::StageContext context;
+	std::memset(&context, 0, sizeof(context));
+	context.numChannels = channels;
+	context.sampleRate = 2500.0f;
+	context.seed = 11;
+	context.sitePositions = sites.data();
+	context.numElectrodes = channels;
+	context.background = &settings;
+
+	SpectralBlockSynth synth;
+	synth.configure(settings, context.sampleRate, context.seed, sites, electrodes);
+
+	const int numBlocks = 40;
+	const int numSamples = numBlocks * synth.getHop();
+	const std::vector<float> expected = overlapAdd(synth, numBlocks);
+
+	SourceSimPipeline::BackgroundStage small, large;
+	small.prepare(context);
+	large.prepare(context);
+
+	const std::vector<float> a = renderStage(small, channels, numSamples, { 500, 7, 64, 1, 300 });
+	const std::vector<float> b = renderStage(large, channels, numSamples, { 3000, 1500 });
+
+	CHECK(a == b);
+
+	//Block -1 only contributes to the first hop, which overlapAdd leaves out
+	bool same = true;
+	for (size_t i = (size_t)synth.getHop() * channels; i < a.size(); i++)
+		same &= a[i] == expected[i];
+
+	CHECK(same);
+
+	double power = 0.0;
+	for (float v : a)
+		power += (double)v * v;
+
+	CHECK_NEAR(std::sqrt(power / a.size()), settings.rms, 0.2 * settings.rms);
+}
+
+/* No stretch of background comes back later: hop-long segments of the (differenced, so
+   roughly white) output are uncorrelated with one another, wherever they are */
+TEST_CASE(BackgroundNoise, neverRepeats)
+{
+	const int channels = 32;
+	const BackgroundSettings settings = DEFAULT_LFP_BACKGROUND;
+
+	std::vector<float> sites;
+	getSitePositions(NPX1_PROBE, 384, sites);
+
+	//Electrodes spread over the whole probe
+	std::vector<int> electrodes;
+	for (int c = 0; c < channels; c++)
+		electrodes.push_back(c * 12);
+
+	SourceSimPipeline::StageContext context;
+	std::memset(&context, 0, sizeof(context));
+	context.numChannels = channels;
+	context.sampleRate = 2500.0f;
+	context.seed = 5;
+	context.channelMap = electrodes.data();
+	context.sitePositions = sites.data();
+	context.numElectrodes = 384;
+	context.background = &settings;
+
+	SourceSimPipeline::BackgroundStage stage;
+	stage.prepare(context);
+
+	const int hop = SpectralBlockSynth::getBlockLength(context.sampleRate) / 2;
+	const int numSegments = 150;
+	const std::vector<float> output = renderStage(stage, channels, numSegments * hop + 1, { 500 });
+
+	std::vector<float> differences((size_t)numSegments * hop * channels);
+	for (size_t i = 0; i < differences.size(); i++)
+		differences[i] = output[i + channels] - output[i];
+
+	const size_t segment = (size_t)hop * channels;
+	std::vector<double> energy(numSegments, 0.0);
+
+	for (int k = 0; k < numSegments; k++)
+		for (size_t i = 0; i < segment; i++)
+			energy[k] += (double)differences[k * segment + i] * differences[k * segment + i];
+
+	double worst = 0.0;
+
+	for (int j = 0; j < numSegments; j++)
+	{
+		for (int k = j + 1; k < numSegments; k++)
+		{
+			const float* x = differences.data() + j * segment;
+			const float* y = differences.data() + k * segment;
+			double xy = 0.0;
+
+			for (size_t i = 0; i < segment; i++)
+				xy += (double)x[i] * y[i];
+
+			worst = std::max(worst, std::fabs(xy) / std::sqrt(energy[j] * energy[k]));
+		}
+	}
+
+	CHECK(worst < 0.3);
+}
+
+/* An unmodulated band is amplitude * sin(phase + omega n), whatever the packet split */
+TEST_CASE(OscillationModel, matchesClosedForm)
+{
+	const OscillationBand band{ 7.0f, 80.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+	const float sampleRate = 2500.0f;
+
+	ModulatedOscillator oscillator;
+	oscillator.configure(band, sampleRate, 0.3);
+
+	std::vector<float> sine(10000), cosine(10000);
+	const int sizes[] = { 1, 500, 31, 64, 7 };
+
+	for (int first = 0, p = 0; first < 10000; p++)
+	{
+		const int count = std::min(sizes[p % 5], 10000 - first);
+		oscillator.render(first, count, sine.data() + first, cosine.data() + first);
+		first += count;
+	}
+
+	double maxError = 0.0;
+
+	for (int n = 0; n < 10000; n++)
+	{
+		const double phase = 0.3 + 6.283185307179586 * 7.0 * n / sampleRate;
+		maxError = std::max(maxError, std::fabs(sine[n] - 80.0 * std::sin(phase)));
+		maxError = std::max(maxError, std::fabs(cosine[n] - 80.0 * std::cos(phase)));
+	}
+
+	CHECK(maxError < 0.05);
+}
+
+/* Modulated bands stay within their envelope and do not depend on the packet split */
+TEST_CASE(OscillationModel, modulatedBandIsSplitInvariant)
+{
+	const OscillationSettings settings = getDefaultOscillations();
+
+	for (int b = 0; b < settings.numBands; b++)
+	{
+		ModulatedOscillator whole, split;
+		whole.configure(settings.bands[b], 2500.0f, 1.0);
+		split.configure(settings.bands[b], 2500.0f, 1.0);
+
+		std::vector<float> sineWhole(20000), cosineWhole(20000), sineSplit(20000), cosineSplit(20000);
+		whole.render(0, 20000, sineWhole.data(), cosineWhole.data());
+
+		for (int first = 0; first < 20000; first += 250)
+			split.render(first, 250, sineSplit.data() + first, cosineSplit.data() + first);
+
+		const float peak = settings.bands[b].amplitude * (1.0f + settings.bands[b].amDepth);
+		bool bounded = true;
+
+		for (int n = 0; n < 20000; n++)
+			bounded &= std::hypot(sineWhole[n], cosineWhole[n]) <= peak * 1.001f;
+
+		CHECK(sineWhole == sineSplit);
+		CHECK(cosineWhole == cosineSplit);
+		CHECK(bounded);
+	}
+}
@@ -0,0 +1,89 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Allen Institute for Brain Science and Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "TestHarness.h"
+#include "ParameterSnapshot.h"
+
+#include <thread>
+
+namespace
+{
+	struct Pair
+	{
+		int a;
+		int b; //always -a
+	};
+}
+
+TEST_CASE(ParameterSnapshot, versions)
+{
+	ParameterSnapshot<Pair> parameters(Pair{ 0, 0 });
+
+	CHECK(parameters.getVersion() == 1);
+	CHECK(parameters.acquire()->version == 1);
+
+	parameters.update([](Pair& p) { p.a = 4; p.b = -4; });
+	parameters.update([](Pair& p) { p.a++; p.b--; });
+
+	const ParameterSnapshot<Pair>::Snapshot* snapshot = parameters.acquire();
+
+	CHECK(snapshot->version == 3);
+	CHECK(snapshot->value.a == 5 && snapshot->value.b == -5);
+	CHECK(parameters.get().a == 5);
+}
+
+/* The reader never sees a half-applied update and versions only move forward */
+TEST_CASE(ParameterSnapshot, concurrentWriters)
+{
+	ParameterSnapshot<Pair> parameters(Pair{ 0, 0 });
+	const int updatesPerWriter = 20000;
+
+	auto writer = [&parameters]()
+	{
+		for (int i = 0; i < updatesPerWriter; i++)
+			parameters.update([](Pair& p) { p.a++; p.b--; });
+	};
+
+	std::thread first(writer);
+	std::thread second(writer);
+
+	bool consistent = true;
+	bool monotonic = true;
+	uint64_t lastVersion = 0;
+
+	while (lastVersion < 2 * updatesPerWriter + 1)
+	{
+		const ParameterSnapshot<Pair>::Snapshot* snapshot = parameters.acquire();
+
+		consistent &= snapshot->value.a == -snapshot->value.b && (uint64_t)snapshot->value.a == snapshot->version - 1;
+		monotonic &= snapshot->version >= lastVersion;
+		lastVersion = snapshot->version;
+	}
+
+	first.join();
+	second.join();
+
+	CHECK(consistent);
+	CHECK(monotonic);
+	CHECK(parameters.get().a == 2 * updatesPerWriter);
+}
@@ -0,0 +1,284 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Allen Institute for Brain Science and Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "TestHarness.h"
+#include "TestSources.h"
+
+using namespace SourceSimTests;
+
+/* Channels of the probe streams in these tests: several tiles wide, quick to render */
+#define TEST_CHANNELS 96
+
+/* Packet boundaries must not show in the output: every packet starts where the last one ended */
+TEST_CASE(Pipeline, packetsAreContinuous)
+{
+	for (int type = 0; type < NUM_SOURCE_TYPES; type++)
+	{
+		const int channels = type == AI_SOURCE ? 8 : TEST_CHANNELS;
+		const int64_t duration = (int64_t)(TestSource(type, channels).sampleRate / 4);
+
+		TestSource whole(type, channels, 3);
+		const std::vector<float> reference = renderInPackets(whole, duration, (int)duration);
+
+		for (int packetSize : { 500, 37, 8, 1 })
+		{
+			TestSource split(type, channels, 3);
+			const std::vector<float> output = renderInPackets(split, duration, packetSize);
+
+			size_t mismatches = 0;
+			for (size_t i = 0; i < output.size(); i++)
+				mismatches += output[i] != reference[i];
+
+			if (mismatches > 0)
+				std::printf("  %s, %d-sample packets: %d samples differ\n", getSourceType(type).name, packetSize, (int)mismatches);
+
+			CHECK(mismatches == 0);
+		}
+	}
+}
+
+/* Exactly numSamples x numChannels values are written, every one of them finite */
+TEST_CASE(Pipeline, writesExactlyThePacket)
+{
+	const float guard = -12345.0f;
+
+	for (int type = 0; type < NUM_SOURCE_TYPES; type++)
+	{
+		const int channels = type == AI_SOURCE ? 8 : TEST_CHANNELS;
+		TestSource source(type, channels);
+
+		for (int packetSize : { 1, 333, 500 })
+		{
+			const size_t values = (size_t)packetSize * channels;
+			std::vector<float> buffer(values + 2 * channels, guard);
+			std::vector<float> packet(values, std::nanf(""));
+
+			source.render(buffer.data() + channels, packetSize, 1000);
+			std::copy(buffer.begin() + channels, buffer.begin() + channels + values, packet.begin());
+
+			bool guardIntact = true;
+			for (int i = 0; i < channels; i++)
+				guardIntact &= buffer[i] == guard && buffer[channels + values + i] == guard;
+
+			bool finite = true;
+			for (float value : packet)
+				finite &= std::isfinite(value) && value != guard;
+
+			CHECK(guardIntact);
+			CHECK(finite);
+		}
+	}
+}
+
+/* With nothing but the cached waveform, sample n of a channel is waveform sample n modulo its period */
+TEST_CASE(Pipeline, waveformValues)
+{
+	TestSource source(AI_SOURCE, 8);
+	const int length = source.getWaveformLength();
+
+	CHECK(length == 3000);
+
+	const int64_t first = 2 * length - 250;
+	std::vector<float> output((size_t)1000 * source.numChannels);
+	source.render(output.data(), 1000, first);
+
+	bool exact = true;
+	for (int i = 0; i < 1000; i++)
+	{
+		const size_t phase = (size_t)((first + i) % length);
+
+		for (int c = 0; c < source.numChannels; c++)
+			exact &= output[(size_t)i * source.numChannels + c] == source.waveform[phase * source.numChannels + c];
+	}
+
+	CHECK(exact);
+
+	//10 Hz, 1000 uV peak: a quarter period in, every channel is at its peak
+	CHECK_NEAR(source.waveform[(size_t)(length / 4) * source.numChannels], 1000.0f, 1e-2f);
+}
+
+/* The seed selects the random content; the same seed reproduces it exactly */
+TEST_CASE(Pipeline, seedsAreReproducible)
+{
+	for (int type : { AP_SOURCE, LFP_SOURCE })
+	{
+		TestSource a(type, TEST_CHANNELS, 11);
+		TestSource b(type, TEST_CHANNELS, 11);
+		TestSource c(type, TEST_CHANNELS, 12);
+
+		const int64_t duration = (int64_t)a.sampleRate / 2;
+
+		const std::vector<float> first = renderInPackets(a, duration, 500);
+		const std::vector<float> second = renderInPackets(b, duration, 500);
+		const std::vector<float> other = renderInPackets(c, duration, 500);
+
+		CHECK(first == second);
+		CHECK(first != other);
+	}
+}
+
+/* Probe amplifiers keep their per-electrode calibration spread at the default (unity) gain */
+TEST_CASE(Pipeline, gainSpreadAtUnity)
+{
+	TestSource spread(AP_SOURCE, TEST_CHANNELS, 4);
+	TestSource flat(AP_SOURCE, TEST_CHANNELS, 4);
+	flat.pipeline.stage<GAIN_STAGE>().setGain(1.0f, 0.0f);
+
+	CHECK(spread.pipeline.stage<GAIN_STAGE>().isEnabled());
+
+	const std::vector<float> a = renderInPackets(spread, 500, 500);
+	const std::vector<float> b = renderInPackets(flat, 500, 500);
+
+	//A sample well away from the zero crossings of the 60 Hz waveform
+	const size_t row = (size_t)125 * TEST_CHANNELS;
+	float lowest = 2.0f, highest = 0.0f;
+
+	for (int c = 0; c < TEST_CHANNELS; c++)
+	{
+		const float gain = a[row + c] / b[row + c];
+		lowest = std::min(lowest, gain);
+		highest = std::max(highest, gain);
+	}
+
+	CHECK(highest - lowest > 0.01f);
+	CHECK(lowest >= 1.0f - PROBE_GAIN_SPREAD - 1e-4f);
+	CHECK(highest <= 1.0f + PROBE_GAIN_SPREAD + 1e-4f);
+
+	//Without a spread, unity gain leaves the stage off
+	CHECK(!flat.pipeline.stage<GAIN_STAGE>().isEnabled());
+}
+
+/* prepare() restarts the pipeline: a second pass from sample 0 repeats the first */
+TEST_CASE(Pipeline, prepareRestarts)
+{
+	TestSource source(WB_SOURCE, TEST_CHANNELS, 5);
+	const int64_t duration = 15000;
+
+	const std::vector<float> first = renderInPackets(source, duration, 500);
+	source.prepare();
+	const std::vector<float> second = renderInPackets(source, duration, 500);
+
+	CHECK(first == second);
+}
+
+/* The ADC stage rounds to whole steps and clips to the int16 range */
+TEST_CASE(Pipeline, quantization)
+{
+	TestSource source(AP_SOURCE, TEST_CHANNELS);
+	source.frontEnd.adcStep = 0.195f;
+	source.pipeline.stage<GAIN_STAGE>().setGain(100.0f);
+	source.prepare();
+
+	std::vector<float> output((size_t)500 * TEST_CHANNELS);
+	source.render(output.data(), 500, 0);
+
+	bool onSteps = true;
+	bool inRange = true;
+
+	for (float value : output)
+	{
+		const float code = std::round(value / 0.195f);
+		onSteps &= code * 0.195f == value;
+		inRange &= code >= -32768.5f && code <= 32767.5f;
+	}
+
+	CHECK(onSteps);
+	CHECK(inRange);
+}
+
+/* Front-end noise has the requested rms on top of the signal, and artifacts start on their interval */
+TEST_CASE(Pipeline, frontEnd)
+{
+	const int64_t duration = 30000;
+
+	//Input-referred: the amplifiers' gain spread would scale the noise and artifacts per channel
+	TestSource clean(AP_SOURCE, TEST_CHANNELS, 5);
+	clean.pipeline.stage<GAIN_STAGE>().setGain(1.0f, 0.0f);
+	const std::vector<float> reference = renderInPackets(clean, duration, 500);
+
+	TestSource noisy(AP_SOURCE, TEST_CHANNELS, 5);
+	noisy.pipeline.stage<GAIN_STAGE>().setGain(1.0f, 0.0f);
+	noisy.frontEnd.noiseRms = 10.0f;
+	noisy.prepare();
+	const std::vector<float> withNoise = renderInPackets(noisy, duration, 500);
+
+	double power = 0.0;
+	for (size_t i = 0; i < reference.size(); i++)
+		power += (double)(withNoise[i] - reference[i]) * (withNoise[i] - reference[i]);
+
+	CHECK_NEAR(std::sqrt(power / reference.size()), 10.0, 0.5);
+
+	TestSource stimulated(AP_SOURCE, TEST_CHANNELS, 5);
+	stimulated.pipeline.stage<GAIN_STAGE>().setGain(1.0f, 0.0f);
+	stimulated.frontEnd = FrontEndSettings{ 0.0f, 0.1f, 500.0f, 0.001f, 0.0f };
+	stimulated.prepare();
+	const std::vector<float> withArtifacts = renderInPackets(stimulated, duration, 500);
+
+	//Every channel jumps by the full amplitude at each onset and is back to the signal before the next
+	bool onsets = true;
+	bool decayed = true;
+
+	for (int64_t onset = 0; onset < duration; onset += 3000)
+	{
+		for (int c = 0; c < TEST_CHANNELS; c++)
+		{
+			const size_t at = (size_t)onset * TEST_CHANNELS + c;
+			const size_t before = at + (size_t)2999 * TEST_CHANNELS;
+			onsets &= std::fabs(withArtifacts[at] - reference[at] - 500.0f) < 1e-2f;
+			decayed &= std::fabs(withArtifacts[before] - reference[before]) < 1e-2f;
+		}
+	}
+
+	CHECK(onsets);
+	CHECK(decayed);
+}
+
+/* The common average reference leaves every sample with a zero mean across channels, whatever the
+   channel count is relative to the partial sums */
+TEST_CASE(Pipeline, commonAverage)
+{
+	for (int channels : { 7, 96, 101 })
+	{
+		//The reference itself, before the amplifiers' gain spread
+		TestSource source(AP_SOURCE, channels, 2);
+		source.pipeline.stage<GAIN_STAGE>().setGain(1.0f, 0.0f);
+		source.pipeline.stage<REFERENCE_STAGE>().setReference(SourceSimPipeline::ReferenceStage::AVERAGE, 0);
+		source.prepare();
+
+		const std::vector<float> output = renderInPackets(source, 3000, 500);
+
+		double worst = 0.0;
+
+		for (int64_t s = 0; s < 3000; s++)
+		{
+			double sum = 0.0;
+
+			for (int c = 0; c < channels; c++)
+				sum += output[(size_t)s * channels + c];
+
+			worst = std::max(worst, std::fabs(sum / channels));
+		}
+
+		CHECK(worst < 1e-3);
+	}
+}
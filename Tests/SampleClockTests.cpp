@@ -0,0 +1,175 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Allen Institute for Brain Science and Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "TestHarness.h"
+#include "SampleClock.h"
+
+#include <vector>
+
+/* Generates the TTL codes and timestamps of consecutive packets the way SourceSim does:
+   clock settings applied at the packet boundary, codes filled, packet stamped */
+struct ClockedStream
+{
+	ClockedStream(double rate) : sampleRate(rate), numSamples(0) {}
+
+	void packet(int count, float period, float tolerance = 0.0f, bool enabled = true)
+	{
+		std::vector<uint64_t> packetCodes(count);
+		std::vector<int64_t> packetStamps(count);
+
+		clock.setTtl(sampleRate, period, tolerance, numSamples);
+		int64_t falling = -1;
+		const int64_t rising = clock.fillEventCodes(packetCodes.data(), numSamples, count, enabled, &falling);
+		SampleClock::stamp(packetStamps.data(), numSamples, count);
+		numSamples += count;
+
+		codes.insert(codes.end(), packetCodes.begin(), packetCodes.end());
+		timestamps.insert(timestamps.end(), packetStamps.begin(), packetStamps.end());
+
+		if (rising >= 0)
+			risingEdges.push_back(rising);
+		if (falling >= 0)
+			fallingEdges.push_back(falling);
+	}
+
+	double sampleRate;
+	int64_t numSamples;
+	SampleClock clock;
+
+	std::vector<uint64_t> codes;
+	std::vector<int64_t> timestamps;
+	std::vector<int64_t> risingEdges;
+	std::vector<int64_t> fallingEdges;
+};
+
+/* Timestamps count samples from 1 and carry on across packets of any size without gaps or repeats */
+TEST_CASE(SampleClock, timestampsAreContinuous)
+{
+	ClockedStream stream(30000.0);
+	const int sizes[] = { 500, 1, 8, 37, 500, 4096, 2 };
+
+	for (int p = 0; p < 70; p++)
+		stream.packet(sizes[p % 7], 1.0f);
+
+	bool continuous = true;
+	for (size_t i = 0; i < stream.timestamps.size(); i++)
+		continuous &= stream.timestamps[i] == (int64_t)i + 1;
+
+	CHECK(continuous);
+	CHECK(stream.numSamples == (int64_t)stream.timestamps.size());
+}
+
+/* A 1 s clock rises on sample 15000 + 30000 k at 30 kHz whatever the packet boundaries, and on the
+   samples of the same instants at 2.5 kHz, so AP and LFP edges line up */
+TEST_CASE(SampleClock, edgesOnClockSamples)
+{
+	ClockedStream ap(30000.0);
+	ClockedStream lfp(2500.0);
+
+	for (int p = 0; p < 360; p++)
+	{
+		ap.packet(p % 2 == 0 ? 500 : 333, 1.0f);
+		lfp.packet(p % 2 == 0 ? 500 : 29, 1.0f);
+	}
+
+	CHECK(ap.risingEdges.size() >= 4);
+	CHECK(lfp.risingEdges.size() >= 4);
+
+	bool onSamples = true;
+	for (size_t k = 0; k < ap.risingEdges.size(); k++)
+		onSamples &= ap.risingEdges[k] == 15000 + 30000 * (int64_t)k && ap.codes[(size_t)ap.risingEdges[k]] == 1 && ap.codes[(size_t)ap.risingEdges[k] - 1] == 0;
+
+	for (size_t k = 0; k < ap.fallingEdges.size(); k++)
+		onSamples &= ap.fallingEdges[k] == 30000 * ((int64_t)k + 1);
+
+	CHECK(onSamples);
+
+	bool aligned = true;
+	for (size_t k = 0; k < lfp.risingEdges.size() && k < ap.risingEdges.size(); k++)
+		aligned &= lfp.risingEdges[k] * 12 == ap.risingEdges[k];
+
+	CHECK(aligned);
+}
+
+/* Re-applying the same settings or toggling the clock keeps its phase; a new period restarts it at
+   the packet boundary from the level it had */
+TEST_CASE(SampleClock, reconfigureKeepsPhase)
+{
+	ClockedStream reference(30000.0);
+	ClockedStream toggled(30000.0);
+
+	for (int p = 0; p < 200; p++)
+	{
+		reference.packet(500, 0.1f);
+		toggled.packet(500, 0.1f, 0.0f, p % 10 != 3);
+	}
+
+	bool samePhase = true;
+	bool disabledLow = true;
+
+	for (size_t i = 0; i < reference.codes.size(); i++)
+	{
+		if ((i / 500) % 10 == 3)
+			disabledLow &= toggled.codes[i] == 0;
+		else
+			samePhase &= toggled.codes[i] == reference.codes[i];
+	}
+
+	CHECK(samePhase);
+	CHECK(disabledLow);
+
+	//Sample 2000 is high (1500-2999), so the 1 s clock continues high and falls 15000 samples later
+	ClockedStream changed(30000.0);
+
+	for (int p = 0; p < 4; p++)
+		changed.packet(500, 0.1f);
+
+	for (int p = 0; p < 70; p++)
+		changed.packet(500, 1.0f);
+
+	CHECK(changed.codes[1999] == 1);
+	CHECK(changed.codes[2000 + 14999] == 1);
+	CHECK(changed.codes[2000 + 15000] == 0);
+	CHECK(changed.codes[2000 + 30000] == 1);
+}
+
+/* reset() restarts the line low, even when the settings stay the same */
+TEST_CASE(SampleClock, resetStartsLow)
+{
+	ClockedStream stream(30000.0);
+
+	for (int p = 0; p < 4; p++)
+		stream.packet(500, 0.1f);
+
+	CHECK(stream.clock.getLevel() == 1);
+
+	stream.clock.reset();
+	stream.numSamples = 0;
+	stream.codes.clear();
+
+	stream.packet(3000, 0.1f);
+
+	CHECK(stream.codes[0] == 0);
+	CHECK(stream.codes[1499] == 0);
+	CHECK(stream.codes[1500] == 1);
+}
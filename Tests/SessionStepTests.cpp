@@ -0,0 +1,155 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Allen Institute for Brain Science and Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "TestHarness.h"
+#include "TestSources.h"
+#include "SampleClock.h"
+
+#include <cstring>
+#include <memory>
+
+using namespace SourceSimTests;
+
+/* DEFAULT_PACKET_SIZE of SourceSim.h */
+#define STEP_PACKET_SIZE 500
+
+/* Steps a session packet by packet the way SessionStepper does: the sources SessionRenderer builds
+   (an AP/LFP pair per probe, then one AI stream), each seeded from the session seed and its index,
+   the source furthest behind in time stepped next. Every packet's samples, timestamps and TTL
+   codes are kept */
+class SteppedSession
+{
+public:
+
+	struct Stream
+	{
+		Stream(int type, int channels, uint32_t seed) : source(type, channels, seed), numSamples(0) {}
+
+		TestSource source;
+		SampleClock clock;
+		int64_t numSamples;
+
+		std::vector<float> samples;
+		std::vector<int64_t> timestamps;
+		std::vector<uint64_t> eventCodes;
+	};
+
+	SteppedSession(uint32_t seed, int numProbes, int probeChannels, int aiChannels)
+	{
+		for (int p = 0; p < numProbes; p++)
+		{
+			add(AP_SOURCE, probeChannels, seed);
+			add(LFP_SOURCE, probeChannels, seed);
+		}
+
+		add(AI_SOURCE, aiChannels, seed);
+	}
+
+	/* Generates packets until every stream holds seconds of data */
+	void run(double seconds, int packetSize)
+	{
+		for (;;)
+		{
+			int next = 0;
+			bool done = true;
+
+			for (size_t i = 0; i < streams.size(); i++)
+			{
+				const Stream& s = *streams[i];
+				done &= s.numSamples >= (int64_t)(seconds * s.source.sampleRate);
+
+				if ((double)s.numSamples * streams[next]->source.sampleRate < (double)streams[next]->numSamples * s.source.sampleRate)
+					next = (int)i;
+			}
+
+			if (done)
+				return;
+
+			step(*streams[next], packetSize);
+		}
+	}
+
+	std::vector<std::unique_ptr<Stream>> streams;
+
+private:
+
+	void add(int type, int channels, uint32_t seed)
+	{
+		streams.emplace_back(new Stream(type, channels, seed + (uint32_t)streams.size()));
+	}
+
+	/* Same sequence as SessionStepper::stepSource: clock settings, TTL codes, samples, timestamps */
+	static void step(Stream& s, int packetSize)
+	{
+		const int channels = s.source.numChannels;
+		const size_t first = s.samples.size();
+
+		s.samples.resize(first + (size_t)packetSize * channels);
+		s.timestamps.resize((size_t)s.numSamples + packetSize);
+		s.eventCodes.resize((size_t)s.numSamples + packetSize);
+
+		s.clock.setTtl(s.source.sampleRate, 1.0f, 0.0f, s.numSamples);
+		s.clock.fillEventCodes(s.eventCodes.data() + s.numSamples, s.numSamples, packetSize, true);
+		s.source.render(s.samples.data() + first, packetSize, s.numSamples);
+		SampleClock::stamp(s.timestamps.data() + s.numSamples, s.numSamples, packetSize);
+
+		s.numSamples += packetSize;
+	}
+};
+
+template <typename T>
+static bool bitIdentical(const std::vector<T>& a, const std::vector<T>& b)
+{
+	return a.size() == b.size() && std::memcmp(a.data(), b.data(), a.size() * sizeof(T)) == 0;
+}
+
+/* Two stepped runs of the same configuration produce the same bits; another seed changes the
+   samples of every probe stream (AI carries only its waveform) but no timestamps or TTL codes */
+TEST_CASE(SessionStep, seedDeterminesOutput)
+{
+	SteppedSession a(7, 2, 64, 8);
+	SteppedSession b(7, 2, 64, 8);
+	SteppedSession c(8, 2, 64, 8);
+
+	a.run(0.5, STEP_PACKET_SIZE);
+	b.run(0.5, STEP_PACKET_SIZE);
+	c.run(0.5, STEP_PACKET_SIZE);
+
+	CHECK(a.streams.size() == 5);
+
+	for (size_t i = 0; i < a.streams.size(); i++)
+	{
+		const SteppedSession::Stream& x = *a.streams[i];
+		const SteppedSession::Stream& y = *b.streams[i];
+		const SteppedSession::Stream& z = *c.streams[i];
+
+		CHECK(x.numSamples >= (int64_t)(0.5 * x.source.sampleRate));
+		CHECK(bitIdentical(x.samples, y.samples));
+		CHECK(bitIdentical(x.timestamps, y.timestamps));
+		CHECK(bitIdentical(x.eventCodes, y.eventCodes));
+
+		CHECK(bitIdentical(x.samples, z.samples) == (x.source.probeType < 0));
+		CHECK(bitIdentical(x.timestamps, z.timestamps));
+		CHECK(bitIdentical(x.eventCodes, z.eventCodes));
+	}
+}
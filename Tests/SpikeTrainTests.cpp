@@ -0,0 +1,194 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Allen Institute for Brain Science and Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "TestHarness.h"
+#include "ActionPotentialTrain.h"
+
+/* Sample rate of APTrain (AP_TRAIN_SAMPLE_RATE in SourceSim.h) */
+#define TRAIN_SAMPLE_RATE 30000.0f
+
+/* Renders samples [0, duration) packet by packet into one reused packet buffer, as APTrain does,
+   scheduling a spike at every rising edge of clock (a 1 / ttlPeriod TTL) first when ttlPeriod > 0 */
+static std::vector<float> renderTrain(ActionPotentialTrain& train, int numChannels, int64_t duration, int packetSize, float ttlPeriod = 0.0f)
+{
+	SampleClock clock;
+	clock.setTtl(TRAIN_SAMPLE_RATE, ttlPeriod, 0.0f, 0);
+
+	std::vector<float> output((size_t)duration * numChannels);
+	std::vector<float> packet((size_t)packetSize * numChannels, 0.0f);
+	std::vector<uint64_t> codes((size_t)packetSize);
+
+	for (int64_t first = 0; first < duration; first += packetSize)
+	{
+		clock.fillEventCodes(codes.data(), first, packetSize, ttlPeriod > 0.0f);
+		train.scheduleRisingEdges(clock, codes.data(), first, packetSize, ttlPeriod > 0.0f);
+		train.render(packet.data(), packetSize, first);
+
+		const size_t count = (size_t)std::min((int64_t)packetSize, duration - first) * numChannels;
+		std::copy(packet.begin(), packet.begin() + count, output.begin() + (size_t)first * numChannels);
+	}
+
+	return output;
+}
+
+/* What the train must produce for the given onsets: the tabulated action potential on every channel
+   after its delay, and exact zeros everywhere else */
+static std::vector<float> expectTrain(const ActionPotentialTrain& train, int numChannels, int64_t duration, const std::vector<int64_t>& onsets)
+{
+	std::vector<float> expected((size_t)duration * numChannels, 0.0f);
+
+	for (int64_t onset : onsets)
+	{
+		for (int j = 0; j < numChannels; j++)
+		{
+			const int64_t start = onset + train.getDelay(j);
+
+			for (int64_t n = std::max((int64_t)0, start); n < std::min(start + train.getLength(), duration); n++)
+				expected[(size_t)n * numChannels + j] = train.getWaveform()[n - start];
+		}
+	}
+
+	return expected;
+}
+
+/* Samples of a channel at which a spike starts: non-zero after a zero (the action potential starts at rest, 10 mV) */
+static std::vector<int64_t> findOnsets(const std::vector<float>& output, int numChannels, int channel)
+{
+	std::vector<int64_t> onsets;
+	const int64_t duration = (int64_t)(output.size() / numChannels);
+
+	for (int64_t n = 0; n < duration; n++)
+	{
+		const bool active = output[(size_t)n * numChannels + channel] != 0.0f;
+		const bool before = n > 0 && output[(size_t)(n - 1) * numChannels + channel] != 0.0f;
+
+		if (active && !before)
+			onsets.push_back(n);
+	}
+
+	return onsets;
+}
+
+/* Spikes start on the samples they were scheduled for, across packet boundaries, and nothing else
+   is written: the samples between them are exactly zero whatever the packet size */
+TEST_CASE(SpikeTrain, scheduledSamples)
+{
+	const int channels = 4;
+	const int64_t duration = 6000;
+	const std::vector<int64_t> onsets = { 0, 480, 1510, 4999 };
+
+	for (int packetSize : { 500, 37, 1 })
+	{
+		ActionPotentialTrain train;
+		train.prepare(TRAIN_SAMPLE_RATE, channels, nullptr, 1, SpikeTrainSettings{ ActionPotentialTrain::TTL_TRIGGER, 0.0f, 0.0f });
+
+		for (int64_t onset : onsets)
+			CHECK(train.schedule(onset));
+
+		const std::vector<float> output = renderTrain(train, channels, duration, packetSize);
+
+		CHECK(output == expectTrain(train, channels, duration, onsets));
+		CHECK(findOnsets(output, channels, 2) == onsets);
+	}
+
+	//1.8 ms of action potential at 30 kHz
+	ActionPotentialTrain train;
+	train.prepare(TRAIN_SAMPLE_RATE, channels, nullptr, 1, DEFAULT_SPIKE_TRAIN);
+
+	CHECK(train.getLength() == 54);
+	CHECK(train.getRefractorySamples() == 150);
+	CHECK_NEAR(train.getWaveform()[0], RESTING_MEMBRANE_POTENTIAL_IN_MV, 1e-4f);
+}
+
+/* No spike starts before the previous one has ended and its refractory period has passed */
+TEST_CASE(SpikeTrain, refractoryGap)
+{
+	ActionPotentialTrain train;
+	train.prepare(TRAIN_SAMPLE_RATE, 1, nullptr, 1, DEFAULT_SPIKE_TRAIN);
+
+	const int gap = train.getLength() + train.getRefractorySamples();
+
+	CHECK(train.schedule(1000));
+	CHECK(!train.schedule(1001));
+	CHECK(!train.schedule(1000 + gap - 1));
+	CHECK(train.schedule(1000 + gap));
+
+	//A 200 Hz TTL rises every 150 samples (75, 225, 375, ...), faster than the 204-sample gap allows:
+	//every other edge fires
+	const int64_t duration = 30000;
+	std::vector<int64_t> everyOtherEdge;
+	for (int64_t n = 75; n < duration; n += 300)
+		everyOtherEdge.push_back(n);
+
+	for (int packetSize : { 500, 75, 37, 1 })
+	{
+		train.prepare(TRAIN_SAMPLE_RATE, 3, nullptr, 1, SpikeTrainSettings{ ActionPotentialTrain::TTL_TRIGGER, 0.0f, 0.0f });
+		const std::vector<float> output = renderTrain(train, 3, duration, packetSize, 0.005f);
+
+		CHECK(findOnsets(output, 3, 0) == everyOtherEdge);
+		CHECK(output == expectTrain(train, 3, duration, everyOtherEdge));
+	}
+
+	//At 1 kHz the rate process would often fire within the gap; those spikes are dropped
+	train.prepare(TRAIN_SAMPLE_RATE, 1, nullptr, 7, SpikeTrainSettings{ ActionPotentialTrain::RATE_TRIGGER, 1000.0f, 0.0f });
+	const std::vector<float> output = renderTrain(train, 1, duration, 500);
+	const std::vector<int64_t> onsets = findOnsets(output, 1, 0);
+
+	bool spaced = true;
+	for (size_t i = 1; i < onsets.size(); i++)
+		spaced &= onsets[i] - onsets[i - 1] >= gap;
+
+	CHECK(spaced);
+	CHECK(onsets.size() > 50);
+	CHECK(output == expectTrain(train, 1, duration, onsets));
+
+	//The rate process depends on the seed only, not on the packet size
+	train.prepare(TRAIN_SAMPLE_RATE, 1, nullptr, 7, SpikeTrainSettings{ ActionPotentialTrain::RATE_TRIGGER, 1000.0f, 0.0f });
+	CHECK(renderTrain(train, 1, duration, 37) == output);
+}
+
+/* Each channel sees a spike after the conduction delay of its electrode */
+TEST_CASE(SpikeTrain, conductionDelays)
+{
+	const int electrodes[] = { 0, 5, 17, 383 };
+	const int channels = 4;
+	const int64_t duration = 3000;
+	const std::vector<int64_t> onsets = { 100, 1200 };
+
+	//0.1 ms per electrode: 3 samples at 30 kHz
+	ActionPotentialTrain train;
+	train.prepare(TRAIN_SAMPLE_RATE, channels, electrodes, 1, SpikeTrainSettings{ ActionPotentialTrain::TTL_TRIGGER, 0.0f, 0.1f });
+
+	for (int64_t onset : onsets)
+		train.schedule(onset);
+
+	const std::vector<float> output = renderTrain(train, channels, duration, 128);
+
+	for (int j = 0; j < channels; j++)
+	{
+		CHECK(train.getDelay(j) == 3 * electrodes[j]);
+		CHECK(findOnsets(output, channels, j) == std::vector<int64_t>({ 100 + 3 * electrodes[j], 1200 + 3 * electrodes[j] }));
+	}
+
+	CHECK(output == expectTrain(train, channels, duration, onsets));
+}
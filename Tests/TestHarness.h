@@ -0,0 +1,90 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Allen Institute for Brain Science and Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __TESTHARNESS_H__
+#define __TESTHARNESS_H__
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+/**
+
+	Minimal test registry for the generation core tests. A test case belongs to a group (one
+	CTest test per group); failed checks are reported with their location and the case carries on.
+
+*/
+
+namespace SourceSimTests
+{
+
+typedef void (*TestFunction)();
+
+struct TestCase
+{
+	const char* group;
+	const char* name;
+	TestFunction function;
+};
+
+inline std::vector<TestCase>& getTestCases()
+{
+	static std::vector<TestCase> cases;
+	return cases;
+}
+
+inline int& getFailureCount()
+{
+	static int failures = 0;
+	return failures;
+}
+
+struct TestRegistration
+{
+	TestRegistration(const char* group, const char* name, TestFunction function)
+	{
+		getTestCases().push_back(TestCase{ group, name, function });
+	}
+};
+
+inline void reportFailure(const char* file, int line, const char* expression)
+{
+	std::printf("  FAILED %s:%d: %s\n", file, line, expression);
+	getFailureCount()++;
+}
+
+}
+
+#define TEST_CASE(group, name) \
+	static void group##_##name(); \
+	static SourceSimTests::TestRegistration group##_##name##Registration(#group, #name, group##_##name); \
+	static void group##_##name()
+
+#define CHECK(condition) \
+	do { if (!(condition)) SourceSimTests::reportFailure(__FILE__, __LINE__, #condition); } while (false)
+
+#define CHECK_NEAR(a, b, tolerance) \
+	do { if (!(std::fabs((double)(a) - (double)(b)) <= (double)(tolerance))) SourceSimTests::reportFailure(__FILE__, __LINE__, #a " ~ " #b); } while (false)
+
+#endif  // __TESTHARNESS_H__
@@ -0,0 +1,60 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Allen Institute for Brain Science and Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "TestHarness.h"
+
+/* Runs every test case of the groups named on the command line (all groups if none) */
+int main(int argc, char** argv)
+{
+	int run = 0;
+
+	for (const SourceSimTests::TestCase& test : SourceSimTests::getTestCases())
+	{
+		bool selected = argc < 2;
+
+		for (int i = 1; i < argc && !selected; i++)
+			selected = std::strcmp(argv[i], test.group) == 0;
+
+		if (!selected)
+			continue;
+
+		const int failuresBefore = SourceSimTests::getFailureCount();
+
+		std::printf("%s.%s\n", test.group, test.name);
+		test.function();
+		run++;
+
+		if (SourceSimTests::getFailureCount() > failuresBefore)
+			std::printf("  -> failed\n");
+	}
+
+	if (run == 0)
+	{
+		std::printf("No test cases selected\n");
+		return 1;
+	}
+
+	std::printf("%d test cases, %d failed checks\n", run, SourceSimTests::getFailureCount());
+
+	return SourceSimTests::getFailureCount() == 0 ? 0 : 1;
+}
@@ -0,0 +1,153 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Allen Institute for Brain Science and Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __TESTSOURCES_H__
+#define __TESTSOURCES_H__
+
+#include "GenerationStages.h"
+#include "ProbeGeometry.h"
+#include "SourceTypes.h"
+
+#include <cstring>
+
+/**
+
+	The simulator's source types (NPX_AP_BAND, NPX_LFP_BAND, NPX2_WIDEBAND and NIDAQ in
+	SourceSim.h) without the JUCE thread around them: the same getSourceType settings and
+	waveform, fed to the same ContinuousPipeline the way SourceSim::prepare does.
+
+*/
+
+namespace SourceSimTests
+{
+
+inline int findSourceType(const char* name)
+{
+	for (int type = 0; type < NUM_SOURCE_TYPES; type++)
+	{
+		if (std::strcmp(name, getSourceType(type).name) == 0)
+			return type;
+	}
+
+	return -1;
+}
+
+class TestSource
+{
+public:
+
+	TestSource(int type_, int channels, uint32_t seed_ = 0) :
+		type(type_),
+		numChannels(channels),
+		seed(seed_),
+		sampleRate(getSourceType(type_).sampleRate),
+		probeType(getSourceType(type_).probeType),
+		background(BackgroundSettings{ 0.0f, 2.0f, 0.0f }),
+		oscillations(OscillationSettings()),
+		frontEnd(FrontEndSettings{ 0.0f, 0.0f, 0.0f, 0.0f, 0.0f })
+	{
+		const SourceTypeDescription& description = getSourceType(type);
+
+		pipeline.stage<SPATIAL_STAGE>().setSourceDensity(description.unitDensity, description.lfpDensity, 0);
+		pipeline.stage<GAIN_STAGE>().setGain(1.0f, description.gainSpread);
+
+		if (description.carriesLfp)
+		{
+			background = DEFAULT_LFP_BACKGROUND;
+			oscillations = getDefaultOscillations();
+		}
+
+		waveform.resize((size_t)getWaveformLength() * numChannels);
+		renderSourceWaveform(description, sampleRate, waveform.data(), getWaveformLength(), numChannels, nullptr);
+
+		prepare();
+	}
+
+	/* Re-reads the configuration; also restarts filters and event tracking, as SourceSim::reset does */
+	void prepare()
+	{
+		getSitePositions(probeType, numChannels, positions);
+
+		SourceSimPipeline::StageContext context;
+		context.numChannels = numChannels;
+		context.sampleRate = sampleRate;
+		context.seed = seed;
+		context.channelMap = nullptr;
+		context.sitePositions = positions.empty() ? nullptr : positions.data();
+		context.numElectrodes = numChannels;
+		context.drift = nullptr;
+		context.background = background.isEnabled() ? &background : nullptr;
+		context.oscillations = oscillations.isEnabled() ? &oscillations : nullptr;
+		context.frontEnd = frontEnd.isEnabled() ? &frontEnd : nullptr;
+		context.waveform = waveform.data();
+		context.waveformLength = getWaveformLength();
+		context.templates = nullptr;
+		context.numTemplates = 0;
+		context.templateElectrodes = 0;
+		context.templateLength = 0;
+
+		pipeline.prepare(context);
+	}
+
+	/* Generates numSamples interleaved samples starting at absolute sample firstSample */
+	void render(float* dest, int numSamples, int64_t firstSample)
+	{
+		pipeline.process(dest, numChannels, numSamples, firstSample);
+	}
+
+	int getWaveformLength() const { return getPeriodLength(sampleRate, getSourceType(type).waveformFrequency); }
+
+	int type;
+	int numChannels;
+	uint32_t seed;
+	float sampleRate;
+	int probeType;
+
+	ContinuousPipeline pipeline;
+
+	BackgroundSettings background;
+	OscillationSettings oscillations;
+	FrontEndSettings frontEnd;
+	std::vector<float> positions;
+
+	/* One period of the cached waveform, [sample][channel] */
+	std::vector<float> waveform;
+};
+
+/* Renders durationSamples in packets of packetSize (the last one shorter) into one buffer */
+inline std::vector<float> renderInPackets(TestSource& source, int64_t durationSamples, int packetSize)
+{
+	std::vector<float> output((size_t)durationSamples * source.numChannels);
+
+	for (int64_t first = 0; first < durationSamples; first += packetSize)
+	{
+		const int count = (int)std::min<int64_t>(packetSize, durationSamples - first);
+		source.render(output.data() + (size_t)first * source.numChannels, count, first);
+	}
+
+	return output;
+}
+
+}
+
+#endif  // __TESTSOURCES_H__
@@ -0,0 +1,178 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Allen Institute for Brain Science and Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "TestHarness.h"
+#include "TtlClock.h"
+
+#include <cstdlib>
+
+/* Without jitter, edge k of a 1 Hz clock at 30 kHz falls on sample k * 15000 */
+TEST_CASE(TtlClock, edgesAtNominalSamples)
+{
+	TtlClock clock;
+	clock.configure(30000.0, 1.0, 0.0, 0, 0);
+
+	for (int64_t k = 1; k <= 100; k++)
+		CHECK(clock.getEdgeSample(k) == k * 15000);
+
+	CHECK(clock.getLevel(0) == 0);
+	CHECK(clock.getLevel(14999) == 0);
+	CHECK(clock.getLevel(15000) == 1);
+	CHECK(clock.getLevel(29999) == 1);
+	CHECK(clock.getLevel(30000) == 0);
+}
+
+/* A restarted clock counts its edges from the new origin and level */
+TEST_CASE(TtlClock, origin)
+{
+	TtlClock clock;
+	clock.configure(2500.0, 10.0, 0.0, 1000, 1);
+
+	CHECK(clock.getLevel(999) == 1);
+	CHECK(clock.getLevel(1000) == 1);
+	CHECK(clock.getEdgeSample(1) == 1125);
+	CHECK(clock.getLevel(1125) == 0);
+	CHECK(clock.getLevel(1250) == 1);
+}
+
+/* Filling packet by packet gives the same levels as evaluating every sample, whatever the packet
+   sizes, and reports each rising and falling edge in the packet that contains it */
+TEST_CASE(TtlClock, fillAcrossPackets)
+{
+	for (double tolerance : { 0.0, 0.05 })
+	{
+		TtlClock clock;
+		clock.configure(30000.0, 7.0, tolerance, 0, 0);
+
+		const int sizes[] = { 1, 500, 37, 4096, 3, 12000 };
+		std::vector<uint64_t> codes(12000);
+
+		int64_t first = 0;
+		bool levelsMatch = true;
+		bool edgesMatch = true;
+
+		for (int p = 0; first < 300000; p++)
+		{
+			const int count = sizes[p % 6];
+			int64_t falling = -1;
+			const int64_t rising = clock.fill(codes.data(), first, count, &falling);
+
+			int64_t expectedRising = -1;
+			int64_t expectedFalling = -1;
+
+			for (int i = 0; i < count; i++)
+			{
+				const int level = clock.getLevel(first + i);
+				levelsMatch &= (int)codes[i] == level;
+
+				if (level != clock.getLevel(first + i - 1) && first + i > 0)
+				{
+					if (level)
+						expectedRising = first + i;
+					else
+						expectedFalling = first + i;
+				}
+			}
+
+			edgesMatch &= rising == expectedRising && falling == expectedFalling;
+			first += count;
+		}
+
+		CHECK(levelsMatch);
+		CHECK(edgesMatch);
+	}
+}
+
+/* Stepping from edge to edge finds exactly the rising edges of the filled levels, including edges on
+   the first sample of a range, with or without jitter and whatever the origin level */
+TEST_CASE(TtlClock, risingEdges)
+{
+	for (int level : { 0, 1 })
+	{
+		for (double tolerance : { 0.0, 0.05 })
+		{
+			TtlClock clock;
+			clock.configure(30000.0, 7.0, tolerance, 1000, level);
+
+			const int sizes[] = { 1, 500, 37, 4096, 3, 12000 };
+			bool edgesMatch = true;
+
+			for (int64_t first = 0, p = 0; first < 300000; first += sizes[p++ % 6])
+			{
+				const int count = sizes[p % 6];
+				std::vector<int64_t> expected, found;
+
+				for (int64_t n = first; n < first + count; n++)
+				{
+					if (clock.getLevel(n) == 1 && clock.getLevel(n - 1) == 0 && n > 1000)
+						expected.push_back(n);
+				}
+
+				clock.forEachRisingEdge(first, count, [&found](int64_t n) { found.push_back(n); });
+				edgesMatch &= found == expected;
+			}
+
+			CHECK(edgesMatch);
+		}
+	}
+}
+
+/* Jitter moves edges by less than a quarter period, so they never reorder */
+TEST_CASE(TtlClock, jitterIsBounded)
+{
+	TtlClock clock;
+	clock.configure(30000.0, 100.0, 50.0, 0, 0);
+
+	const int64_t halfPeriod = 150;
+	bool bounded = true;
+	bool ordered = true;
+	bool jittered = false;
+
+	for (int64_t k = 1; k <= 10000; k++)
+	{
+		const int64_t edge = clock.getEdgeSample(k);
+		bounded &= std::llabs(edge - k * halfPeriod) <= halfPeriod / 4 + 1;
+		ordered &= edge > clock.getEdgeSample(k - 1);
+		jittered |= edge != k * halfPeriod;
+	}
+
+	CHECK(bounded);
+	CHECK(ordered);
+	CHECK(jittered);
+}
+
+/* A clock without a frequency holds its level */
+TEST_CASE(TtlClock, heldLevel)
+{
+	TtlClock clock;
+	clock.configure(30000.0, 0.0, 0.0, 0, 1);
+
+	uint64_t codes[64];
+	CHECK(clock.fill(codes, 12345, 64) == -1);
+
+	bool held = true;
+	for (uint64_t code : codes)
+		held &= code == 1;
+
+	CHECK(held);
+}